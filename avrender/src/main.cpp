@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "av_writer.h"
+#include "movie.h"
+#include "nes.h"
+#include "ntsc_palette.h"
+#include "rgba_converter.h"
+
+/*
+    Offline renderer: runs a ROM headless, optionally replaying an input movie, as fast as it will go and writes the audio and video
+    to files (see AvWriter for the formats). Reports how many times faster than real time the run went, both overall and for the
+    emulation alone.
+*/
+
+
+template<typename F>
+void die(const F& f)
+{
+    f();
+    exit(1);
+}
+
+
+void usage()
+{
+    printf("Usage:\n");
+    printf("\tavrender [options] rom\n");
+    printf("\t-m movie      FCEUX .fm2 input movie\n");
+    printf("\t-n frames     number of frames to render (default: the length of the movie)\n");
+    printf("\t-w file       write the audio to a WAV file\n");
+    printf("\t-v file       write the video to a raw RGBA32 file\n");
+    printf("\t-a file       write the video and audio to an AVI file\n");
+    printf("\t-r rate       audio sample rate (default: 48000)\n");
+    printf("\t-q quality    audio synthesis quality, 0-2 (default: 1)\n");
+    printf("\t-p palette    64 or 512 entry .pal file (default: built in NTSC palette)\n");
+}
+
+
+// The PPU's frame rate as a fraction of the master clock, NTSC frames average half a dot short because of the odd frame skip
+template <class Timing>
+void frame_rate(uint32_t& rate, uint32_t& scale)
+{
+    rate = Timing::MasterClock;
+    scale = Timing::PpuDivider * 341 * (Timing::LastScanline + 2) - (Timing::SkipOddFrameDot ? Timing::PpuDivider / 2 : 0);
+}
+
+
+int main(int argc, char** argv)
+{
+    std::string rom;
+    std::string movie_path;
+    std::string palette_path;
+    uint32_t frames = 0;
+    uint32_t quality = 1;
+    AvWriter::Settings settings;
+    settings.sample_rate = 48000;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+
+        if (arg[0] == '-')
+        {
+            if (arg.size() != 2 || ++i == argc)
+            {
+                die(usage);
+            }
+
+            switch (arg[1])
+            {
+                case 'm': movie_path = argv[i]; break;
+                case 'n': frames = uint32_t(strtoul(argv[i], nullptr, 10)); break;
+                case 'w': settings.wav_path = argv[i]; break;
+                case 'v': settings.video_path = argv[i]; break;
+                case 'a': settings.avi_path = argv[i]; break;
+                case 'r': settings.sample_rate = uint32_t(strtoul(argv[i], nullptr, 10)); break;
+                case 'q': quality = uint32_t(strtoul(argv[i], nullptr, 10)); break;
+                case 'p': palette_path = argv[i]; break;
+                default: die(usage);
+            }
+        }
+        else if (rom.empty())
+        {
+            rom = arg;
+        }
+        else
+        {
+            die(usage);
+        }
+    }
+
+    std::vector<MovieFrame> movie;
+
+    if (!movie_path.empty() && !read_movie(movie_path, movie))
+    {
+        die([&]() { printf("Unable to read movie [%s]\n", movie_path.c_str()); });
+    }
+
+    frames = frames ? frames : uint32_t(movie.size());
+
+    if (rom.empty() || !frames || quality > 2 || !settings.sample_rate)
+    {
+        die(usage);
+    }
+
+    RgbaConverter converter;
+
+    if (palette_path.empty() ? !converter.set_palette(ntsc_palette, sizeof(ntsc_palette)) : !converter.load_palette(palette_path))
+    {
+        die([&]() { printf("Unable to load palette [%s]\n", palette_path.c_str()); });
+    }
+
+    std::unique_ptr<Nes> nes = std::make_unique<Nes>();
+
+    if (!nes->load_game_pak(rom))
+    {
+        die([&]() { printf("Unable to load [%s]\n", rom.c_str()); });
+    }
+
+    nes->_ppu.set_emphasis_output(true);
+    nes->_apu.set_sample_rate(settings.sample_rate, BlipBuffer::Quality(quality));
+    nes->reset(true);
+
+    switch (nes->region())
+    {
+        case Region::Pal: frame_rate<PalTiming>(settings.frame_rate, settings.frame_scale); break;
+        case Region::Dendy: frame_rate<DendyTiming>(settings.frame_rate, settings.frame_scale); break;
+        default: frame_rate<NtscTiming>(settings.frame_rate, settings.frame_scale); break;
+    }
+
+    settings.palette = converter.lut();
+    AvWriter writer;
+
+    if (!writer.open(settings))
+    {
+        die([&]() { printf("%s\n", writer.error().c_str()); });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t frame = 0; frame < frames; ++frame)
+    {
+        if (frame < movie.size())
+        {
+            if (movie[frame].commands & 3)
+                nes->reset((movie[frame].commands & 2) != 0);
+
+            nes->joy1.buttons = movie[frame].buttons[0];
+            nes->joy2.buttons = movie[frame].buttons[1];
+        }
+
+        nes->run_frame();
+        writer.write_frame(nes->_ppu._screen9.data(), nes->_apu.samples());
+    }
+
+    auto emulated = std::chrono::steady_clock::now();
+    bool written = writer.close();
+    auto finished = std::chrono::steady_clock::now();
+
+    double seconds = double(frames) * settings.frame_scale / settings.frame_rate;
+    double emulation_time = std::chrono::duration<double>(emulated - start).count();
+    double total_time = std::chrono::duration<double>(finished - start).count();
+
+    printf("%u frames (%.2fs) in %.2fs: %.1fx real time (emulation alone %.1fx), waited for the writer %u times\n", frames, seconds,
+        total_time, seconds / total_time, seconds / emulation_time, writer.stalls());
+
+    if (!written)
+    {
+        die([&]() { printf("%s\n", writer.error().c_str()); });
+    }
+
+    return 0;
+}
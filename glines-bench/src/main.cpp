@@ -0,0 +1,1023 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gamepak.h"
+#include "gli2a03.h"
+#include "gli2a03_instructions.h"
+#include "gli2c02.h"
+#include "flat_lockstep_cpu.h"
+#include "nes.h"
+
+#if defined(_WIN32)
+#include "vgfw.h"
+#endif
+
+/*
+    Component microbenchmarks: each one drives a single part of the emulator (the CPU, the PPU, a mapper, ...) in isolation on
+    synthetic input built the same way every run, so the numbers only move when the code does.
+
+    A benchmark is a function running a given number of operations (instructions, frames, reads, ...). It's calibrated to take about
+    the target sample time, then timed over a number of samples; the median time per operation is reported along with the spread of
+    the samples (their standard deviation as a percentage of the mean) and the fastest one.
+
+    Results can be written to a baseline file (-w) and later runs compared against it (-b). A benchmark slower than its baseline by more
+    than the threshold is reported as a regression and the exit code is non-zero, so this can gate a build. Baselines are only
+    comparable on the same machine and build configuration.
+
+    -v checks the flat memory lockstep CPU experiment against gli2A03 instead of timing anything (see verify_lockstep()).
+*/
+
+
+template<typename F>
+void die(const F& f)
+{
+    f();
+    exit(1);
+}
+
+
+void usage()
+{
+    printf("Usage:\n");
+    printf("\tglines-bench [options]\n");
+    printf("\t-f filter     only run benchmarks whose name contains this\n");
+    printf("\t-n samples    number of timed samples per benchmark (default: 15)\n");
+    printf("\t-t ms         target time per sample in milliseconds (default: 20)\n");
+    printf("\t-b file       compare against a baseline written by -w\n");
+    printf("\t-r percent    slowdown against the baseline reported as a regression (default: 10)\n");
+    printf("\t-w file       write the results as a baseline\n");
+    printf("\t-l            list the benchmarks\n");
+    printf("\t-v            check the flat memory lockstep CPU against gli2A03 and exit\n");
+}
+
+
+// Sink for values computed by the benchmarks, so the work can't be optimized away
+volatile uint32_t g_sink;
+
+
+// Small deterministic generator for the synthetic inputs (xorshift32)
+class Random
+{
+public:
+    explicit Random(uint32_t seed) : _state(seed) {}
+
+    uint32_t next()
+    {
+        _state ^= _state << 13;
+        _state ^= _state >> 17;
+        _state ^= _state << 5;
+        return _state;
+    }
+
+    uint32_t next(uint32_t range) { return next() % range; }
+
+private:
+    uint32_t _state;
+};
+
+
+// An iNES image with random PRG and CHR ROM contents
+std::string ines_image(uint8_t mapper, uint8_t prg_banks, uint8_t chr_banks, uint32_t seed)
+{
+    std::string image(16 + prg_banks * size_t(0x4000) + chr_banks * size_t(0x2000), '\0');
+    image[0] = 'N';
+    image[1] = 'E';
+    image[2] = 'S';
+    image[3] = 0x1A;
+    image[4] = char(prg_banks);
+    image[5] = char(chr_banks);
+    image[6] = char(((mapper & 0x0F) << 4) | 1);
+    image[7] = char(mapper & 0xF0);
+
+    Random random(seed);
+
+    for (size_t i = 16; i < image.size(); ++i)
+    {
+        image[i] = char(random.next());
+    }
+
+    return image;
+}
+
+
+std::shared_ptr<GamePak> load_image(const std::string& image)
+{
+    std::shared_ptr<GamePak> game_pak = std::make_shared<GamePak>();
+    std::istringstream is(image);
+
+    if (!game_pak->load(is))
+    {
+        die([]() { printf("Unable to load synthetic game pak\n"); });
+    }
+
+    game_pak->reset(true);
+    return game_pak;
+}
+
+
+/*
+    CPU on a flat 64KB of RAM, running a long straight line of randomly chosen instructions from a mix and jumping back to the start.
+    Everything the program writes stays below $0800 and it only reads zero page pointers it doesn't write, so it runs forever. One
+    instruction starts on each clock which changes the PC; branches are never to themselves, so that counts instructions exactly.
+*/
+class CpuRig
+{
+public:
+    enum Mode : uint8_t
+    {
+        Implied,
+        Immediate,
+        ZeroPage,       // Read or written, $00-$7F
+        ZeroPageX,      // Read only, anywhere in zero page
+        Absolute,       // $0200-$06FF, plus up to $FF when indexed
+        IndirectY,      // Through one of the pointers at $80-$FF
+        Branch,         // To the next instruction, whether taken or not
+        Jump,           // JMP to the next instruction
+        Subroutine,     // JSR to an RTS
+        PushPull,       // PHA then PLA
+    };
+
+    struct Op
+    {
+        uint8_t opcode;
+        Mode mode;
+    };
+
+    static constexpr uint16_t ProgramStart = 0x8000;
+    static constexpr uint16_t ProgramEnd = 0xF000;
+    static constexpr uint16_t SubroutineAddress = 0xF000;
+
+    std::vector<uint8_t> memory;
+    std::vector<uint16_t> instructions;  // Address of every instruction in the program
+    gli2A03 cpu;
+
+
+    CpuRig(const std::vector<Op>& mix, uint32_t seed)
+        : memory(0x10000, 0xEA)
+    {
+        Random random(seed);
+
+        for (uint16_t addr = 0x80; addr < 0x100; addr += 2)
+        {
+            uint16_t pointer = uint16_t(0x0300 + random.next(0x400));
+            memory[addr] = uint8_t(pointer);
+            memory[addr + 1] = uint8_t(pointer >> 8);
+        }
+
+        uint16_t pc = ProgramStart;
+
+        while (pc < ProgramEnd - 8)
+        {
+            const Op& op = mix[random.next(uint32_t(mix.size()))];
+            instructions.push_back(pc);
+            memory[pc++] = op.opcode;
+
+            switch (op.mode)
+            {
+                case Implied: break;
+                case Immediate: memory[pc++] = uint8_t(random.next()); break;
+                case ZeroPage: memory[pc++] = uint8_t(random.next(0x80)); break;
+                case ZeroPageX: memory[pc++] = uint8_t(random.next()); break;
+                case IndirectY: memory[pc++] = uint8_t(0x80 + random.next(0x40) * 2); break;
+                case Branch: memory[pc++] = 0; break;
+                case Absolute: pc = emit_word(pc, uint16_t(0x0200 + random.next(0x500))); break;
+                case Jump: pc = emit_word(pc, uint16_t(pc + 2)); break;
+                case Subroutine: pc = emit_word(pc, SubroutineAddress); break;
+                case PushPull:
+                {
+                    instructions.push_back(pc);
+                    memory[pc++] = 0x68;
+                    break;
+                }
+            }
+        }
+
+        instructions.push_back(pc);
+        memory[pc] = 0x4C;
+        emit_word(pc + 1, ProgramStart);
+        memory[SubroutineAddress] = 0x60;
+        emit_word(0xFFFA, ProgramStart);
+        emit_word(0xFFFC, ProgramStart);
+        emit_word(0xFFFE, ProgramStart);
+
+        cpu.connect([this](uint16_t addr) { return memory[addr]; }, [this](uint16_t addr, uint8_t data) { memory[addr] = data; });
+        cpu.reset(true);
+    }
+
+
+    void run(uint64_t count)
+    {
+        while (count)
+        {
+            uint16_t pc = cpu._pc;
+            cpu.clock();
+            count -= (cpu._pc != pc);
+        }
+    }
+
+
+private:
+    uint16_t emit_word(uint16_t addr, uint16_t value)
+    {
+        memory[addr] = uint8_t(value);
+        memory[addr + 1] = uint8_t(value >> 8);
+        return uint16_t(addr + 2);
+    }
+};
+
+
+const std::vector<CpuRig::Op> alu_mix = {
+    { 0xA9, CpuRig::Immediate }, { 0xA2, CpuRig::Immediate }, { 0xA0, CpuRig::Immediate }, { 0x69, CpuRig::Immediate },
+    { 0xE9, CpuRig::Immediate }, { 0x29, CpuRig::Immediate }, { 0x09, CpuRig::Immediate }, { 0x49, CpuRig::Immediate },
+    { 0xC9, CpuRig::Immediate }, { 0x0A, CpuRig::Implied }, { 0x4A, CpuRig::Implied }, { 0x2A, CpuRig::Implied },
+    { 0x6A, CpuRig::Implied }, { 0xE8, CpuRig::Implied }, { 0xC8, CpuRig::Implied }, { 0xCA, CpuRig::Implied },
+    { 0x88, CpuRig::Implied }, { 0xAA, CpuRig::Implied }, { 0x8A, CpuRig::Implied }, { 0xA8, CpuRig::Implied },
+    { 0x98, CpuRig::Implied }, { 0x18, CpuRig::Implied }, { 0x38, CpuRig::Implied }, { 0x65, CpuRig::ZeroPage },
+    { 0xE5, CpuRig::ZeroPage }, { 0xA5, CpuRig::ZeroPage }, { 0x85, CpuRig::ZeroPage },
+};
+
+
+const std::vector<CpuRig::Op> memory_mix = {
+    { 0xAD, CpuRig::Absolute }, { 0x8D, CpuRig::Absolute }, { 0x6D, CpuRig::Absolute }, { 0xEE, CpuRig::Absolute },
+    { 0xCE, CpuRig::Absolute }, { 0xBD, CpuRig::Absolute }, { 0xB9, CpuRig::Absolute }, { 0x9D, CpuRig::Absolute },
+    { 0x99, CpuRig::Absolute }, { 0x1E, CpuRig::Absolute }, { 0xB1, CpuRig::IndirectY }, { 0x91, CpuRig::IndirectY },
+    { 0xB5, CpuRig::ZeroPageX }, { 0xA5, CpuRig::ZeroPage }, { 0x85, CpuRig::ZeroPage }, { 0xE6, CpuRig::ZeroPage },
+    { 0xA6, CpuRig::ZeroPage }, { 0x86, CpuRig::ZeroPage }, { 0xE8, CpuRig::Implied }, { 0xC8, CpuRig::Implied },
+};
+
+
+const std::vector<CpuRig::Op> branch_mix = {
+    { 0xD0, CpuRig::Branch }, { 0xF0, CpuRig::Branch }, { 0x10, CpuRig::Branch }, { 0x30, CpuRig::Branch },
+    { 0x90, CpuRig::Branch }, { 0xB0, CpuRig::Branch }, { 0x50, CpuRig::Branch }, { 0x70, CpuRig::Branch },
+    { 0xC9, CpuRig::Immediate }, { 0x69, CpuRig::Immediate }, { 0xE8, CpuRig::Implied }, { 0x88, CpuRig::Implied },
+    { 0x24, CpuRig::ZeroPage }, { 0x4C, CpuRig::Jump }, { 0x20, CpuRig::Subroutine }, { 0x48, CpuRig::PushPull },
+};
+
+
+/*
+    The same programs on the flat memory lockstep CPU, every lane with different work RAM so data dependent branches split the lanes
+    up. An operation is an instruction in one lane. One lane (x1) is the baseline to compare the others with: the same core on the
+    same memory, stepped the same way. The cpu benchmarks aren't comparable, gli2A03 is clocked through its bus callbacks.
+*/
+template <size_t Lanes>
+class FlatLockstepRig
+{
+public:
+    std::unique_ptr<FlatLockstepCpu<Lanes>> cpu;
+
+
+    FlatLockstepRig(const std::vector<CpuRig::Op>& mix, uint32_t seed)
+        : cpu(std::make_unique<FlatLockstepCpu<Lanes>>())
+    {
+        CpuRig program(mix, seed);
+        cpu->load(0, program.memory.data(), program.memory.size());
+        Random random(seed);
+
+        for (size_t lane = 1; lane < Lanes; ++lane)
+        {
+            for (uint16_t addr = 0; addr < 0x800; addr = (addr == 0x7F) ? 0x200 : addr + 1)
+            {
+                cpu->poke(lane, addr, uint8_t(random.next()));
+            }
+        }
+
+        cpu->reset();
+    }
+
+
+    void run(uint64_t count)
+    {
+        for (uint64_t i = 0; i < count; i += Lanes)
+        {
+            cpu->step();
+        }
+    }
+};
+
+
+/*
+    Differential check of the lockstep CPU: every lane runs the same program as its own gli2A03 on a copy of its memory, and after
+    every step the scalar CPU is clocked for the cycles the lane's instruction took, which must leave it at the end of the same
+    instruction with the same registers, and at the end all of their memory must match. A program is either one of the benchmark mixes, with each lane's RAM outside the zero page pointers randomised
+    so the lanes diverge, or entirely random bytes (all 256 opcodes, wild jumps, reads and writes anywhere) with random RAM per lane.
+*/
+template <size_t Lanes>
+bool verify_lockstep(const char* name, const std::vector<uint8_t>& program, uint32_t seed, uint32_t steps)
+{
+    struct ScalarLane
+    {
+        std::vector<uint8_t> memory;
+        gli2A03 cpu;
+    };
+
+    std::unique_ptr<FlatLockstepCpu<Lanes>> lockstep = std::make_unique<FlatLockstepCpu<Lanes>>();
+    lockstep->load(0, program.data(), program.size());
+    Random random(seed);
+
+    for (size_t lane = 1; lane < Lanes; ++lane)
+    {
+        for (uint16_t addr = 0; addr < 0x800; ++addr)
+        {
+            // Leave the pointers of the benchmark programs alone (random programs don't care)
+            (addr < 0x80 || addr >= 0x200) ? lockstep->poke(lane, addr, uint8_t(random.next())) : ((void)0);
+        }
+    }
+
+    std::vector<std::unique_ptr<ScalarLane>> lanes;
+
+    for (size_t lane = 0; lane < Lanes; ++lane)
+    {
+        lanes.push_back(std::make_unique<ScalarLane>());
+        ScalarLane* scalar = lanes.back().get();
+
+        for (uint32_t addr = 0; addr < 0x10000; ++addr)
+        {
+            scalar->memory.push_back(lockstep->peek(lane, uint16_t(addr)));
+        }
+
+        scalar->cpu.connect([scalar](uint16_t addr) { return scalar->memory[addr]; },
+            [scalar](uint16_t addr, uint8_t data) { scalar->memory[addr] = data; });
+        scalar->cpu.reset(true);
+    }
+
+    lockstep->reset();
+
+    // The scalar CPU takes 7 cycles to reset and executes an instruction on its first cycle, run it up to the first one
+    for (std::unique_ptr<ScalarLane>& lane : lanes)
+    {
+        for (int cycle = 0; cycle < 6; ++cycle)
+        {
+            lane->cpu.clock();
+        }
+    }
+
+    uint64_t instructions = 0;
+
+    for (uint32_t step = 0; step < steps; ++step)
+    {
+        std::array<uint64_t, Lanes> cycles = lockstep->_cycles;
+        lockstep->step();
+
+        for (size_t lane = 0; lane < Lanes; ++lane)
+        {
+            gli2A03& cpu = lanes[lane]->cpu;
+
+            if (cpu._stopped)
+            {
+                continue;
+            }
+
+            // STP takes no cycles in the lockstep CPU, the scalar one needs a clock to execute it
+            uint16_t pc = cpu._pc;
+            uint64_t clocks = std::max<uint64_t>(lockstep->_cycles[lane] - cycles[lane], 1);
+
+            for (uint64_t clock = 0; clock < clocks; ++clock)
+            {
+                cpu.clock();
+            }
+
+            ++instructions;
+            gli2A03::State state;
+            cpu.save_state(state);
+
+            bool match = cpu._pc == lockstep->_pc[lane] && cpu._p == lockstep->_p[lane] && cpu._a == lockstep->_a[lane] &&
+                cpu._x == lockstep->_x[lane] && cpu._y == lockstep->_y[lane] && cpu._s == lockstep->_s[lane] &&
+                cpu._stopped == (lockstep->_stopped[lane] != 0) && (cpu._stopped || state.instruction_cycles_remaining == 0);
+
+            if (!match)
+            {
+                printf("%-32s FAILED at step %u lane %zu after $%02X at $%04X\n", name, step, lane, lanes[lane]->memory[pc], pc);
+                printf("  gli2A03   PC=%04X P=%02X A=%02X X=%02X Y=%02X S=%02X cycles left=%u\n", cpu._pc, cpu._p, cpu._a, cpu._x,
+                    cpu._y, cpu._s, state.instruction_cycles_remaining);
+                printf("  lockstep  PC=%04X P=%02X A=%02X X=%02X Y=%02X S=%02X cycles=%llu\n", lockstep->_pc[lane], lockstep->_p[lane],
+                    lockstep->_a[lane], lockstep->_x[lane], lockstep->_y[lane], lockstep->_s[lane], (unsigned long long)clocks);
+                return false;
+            }
+        }
+    }
+
+    for (size_t lane = 0; lane < Lanes; ++lane)
+    {
+        for (uint32_t addr = 0; addr < 0x10000; ++addr)
+        {
+            if (lanes[lane]->memory[addr] != lockstep->peek(lane, uint16_t(addr)))
+            {
+                printf("%-32s FAILED memory differs at $%04X in lane %zu\n", name, addr, lane);
+                return false;
+            }
+        }
+    }
+
+    printf("%-32s ok  (%llu instructions, %.2f groups per step)\n", name, (unsigned long long)instructions,
+        double(lockstep->groups()) / double(lockstep->steps()));
+    return true;
+}
+
+
+int verify()
+{
+    int failures = 0;
+
+    auto mixes = { std::make_pair("alu-mix", &alu_mix), std::make_pair("memory-mix", &memory_mix), std::make_pair("branch-mix", &branch_mix) };
+
+    for (auto mix : mixes)
+    {
+        for (uint32_t seed = 1; seed <= 4; ++seed)
+        {
+            CpuRig program(*mix.second, seed);
+            std::string name = std::string("flat-lockstep/") + mix.first + "-" + std::to_string(seed);
+            failures += !verify_lockstep<8>((name + "-x8").c_str(), program.memory, seed, 20000);
+            failures += !verify_lockstep<16>((name + "-x16").c_str(), program.memory, seed, 20000);
+        }
+    }
+
+    for (uint32_t seed = 1; seed <= 16; ++seed)
+    {
+        Random random(seed * 0x9E3779B9u);
+        std::vector<uint8_t> program(0x10000);
+
+        for (uint8_t& byte : program)
+        {
+            // No BRK or STP, which stop a lane for good (they can still be reached through data the program writes)
+            do
+            {
+                byte = uint8_t(random.next());
+            } while (InstructionTable[byte].opcode == Opcode::BRK || InstructionTable[byte].opcode == Opcode::STP);
+        }
+
+        std::string name = "flat-lockstep/random-" + std::to_string(seed);
+        failures += !verify_lockstep<8>((name + "-x8").c_str(), program, seed, 5000);
+        failures += !verify_lockstep<16>((name + "-x16").c_str(), program, seed, 5000);
+    }
+
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}
+
+
+/*
+    PPU with an NROM game pak of random CHR, random nametables and palette, and a CPU which only does OAM DMA. With sprites the OAM
+    holds eight 8x16 sprites on every line of a 128 line band, the most the PPU will draw.
+*/
+class PpuRig
+{
+public:
+    std::vector<uint8_t> memory;
+    std::shared_ptr<GamePak> game_pak;
+    gli2C02 ppu;
+    gli2A03 cpu;
+
+
+    PpuRig(uint8_t mask, bool sprites)
+        : memory(0x10000, 0xEA)
+    {
+        game_pak = load_image(ines_image(0, 2, 1, 0x5EED));
+        ppu.connect_game_pak(game_pak);
+        ppu.reset(true);
+
+        // Register writes are ignored until the end of the first vblank
+        run_frames(2);
+
+        Random random(0xC0FFEE);
+        ppu.cpu_write(0x2000, 0x00);
+        ppu.cpu_write(0x2006, 0x20);
+        ppu.cpu_write(0x2006, 0x00);
+
+        for (int i = 0; i < 0x800; ++i)
+        {
+            ppu.cpu_write(0x2007, uint8_t(random.next()));
+        }
+
+        ppu.cpu_write(0x2006, 0x3F);
+        ppu.cpu_write(0x2006, 0x00);
+
+        for (int i = 0; i < 0x20; ++i)
+        {
+            ppu.cpu_write(0x2007, uint8_t(random.next(0x40)));
+        }
+
+        for (int i = 0; i < 64; ++i)
+        {
+            uint8_t* sprite = &memory[0x0200 + i * 4];
+            sprite[0] = sprites ? uint8_t(32 + (i / 8) * 16) : 0xFF;
+            sprite[1] = uint8_t(random.next());
+            sprite[2] = uint8_t(random.next() & 0xE3);
+            sprite[3] = uint8_t((i % 8) * 30 + random.next(8));
+        }
+
+        cpu.connect([this](uint16_t addr) { return memory[addr]; },
+            [this](uint16_t addr, uint8_t data) { addr == 0x2004 ? ppu.cpu_write(addr, data) : (void)(memory[addr] = data); });
+        cpu.reset(true);
+        oam_dma(1);
+
+        ppu.cpu_write(0x2005, 0x00);
+        ppu.cpu_write(0x2005, 0x00);
+        ppu.cpu_write(0x2000, 0x20);
+        ppu.cpu_write(0x2001, mask);
+        run_frames(1);
+    }
+
+
+    void run_frames(uint64_t count)
+    {
+        for (; count; --count)
+        {
+            uint32_t frame = ppu.frame_number();
+
+            while (ppu.frame_number() == frame)
+            {
+                ppu.clock<NtscTiming>();
+            }
+        }
+    }
+
+
+    // How the system advances the PPU while rendering is disabled
+    void advance_frames(uint64_t count)
+    {
+        for (; count; --count)
+        {
+            uint32_t frame = ppu.frame_number();
+
+            while (ppu.frame_number() == frame)
+            {
+                ppu.advance<NtscTiming>(ppu.idle_clocks<NtscTiming>());
+            }
+        }
+    }
+
+
+    void oam_dma(uint64_t count)
+    {
+        for (; count; --count)
+        {
+            ppu.cpu_write(0x2003, 0x00);
+            cpu.dma(0x02);
+
+            while (cpu.dma_active())
+            {
+                cpu.clock();
+            }
+        }
+    }
+};
+
+
+// Game pak reads from the CPU and the PPU, spread over the whole of the PRG and CHR windows (mappers may look at the CPU and PPU)
+class MapperRig
+{
+public:
+    std::shared_ptr<GamePak> game_pak;
+    gli2A03 cpu;
+    gli2C02 ppu;
+
+
+    MapperRig(uint8_t mapper)
+    {
+        game_pak = load_image(ines_image(mapper, 16, 16, mapper));
+        game_pak->connect(&cpu, &ppu);
+        ppu.connect_game_pak(game_pak);
+        ppu.reset(true);
+        game_pak->reset(true);
+    }
+
+
+    void cpu_reads(uint64_t count)
+    {
+        uint32_t sum = 0;
+
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            sum += game_pak->cpu_read(uint16_t(0x8000 | ((i * 0x3B5) & 0x7FFF)));
+        }
+
+        g_sink = sum;
+    }
+
+
+    void ppu_reads(uint64_t count)
+    {
+        uint32_t sum = 0;
+
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            uint8_t value = 0;
+            game_pak->ppu_read(uint16_t((i * 0x3B5) & 0x1FFF), value);
+            sum += value;
+        }
+
+        g_sink = sum;
+    }
+};
+
+
+// The whole console on an MMC1 board with PRG and CHR RAM, the most an iNES image's state has to copy, part way through running random
+// code
+class NesRig
+{
+public:
+    std::unique_ptr<Nes> nes = std::make_unique<Nes>();
+    std::unique_ptr<Nes::State> state = std::make_unique<Nes::State>();
+
+
+    NesRig()
+    {
+        std::istringstream is(ines_image(1, 16, 0, 0x5A7E));
+
+        if (!nes->load_game_pak(is))
+        {
+            die([]() { printf("Unable to load synthetic game pak\n"); });
+        }
+
+        nes->reset(true);
+
+        for (int frame = 0; frame < 10; ++frame)
+        {
+            nes->run_frame();
+        }
+
+        nes->save_state(*state);
+    }
+
+
+    void save_states(uint64_t count)
+    {
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            nes->save_state(*state);
+        }
+
+        g_sink = state->size;
+    }
+
+
+    void load_states(uint64_t count)
+    {
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            nes->load_state(*state);
+        }
+    }
+};
+
+
+#if defined(_WIN32)
+// The front end's display, scaling the PPU's screen up the way it draws the TV (the window is created but never shown)
+class DisplayRig : public Vgfw
+{
+public:
+    static constexpr int DisplayScale = 3;
+
+    std::vector<uint8_t> screen;
+
+
+    DisplayRig()
+        : screen(256 * 240)
+    {
+        Random random(0xD15);
+
+        for (uint8_t& pixel : screen)
+        {
+            pixel = uint8_t(random.next(0x40));
+        }
+
+        if (!initialize(L"glines-bench", 32 + 256 * DisplayScale, 32 + 240 * DisplayScale, 1))
+        {
+            die([]() { printf("Unable to create display\n"); });
+        }
+    }
+
+
+    bool on_create() override { return true; }
+    void on_destroy() override {}
+    bool on_update(float) override { return true; }
+
+
+    void copy_frames(uint64_t count)
+    {
+        for (; count; --count)
+        {
+            for (int line = 0; line < 240; ++line)
+            {
+                copy_rect_scaled(16, 16 + line * DisplayScale, 256 * DisplayScale, DisplayScale, screen.data() + line * 256, 256, DisplayScale);
+            }
+        }
+    }
+};
+#endif
+
+
+struct Benchmark
+{
+    std::string name;
+    const char* unit;
+    std::function<void(uint64_t count)> run;
+};
+
+
+struct Result
+{
+    double median = 0.0;    // ns per operation
+    double min = 0.0;
+    double spread = 0.0;    // Standard deviation as a percentage of the mean
+};
+
+
+std::vector<Benchmark> benchmarks(const std::string& filter)
+{
+    std::vector<Benchmark> all;
+
+    auto add = [&](const std::string& name, const char* unit, auto make_rig, auto run) {
+        if (name.find(filter) != std::string::npos)
+        {
+            // Rigs are only built for the benchmarks which are going to run
+            auto rig = make_rig();
+            all.push_back({ name, unit, [rig, run](uint64_t count) { run(*rig, count); } });
+        }
+    };
+
+    auto cpu = [](const std::vector<CpuRig::Op>& mix) { return [&mix]() { return std::make_shared<CpuRig>(mix, 0x6502); }; };
+    auto ppu = [](uint8_t mask, bool sprites) { return [=]() { return std::make_shared<PpuRig>(mask, sprites); }; };
+    auto mapper = [](uint8_t number) { return [=]() { return std::make_shared<MapperRig>(number); }; };
+    auto nes = []() { return std::make_shared<NesRig>(); };
+
+    add("cpu/alu-mix", "instruction", cpu(alu_mix), [](CpuRig& rig, uint64_t count) { rig.run(count); });
+    add("cpu/memory-mix", "instruction", cpu(memory_mix), [](CpuRig& rig, uint64_t count) { rig.run(count); });
+    add("cpu/branch-mix", "instruction", cpu(branch_mix), [](CpuRig& rig, uint64_t count) { rig.run(count); });
+    auto flat1 = [](const std::vector<CpuRig::Op>& mix) { return [&mix]() { return std::make_shared<FlatLockstepRig<1>>(mix, 0x6502); }; };
+    auto flat8 = [](const std::vector<CpuRig::Op>& mix) { return [&mix]() { return std::make_shared<FlatLockstepRig<8>>(mix, 0x6502); }; };
+    auto flat16 = [](const std::vector<CpuRig::Op>& mix) { return [&mix]() { return std::make_shared<FlatLockstepRig<16>>(mix, 0x6502); }; };
+    auto run1 = [](FlatLockstepRig<1>& rig, uint64_t count) { rig.run(count); };
+    auto run8 = [](FlatLockstepRig<8>& rig, uint64_t count) { rig.run(count); };
+    auto run16 = [](FlatLockstepRig<16>& rig, uint64_t count) { rig.run(count); };
+    add("flat-lockstep/alu-mix-x1", "lane instruction", flat1(alu_mix), run1);
+    add("flat-lockstep/alu-mix-x8", "lane instruction", flat8(alu_mix), run8);
+    add("flat-lockstep/alu-mix-x16", "lane instruction", flat16(alu_mix), run16);
+    add("flat-lockstep/memory-mix-x1", "lane instruction", flat1(memory_mix), run1);
+    add("flat-lockstep/memory-mix-x8", "lane instruction", flat8(memory_mix), run8);
+    add("flat-lockstep/memory-mix-x16", "lane instruction", flat16(memory_mix), run16);
+    add("flat-lockstep/branch-mix-x1", "lane instruction", flat1(branch_mix), run1);
+    add("flat-lockstep/branch-mix-x8", "lane instruction", flat8(branch_mix), run8);
+    add("flat-lockstep/branch-mix-x16", "lane instruction", flat16(branch_mix), run16);
+    add("cpu/disassemble", "call", cpu(memory_mix), [](CpuRig& rig, uint64_t count) {
+        uint32_t sum = 0;
+
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            sum += uint32_t(rig.cpu.disassemble(rig.instructions[i % rig.instructions.size()]).size());
+        }
+
+        g_sink = sum;
+    });
+    add("cpu/oam-dma", "transfer", ppu(0x00, true), [](PpuRig& rig, uint64_t count) { rig.oam_dma(count); });
+    add("ppu/frame-rendering-off", "frame", ppu(0x00, false), [](PpuRig& rig, uint64_t count) { rig.run_frames(count); });
+    add("ppu/frame-rendering-off-advance", "frame", ppu(0x00, false), [](PpuRig& rig, uint64_t count) { rig.advance_frames(count); });
+    add("ppu/frame-background", "frame", ppu(0x0A, false), [](PpuRig& rig, uint64_t count) { rig.run_frames(count); });
+    add("ppu/frame-8-sprites-per-line", "frame", ppu(0x1E, true), [](PpuRig& rig, uint64_t count) { rig.run_frames(count); });
+    add("mapper_001/cpu-read", "read", mapper(1), [](MapperRig& rig, uint64_t count) { rig.cpu_reads(count); });
+    add("mapper_001/ppu-read", "read", mapper(1), [](MapperRig& rig, uint64_t count) { rig.ppu_reads(count); });
+    add("mapper_004/cpu-read", "read", mapper(4), [](MapperRig& rig, uint64_t count) { rig.cpu_reads(count); });
+    add("mapper_004/ppu-read", "read", mapper(4), [](MapperRig& rig, uint64_t count) { rig.ppu_reads(count); });
+    add("nes/save-state", "state", nes, [](NesRig& rig, uint64_t count) { rig.save_states(count); });
+    add("nes/load-state", "state", nes, [](NesRig& rig, uint64_t count) { rig.load_states(count); });
+
+#if defined(_WIN32)
+    add("vgfw/copy-rect-scaled", "frame", []() { return std::make_shared<DisplayRig>(); },
+        [](DisplayRig& rig, uint64_t count) { rig.copy_frames(count); });
+#endif
+
+    return all;
+}
+
+
+double time_ns(const Benchmark& benchmark, uint64_t count)
+{
+    auto start = std::chrono::steady_clock::now();
+    benchmark.run(count);
+    auto finish = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(finish - start).count();
+}
+
+
+Result measure(const Benchmark& benchmark, uint32_t samples, double target_ns)
+{
+    // Double the count until a run takes a measurable fraction of the target, then scale it up to the target (this warms up too)
+    uint64_t count = 1;
+    double elapsed = time_ns(benchmark, count);
+
+    while (elapsed < target_ns / 8)
+    {
+        count *= 2;
+        elapsed = time_ns(benchmark, count);
+    }
+
+    count = std::max<uint64_t>(1, uint64_t(count * target_ns / elapsed));
+
+    std::vector<double> times(samples);
+
+    for (double& t : times)
+    {
+        t = time_ns(benchmark, count) / count;
+    }
+
+    double mean = 0.0;
+
+    for (double t : times)
+    {
+        mean += t;
+    }
+
+    mean /= samples;
+    double variance = 0.0;
+
+    for (double t : times)
+    {
+        variance += (t - mean) * (t - mean);
+    }
+
+    variance /= std::max<uint32_t>(1, samples - 1);
+    std::sort(times.begin(), times.end());
+
+    Result result;
+    result.median = (samples & 1) ? times[samples / 2] : (times[samples / 2 - 1] + times[samples / 2]) * 0.5;
+    result.min = times[0];
+    result.spread = 100.0 * sqrt(variance) / mean;
+    return result;
+}
+
+
+/*
+    Baselines are a flat JSON object of benchmark name to its results. Only files written by write_baseline() need to be read back, so
+    this just looks for each name and the median following it.
+*/
+bool read_baseline(const std::string& path, const std::string& name, double& median)
+{
+    static std::string text;
+    static bool loaded = false;
+
+    if (!loaded)
+    {
+        std::ifstream ifs(path, std::ios::binary);
+
+        if (!ifs)
+        {
+            die([&]() { printf("Unable to read [%s]\n", path.c_str()); });
+        }
+
+        text.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+        loaded = true;
+    }
+
+    size_t pos = text.find("\"" + name + "\"");
+
+    if (pos == std::string::npos || (pos = text.find("\"median\":", pos)) == std::string::npos)
+    {
+        return false;
+    }
+
+    median = strtod(text.c_str() + pos + 9, nullptr);
+    return median > 0.0;
+}
+
+
+bool write_baseline(const std::string& path, const std::vector<Benchmark>& benchmarks, const std::vector<Result>& results)
+{
+    FILE* f = fopen(path.c_str(), "w");
+
+    if (!f)
+        return false;
+
+    fprintf(f, "{\n");
+
+    for (size_t i = 0; i < benchmarks.size(); ++i)
+    {
+        fprintf(f, "    \"%s\": { \"unit\": \"%s\", \"median\": %.4f, \"min\": %.4f, \"spread\": %.2f }%s\n", benchmarks[i].name.c_str(),
+            benchmarks[i].unit, results[i].median, results[i].min, results[i].spread, i + 1 < benchmarks.size() ? "," : "");
+    }
+
+    fprintf(f, "}\n");
+    return fclose(f) == 0;
+}
+
+
+int main(int argc, char** argv)
+{
+    std::string filter;
+    std::string baseline_path;
+    std::string write_path;
+    uint32_t samples = 15;
+    double target_ms = 20.0;
+    double threshold = 10.0;
+    bool list = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+
+        if (arg == "-l")
+        {
+            list = true;
+        }
+        else if (arg == "-v")
+        {
+            return verify();
+        }
+        else if (arg[0] == '-')
+        {
+            if (arg.size() != 2 || ++i == argc)
+            {
+                die(usage);
+            }
+
+            switch (arg[1])
+            {
+                case 'f': filter = argv[i]; break;
+                case 'n': samples = uint32_t(strtoul(argv[i], nullptr, 10)); break;
+                case 't': target_ms = atof(argv[i]); break;
+                case 'b': baseline_path = argv[i]; break;
+                case 'r': threshold = atof(argv[i]); break;
+                case 'w': write_path = argv[i]; break;
+                default: die(usage);
+            }
+        }
+        else
+        {
+            die(usage);
+        }
+    }
+
+    if (!samples || target_ms <= 0.0)
+    {
+        die(usage);
+    }
+
+    std::vector<Benchmark> selected = benchmarks(filter);
+
+    if (selected.empty())
+    {
+        die([&]() { printf("No benchmarks match [%s]\n", filter.c_str()); });
+    }
+
+    if (list)
+    {
+        for (const Benchmark& benchmark : selected)
+        {
+            printf("%s\n", benchmark.name.c_str());
+        }
+
+        return 0;
+    }
+
+    std::vector<Result> results;
+    int regressions = 0;
+
+    printf("%-32s %12s %12s %8s", "benchmark", "ns/op", "min", "spread");
+    baseline_path.empty() ? ((void)0) : (void)printf(" %12s %8s", "baseline", "change");
+    printf("\n");
+
+    for (const Benchmark& benchmark : selected)
+    {
+        Result result = measure(benchmark, samples, target_ms * 1e6);
+        results.push_back(result);
+
+        printf("%-32s %12.2f %12.2f %7.1f%%", benchmark.name.c_str(), result.median, result.min, result.spread);
+
+        double baseline = 0.0;
+
+        if (!baseline_path.empty() && read_baseline(baseline_path, benchmark.name, baseline))
+        {
+            double change = 100.0 * (result.median - baseline) / baseline;
+            bool regressed = change > threshold;
+            regressions += regressed;
+            printf(" %12.2f %+7.1f%%%s", baseline, change, regressed ? "  REGRESSION" : "");
+        }
+
+        printf("  (per %s)\n", benchmark.unit);
+        fflush(stdout);
+    }
+
+    if (!write_path.empty() && !write_baseline(write_path, selected, results))
+    {
+        die([&]() { printf("Unable to write [%s]\n", write_path.c_str()); });
+    }
+
+    if (regressions)
+    {
+        printf("\n%d benchmark%s regressed by more than %.1f%% against [%s]\n", regressions, regressions == 1 ? "" : "s", threshold,
+            baseline_path.c_str());
+        return 1;
+    }
+
+    return 0;
+}
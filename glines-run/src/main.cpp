@@ -0,0 +1,720 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "corpus.h"
+#include "movie.h"
+#include "nes.h"
+#include "ntsc_palette.h"
+#include "rgba_converter.h"
+
+/*
+    Headless throughput runner: loads a ROM and runs it for a number of frames (or seconds of emulated time) as fast as it will go,
+    optionally replaying an input movie, then reports the emulation speed. Loading the ROM isn't timed.
+
+    Speeds are reported as emulated frames per second, how many times faster than real time that is, the CPU clock rate in MHz the
+    host kept up (the real console's is about 1.79MHz) and host nanoseconds per frame. The final frame can be written out as a PPM
+    image and its frame and work RAM hashes printed (see Nes::set_hashing()), to check a run ended where it should have.
+
+    Given a corpus file (-c, see corpus.h) it runs every ROM in it in turn, for the corpus' frame counts and with its movies, as an
+    end to end benchmark. Every frame is timed on its own: a frame that takes longer than the display interval is a dropped frame
+    however fast the average is, so the median, 99th percentile and slowest frame times are reported along with the throughput.
+    Peak resident memory is the process' high-water mark, which only ever rises as ROMs are run one after another, so it is reported
+    once for the whole run rather than per ROM.
+
+    Results can be written to a file (-w) and a later run compared against it (-b), with the change in each figure for each ROM. A
+    ROM whose throughput, median or 99th percentile frame time got worse by more than the threshold is reported as a regression, as
+    is the peak resident memory growing by more than it, and the exit code is non-zero. Slowest frames are too noisy to gate on and
+    are only reported.
+
+    With -t the ROMs are test ROMs that report their result in PRG RAM the way blargg's do (see test_status()). Each one runs until it
+    reports or the frame count runs out, its result and message are printed and the exit code is non-zero if any didn't pass.
+*/
+
+
+template<typename F>
+void die(const F& f)
+{
+    f();
+    exit(1);
+}
+
+
+void usage()
+{
+    printf("Usage:\n");
+    printf("\tglines-run [options] rom\n");
+    printf("\tglines-run [options] -c corpusfile\n");
+    printf("\t-n frames     number of frames to run (default: 3600, or the length of the movie)\n");
+    printf("\t-s seconds    run for this much emulated time instead\n");
+    printf("\t-m movie      FCEUX .fm2 input movie\n");
+    printf("\t-a rate       synthesize audio at this sample rate (default: none)\n");
+    printf("\t-o file       write the final frame to a PPM image\n");
+    printf("\t-h            print the final frame's frame and RAM hashes\n");
+    printf("\t-t            run test ROMs that report their result at $6000, until they do\n");
+    printf("\t-c corpus     run every ROM in a corpus file, for its frame counts and with its movies\n");
+    printf("\t-w file       write the results to a file\n");
+    printf("\t-b file       compare the results with a file written by -w\n");
+    printf("\t-r percent    slowdown against -b reported as a regression (default: 10)\n");
+}
+
+
+struct RunResult
+{
+    std::string name;
+    uint32_t frames = 0;
+    double emulated_seconds = 0.0;
+    double host_seconds = 0.0;
+    uint64_t cycles = 0;
+    double p50 = 0.0;   // Frame times, ns
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+
+// Peak resident set size of the process so far, in KB
+uint64_t peak_rss_kb()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters{};
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? uint64_t(counters.PeakWorkingSetSize / 1024) : 0;
+#else
+    struct rusage usage{};
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+
+#if defined(__APPLE__)
+    return uint64_t(usage.ru_maxrss) / 1024;    // Bytes on macOS
+#else
+    return uint64_t(usage.ru_maxrss);
+#endif
+#endif
+}
+
+
+/*
+    blargg's test ROMs write DE B0 61 to $6001-$6003 once $6000 holds their status: $80 while the test is running, $81 when it wants
+    the console reset (no sooner than 100ms later) and otherwise the result code, 0 for a pass. The message follows from $6004,
+    null terminated. Returns -1 until the signature is there.
+*/
+int test_status(const uint8_t* prg_ram)
+{
+    return prg_ram[1] == 0xDE && prg_ram[2] == 0xB0 && prg_ram[3] == 0x61 ? prg_ram[0] : -1;
+}
+
+
+std::string test_message(const uint8_t* prg_ram)
+{
+    const char* text = reinterpret_cast<const char*>(prg_ram + 4);
+    std::string message(text, strnlen(text, 0x2000 - 4));
+
+    while (!message.empty() && (message.back() == '\n' || message.back() == ' '))
+        message.pop_back();
+
+    return message;
+}
+
+
+// Nearest rank percentile of sorted values
+double percentile(const std::vector<double>& sorted, double p)
+{
+    size_t rank = size_t(p / 100.0 * sorted.size() + 0.999999);
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+
+bool write_ppm(const std::string& path, const uint16_t* pixels, const RgbaConverter& converter)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+
+    if (!f)
+        return false;
+
+    std::vector<uint8_t> rgb(256 * 240 * 3);
+
+    for (size_t i = 0; i < 256 * 240; ++i)
+    {
+        uint32_t rgba = converter.lookup(pixels[i]);
+        rgb[i * 3 + 0] = uint8_t(rgba);
+        rgb[i * 3 + 1] = uint8_t(rgba >> 8);
+        rgb[i * 3 + 2] = uint8_t(rgba >> 16);
+    }
+
+    bool written = fprintf(f, "P6\n256 240\n255\n") > 0 && fwrite(rgb.data(), 1, rgb.size(), f) == rgb.size();
+    return fclose(f) == 0 && written;
+}
+
+
+// Figures read back from a results file, by ROM name and field
+struct Baseline
+{
+    std::map<std::string, std::map<std::string, double>> roms;
+    double peak_rss_kb = 0.0;
+};
+
+
+std::string json_string(const std::string& text)
+{
+    std::string quoted = "\"";
+
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if (uint8_t(c) < 0x20)
+        {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", unsigned(uint8_t(c)));
+            quoted += escape;
+        }
+        else
+        {
+            quoted += c;
+        }
+    }
+
+    return quoted + "\"";
+}
+
+
+/*
+    Just enough of a JSON reader for results files: objects, strings and numbers. Names are matched whole as keys of the object they're
+    in, so a ROM named after a field (or containing quotes or braces) can't be mistaken for anything else.
+*/
+class JsonReader
+{
+public:
+    explicit JsonReader(const std::string& text) : _p(text.c_str()), _end(text.c_str() + text.size()) {}
+
+    bool done() { space(); return _p == _end; }
+
+    // Calls member(key) with the reader at each member's value, which it must consume
+    template <typename F>
+    bool object(const F& member)
+    {
+        if (!expect('{'))
+            return false;
+
+        if (expect('}'))
+            return true;
+
+        do
+        {
+            std::string key;
+
+            if (!string(key) || !expect(':') || !member(key))
+                return false;
+        } while (expect(','));
+
+        return expect('}');
+    }
+
+    bool string(std::string& value)
+    {
+        if (!expect('"'))
+            return false;
+
+        value.clear();
+
+        while (_p != _end && *_p != '"')
+        {
+            if (*_p == '\\')
+            {
+                if (++_p == _end)
+                    return false;
+
+                switch (*_p)
+                {
+                    case 'b': value += '\b'; break;
+                    case 'f': value += '\f'; break;
+                    case 'n': value += '\n'; break;
+                    case 'r': value += '\r'; break;
+                    case 't': value += '\t'; break;
+                    case 'u':
+                    {
+                        // Only the control characters json_string() escapes
+                        if (_end - _p < 5)
+                            return false;
+
+                        value += char(strtoul(std::string(_p + 1, 4).c_str(), nullptr, 16));
+                        _p += 4;
+                        break;
+                    }
+                    default: value += *_p; break;
+                }
+            }
+            else
+            {
+                value += *_p;
+            }
+
+            ++_p;
+        }
+
+        return _p != _end && *_p++ == '"';
+    }
+
+    bool number(double& value)
+    {
+        space();
+        char* end = nullptr;
+        value = strtod(_p, &end);
+
+        if (end == _p || end > _end)
+            return false;
+
+        _p = end;
+        return true;
+    }
+
+    bool skip()
+    {
+        std::string text;
+        double value;
+
+        space();
+
+        if (_p != _end && *_p == '{')
+            return object([&](const std::string&) { return skip(); });
+        else if (_p != _end && *_p == '"')
+            return string(text);
+        else
+            return number(value);
+    }
+
+private:
+    const char* _p;
+    const char* _end;
+
+
+    void space()
+    {
+        while (_p != _end && (*_p == ' ' || *_p == '\t' || *_p == '\n' || *_p == '\r'))
+            ++_p;
+    }
+
+
+    bool expect(char c)
+    {
+        space();
+
+        if (_p == _end || *_p != c)
+            return false;
+
+        ++_p;
+        return true;
+    }
+};
+
+
+/*
+    Results files are a JSON object holding an object of ROM name to its figures and the figures for the whole process. Anything else
+    in them is skipped.
+*/
+bool read_results(const std::string& text, Baseline& baseline)
+{
+    JsonReader reader(text);
+
+    bool read = reader.object([&](const std::string& key)
+    {
+        if (key == "roms")
+        {
+            return reader.object([&](const std::string& name)
+            {
+                return reader.object([&](const std::string& field) { return reader.number(baseline.roms[name][field]); });
+            });
+        }
+        else if (key == "process")
+        {
+            return reader.object([&](const std::string& field)
+            {
+                return field == "peak_rss_kb" ? reader.number(baseline.peak_rss_kb) : reader.skip();
+            });
+        }
+
+        return reader.skip();
+    });
+
+    return read && reader.done();
+}
+
+
+// The ROM's figure from a baseline, false if it doesn't have one
+bool baseline_result(const Baseline& baseline, const std::string& name, const char* field, double& value)
+{
+    auto rom = baseline.roms.find(name);
+
+    if (rom == baseline.roms.end())
+        return false;
+
+    auto figure = rom->second.find(field);
+
+    if (figure == rom->second.end())
+        return false;
+
+    value = figure->second;
+    return value > 0.0;
+}
+
+
+bool write_results(const std::string& path, const std::vector<RunResult>& results, uint64_t rss_kb)
+{
+    FILE* f = fopen(path.c_str(), "w");
+
+    if (!f)
+        return false;
+
+    fprintf(f, "{\n");
+    fprintf(f, "    \"roms\": {\n");
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const RunResult& result = results[i];
+        fprintf(f, "        %s: { \"frames\": %u, \"fps\": %.2f, \"p50\": %.0f, \"p99\": %.0f, \"max\": %.0f }%s\n",
+            json_string(result.name).c_str(), result.frames, result.frames / result.host_seconds, result.p50, result.p99, result.max,
+            i + 1 < results.size() ? "," : "");
+    }
+
+    fprintf(f, "    },\n");
+    fprintf(f, "    \"process\": { \"peak_rss_kb\": %llu }\n", (unsigned long long)rss_kb);
+    fprintf(f, "}\n");
+    return fclose(f) == 0;
+}
+
+
+int main(int argc, char** argv)
+{
+    std::string rom;
+    std::string movie_path;
+    std::string image_path;
+    std::string corpus_path;
+    std::string write_path;
+    std::string baseline_path;
+    uint32_t frames = 0;
+    double seconds = 0.0;
+    double threshold = 10.0;
+    uint32_t sample_rate = 0;
+    bool hashes = false;
+    bool test = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+
+        if (arg == "-h")
+        {
+            hashes = true;
+        }
+        else if (arg == "-t")
+        {
+            test = true;
+        }
+        else if (arg[0] == '-')
+        {
+            if (arg.size() != 2 || ++i == argc)
+            {
+                die(usage);
+            }
+
+            switch (arg[1])
+            {
+                case 'n': frames = uint32_t(strtoul(argv[i], nullptr, 10)); break;
+                case 's': seconds = atof(argv[i]); break;
+                case 'm': movie_path = argv[i]; break;
+                case 'a': sample_rate = uint32_t(strtoul(argv[i], nullptr, 10)); break;
+                case 'o': image_path = argv[i]; break;
+                case 'c': corpus_path = argv[i]; break;
+                case 'w': write_path = argv[i]; break;
+                case 'b': baseline_path = argv[i]; break;
+                case 'r': threshold = atof(argv[i]); break;
+                default: die(usage);
+            }
+        }
+        else if (rom.empty())
+        {
+            rom = arg;
+        }
+        else
+        {
+            die(usage);
+        }
+    }
+
+    std::vector<CorpusEntry> entries;
+
+    if (!corpus_path.empty())
+    {
+        // A corpus brings its own frame counts and movies, and there's no single final frame to output
+        if (!rom.empty() || frames || seconds > 0.0 || !movie_path.empty() || !image_path.empty() || hashes)
+        {
+            die(usage);
+        }
+
+        if (!read_corpus(corpus_path, entries) || entries.empty())
+        {
+            die([&]() { printf("Unable to read corpus file [%s]\n", corpus_path.c_str()); });
+        }
+    }
+    else if (rom.empty())
+    {
+        die(usage);
+    }
+    else
+    {
+        CorpusEntry entry;
+        entry.name = rom;
+        entry.rom = rom;
+        entry.movie = movie_path;
+        entries.push_back(entry);
+    }
+
+    Baseline baseline;
+
+    if (!baseline_path.empty())
+    {
+        std::ifstream ifs(baseline_path, std::ios::binary);
+        std::string text(std::istreambuf_iterator<char>(ifs), (std::istreambuf_iterator<char>()));
+
+        if (!ifs || !read_results(text, baseline))
+        {
+            die([&]() { printf("Unable to read [%s]\n", baseline_path.c_str()); });
+        }
+    }
+
+    std::vector<RunResult> results;
+    int regressions = 0;
+    int failures = 0;
+
+    for (const CorpusEntry& entry : entries)
+    {
+        std::vector<MovieFrame> movie;
+
+        if (!entry.movie.empty() && !read_movie(entry.movie, movie))
+        {
+            die([&]() { printf("Unable to read movie [%s]\n", entry.movie.c_str()); });
+        }
+
+        std::unique_ptr<Nes> nes = std::make_unique<Nes>();
+
+        if (!nes->load_game_pak(entry.rom))
+        {
+            die([&]() { printf("Unable to load [%s]\n", entry.rom.c_str()); });
+        }
+
+        RunResult result;
+        result.name = entry.name;
+        result.frames = entry.frames;
+
+        if (seconds > 0.0)
+        {
+            result.frames = uint32_t(seconds / nes->frame_time() + 0.5);
+        }
+        else if (!result.frames)
+        {
+            result.frames = frames ? frames : movie.empty() ? 3600 : uint32_t(movie.size());
+        }
+
+        if (!result.frames)
+        {
+            die(usage);
+        }
+
+        nes->_ppu.set_emphasis_output(!image_path.empty());
+        nes->_apu.set_sample_rate(sample_rate);
+        nes->reset(true);
+
+        uint8_t* prg_ram = nes->_game_pak->prg_ram();
+
+        if (test && !prg_ram)
+        {
+            die([&]() { printf("[%s] has no PRG RAM to report a test result in\n", entry.rom.c_str()); });
+        }
+
+        int status = -1;
+        uint32_t reset_frame = 0;
+        std::vector<double> frame_times(result.frames);
+        uint64_t start_cycle = nes->_cpu.cycle_count();
+        auto start = std::chrono::steady_clock::now();
+        auto frame_start = start;
+
+        for (uint32_t frame = 0; frame < result.frames; ++frame)
+        {
+            if (frame < movie.size())
+            {
+                if (movie[frame].commands & 3)
+                    nes->reset((movie[frame].commands & 2) != 0);
+
+                nes->joy1.buttons = movie[frame].buttons[0];
+                nes->joy2.buttons = movie[frame].buttons[1];
+            }
+
+            // Hashing is only wanted for the last frame, it isn't part of the emulation being measured
+            nes->set_hashing(hashes && frame == result.frames - 1);
+            nes->run_frame();
+            nes->_apu.samples().clear();
+
+            auto frame_end = std::chrono::steady_clock::now();
+            frame_times[frame] = std::chrono::duration<double, std::nano>(frame_end - frame_start).count();
+            frame_start = frame_end;
+
+            if (test)
+            {
+                status = test_status(prg_ram);
+
+                if (status >= 0 && status < 0x80)
+                {
+                    result.frames = frame + 1;
+                    frame_times.resize(result.frames);
+                }
+                else if (status == 0x81 && !reset_frame)
+                {
+                    reset_frame = frame + 7;    // 6 frames is 100ms
+                }
+                else if (status == 0x81 && frame == reset_frame)
+                {
+                    nes->reset(false);
+                }
+                else if (status != 0x81)
+                {
+                    reset_frame = 0;
+                }
+            }
+        }
+
+        result.host_seconds = std::chrono::duration<double>(frame_start - start).count();
+        result.emulated_seconds = result.frames * nes->frame_time();
+        result.cycles = nes->_cpu.cycle_count() - start_cycle;
+
+        std::sort(frame_times.begin(), frame_times.end());
+        result.p50 = percentile(frame_times, 50.0);
+        result.p99 = percentile(frame_times, 99.0);
+        result.max = frame_times.back();
+
+        printf("%s: %u frames (%.2fs emulated) in %.3fs\n", result.name.c_str(), result.frames, result.emulated_seconds,
+            result.host_seconds);
+        printf("%.1f frames/s, %.1fx real time, %.2f MHz CPU, %.0f ns/frame\n", result.frames / result.host_seconds,
+            result.emulated_seconds / result.host_seconds, result.cycles / result.host_seconds / 1e6,
+            result.host_seconds * 1e9 / result.frames);
+        printf("frame time p50 %.0f ns, p99 %.0f ns, max %.0f ns\n", result.p50, result.p99, result.max);
+
+        double fps = 0.0;
+        double p50 = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+
+        if (baseline_result(baseline, result.name, "fps", fps) && baseline_result(baseline, result.name, "p50", p50) &&
+            baseline_result(baseline, result.name, "p99", p99) && baseline_result(baseline, result.name, "max", max))
+        {
+            // Positive changes are slowdowns, for throughput as well as frame times
+            double fps_change = 100.0 * (fps - result.frames / result.host_seconds) / fps;
+            double p50_change = 100.0 * (result.p50 - p50) / p50;
+            double p99_change = 100.0 * (result.p99 - p99) / p99;
+            double max_change = 100.0 * (result.max - max) / max;
+            bool regressed = fps_change > threshold || p50_change > threshold || p99_change > threshold;
+            regressions += regressed;
+
+            printf("against baseline: frames/s %.1f (%+.1f%% slower), p50 %.0f ns (%+.1f%%), p99 %.0f ns (%+.1f%%), max %.0f ns (%+.1f%%)%s\n",
+                fps, fps_change, p50, p50_change, p99, p99_change, max, max_change, regressed ? "  REGRESSION" : "");
+        }
+        else if (!baseline_path.empty())
+        {
+            printf("against baseline: not in [%s]\n", baseline_path.c_str());
+        }
+
+        if (test)
+        {
+            failures += status != 0;
+
+            if (status < 0 || status >= 0x80)
+                printf("test FAILED: no result after %u frames\n", result.frames);
+            else if (status)
+                printf("test FAILED (result %d):\n%s\n", status, test_message(prg_ram).c_str());
+            else
+                printf("test passed:\n%s\n", test_message(prg_ram).c_str());
+        }
+
+        if (hashes)
+        {
+            printf("frame hash %016llx, RAM hash %016llx\n", (unsigned long long)nes->frame_hash(), (unsigned long long)nes->ram_hash());
+        }
+
+        if (!image_path.empty())
+        {
+            RgbaConverter converter;
+            converter.set_palette(ntsc_palette, sizeof(ntsc_palette));
+
+            if (!write_ppm(image_path, nes->_ppu._screen9.data(), converter))
+            {
+                die([&]() { printf("Unable to write [%s]\n", image_path.c_str()); });
+            }
+        }
+
+        results.push_back(result);
+        fflush(stdout);
+    }
+
+    // The high-water mark of the whole run, whichever ROM reached it
+    uint64_t rss_kb = peak_rss_kb();
+    bool rss_regressed = false;
+    printf("peak RSS %.1f MB (process)", rss_kb / 1024.0);
+
+    if (baseline.peak_rss_kb > 0.0)
+    {
+        double rss_change = 100.0 * (rss_kb - baseline.peak_rss_kb) / baseline.peak_rss_kb;
+        rss_regressed = rss_change > threshold;
+
+        printf(" against baseline %.1f MB (%+.1f%%)%s", baseline.peak_rss_kb / 1024.0, rss_change, rss_regressed ? "  REGRESSION" : "");
+    }
+
+    printf("\n");
+
+    if (!write_path.empty() && !write_results(write_path, results, rss_kb))
+    {
+        die([&]() { printf("Unable to write [%s]\n", write_path.c_str()); });
+    }
+
+    if (failures)
+    {
+        printf("\n%d of %zu tests failed\n", failures, results.size());
+    }
+
+    if (regressions)
+    {
+        printf("\n%d of %zu ROMs regressed by more than %.1f%% against [%s]\n", regressions, results.size(), threshold,
+            baseline_path.c_str());
+    }
+
+    if (rss_regressed)
+    {
+        printf("\nPeak RSS grew by more than %.1f%% against [%s]\n", threshold, baseline_path.c_str());
+    }
+
+    if (regressions || rss_regressed)
+    {
+        return 1;
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,825 @@
+#include "apu.h"
+
+#include "gli2a03.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+static constexpr uint64_t Never = ~0ull;
+
+// Frame counter step actions
+static constexpr uint8_t QuarterFrame = 1 << 0;
+static constexpr uint8_t HalfFrame = 1 << 1;
+static constexpr uint8_t FrameIrq = 1 << 2;
+static constexpr uint8_t SequenceEnd = 1 << 3;
+
+static const uint8_t LengthTable[32] =
+{
+    10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14, 12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+static const uint8_t DutyTable[4][8] =
+{
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 1, 1, 0, 0, 0 },
+    { 1, 0, 0, 1, 1, 1, 1, 1 },
+};
+
+static const uint8_t TriangleTable[32] =
+{
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+};
+
+/*
+    https://wiki.nesdev.com/w/index.php/APU_Mixer
+
+    The lookup table approximation of the nonlinear mixer, indexed by pulse1 + pulse2 and 3 * triangle + 2 * noise + dmc.
+*/
+template <size_t Size>
+struct MixerTable
+{
+    float level[Size];
+};
+
+
+template <size_t Size>
+static constexpr MixerTable<Size> make_mixer_table(float numerator, float denominator)
+{
+    MixerTable<Size> table{};
+
+    for (size_t n = 1; n < Size; ++n)
+    {
+        table.level[n] = numerator / (denominator / n + 100.0f);
+    }
+
+    return table;
+}
+
+
+static constexpr MixerTable<31> PulseTable = make_mixer_table<31>(95.52f, 8128.0f);
+static constexpr MixerTable<203> TndTable = make_mixer_table<203>(163.67f, 24329.0f);
+
+// Timer periods in CPU cycles, Dendy uses the NTSC tables
+static const uint16_t NoisePeriodsNtsc[16] = { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 };
+static const uint16_t NoisePeriodsPal[16] = { 4, 8, 14, 30, 60, 88, 118, 148, 188, 236, 354, 472, 708, 944, 1890, 3778 };
+static const uint16_t DmcPeriodsNtsc[16] = { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 };
+static const uint16_t DmcPeriodsPal[16] = { 398, 354, 316, 298, 276, 236, 210, 198, 176, 148, 132, 118, 98, 78, 66, 50 };
+
+
+void Apu::Envelope::clock()
+{
+    if (start)
+    {
+        start = false;
+        decay = 15;
+        divider = period;
+    }
+    else if (divider == 0)
+    {
+        divider = period;
+
+        if (decay > 0)
+            decay--;
+        else if (loop)
+            decay = 15;
+    }
+    else
+    {
+        divider--;
+    }
+}
+
+
+uint16_t Apu::Pulse::sweep_target(bool ones_complement) const
+{
+    // Pulse 1 negates with ones' complement, pulse 2 with two's complement
+    uint16_t change = period >> sweep_shift;
+    return sweep_negate ? period - change - (ones_complement ? 1 : 0) : period + change;
+}
+
+
+bool Apu::Pulse::muted(bool ones_complement) const
+{
+    return period < 8 || (!sweep_negate && sweep_target(ones_complement) > 0x7FF);
+}
+
+
+void Apu::connect(gli2A03* cpu, ReadCallback dma_read)
+{
+    _cpu = cpu;
+    _dma_read = dma_read;
+}
+
+
+void Apu::set_region(Region region)
+{
+    /*
+        https://wiki.nesdev.com/w/index.php/APU_Frame_Counter
+
+        The frame IRQ flag is set on the last three CPU cycles of the 4-step sequence, the last of which is also the first cycle of the
+        next sequence.
+    */
+    static const FrameStep FrameStepsNtsc[2][6] =
+    {
+        {
+            { 7457, QuarterFrame }, { 14913, QuarterFrame | HalfFrame }, { 22371, QuarterFrame }, { 29828, FrameIrq },
+            { 29829, QuarterFrame | HalfFrame | FrameIrq }, { 29830, FrameIrq | SequenceEnd },
+        },
+        {
+            { 7457, QuarterFrame }, { 14913, QuarterFrame | HalfFrame }, { 22371, QuarterFrame }, { 37281, QuarterFrame | HalfFrame },
+            { 37282, SequenceEnd },
+        },
+    };
+
+    static const FrameStep FrameStepsPal[2][6] =
+    {
+        {
+            { 8313, QuarterFrame }, { 16627, QuarterFrame | HalfFrame }, { 24939, QuarterFrame }, { 33252, FrameIrq },
+            { 33253, QuarterFrame | HalfFrame | FrameIrq }, { 33254, FrameIrq | SequenceEnd },
+        },
+        {
+            { 8313, QuarterFrame }, { 16627, QuarterFrame | HalfFrame }, { 24939, QuarterFrame }, { 41565, QuarterFrame | HalfFrame },
+            { 41566, SequenceEnd },
+        },
+    };
+
+    _region = region;
+    _noise_periods = region == Region::Pal ? NoisePeriodsPal : NoisePeriodsNtsc;
+    _dmc_periods = region == Region::Pal ? DmcPeriodsPal : DmcPeriodsNtsc;
+    _frame_steps[0] = region == Region::Pal ? FrameStepsPal[0] : FrameStepsNtsc[0];
+    _frame_steps[1] = region == Region::Pal ? FrameStepsPal[1] : FrameStepsNtsc[1];
+    set_sample_rate(_sample_rate, _quality);
+}
+
+
+void Apu::reset(bool coldstart)
+{
+    /*
+        https://wiki.nesdev.com/w/index.php/CPU_power_up_state
+
+        At power up all the registers are cleared and the noise shift register is loaded with 1. On reset the channels are silenced
+        ($4015 = 0), the triangle's phase and the DMC's output level (except bit 0) are reset and the frame counter restarts in the mode
+        last written to $4017.
+    */
+    if (!_noise_periods)
+        set_region(_region);
+
+    if (coldstart)
+    {
+        memset(_pulse, 0, sizeof(_pulse));
+        memset(&_triangle, 0, sizeof(_triangle));
+        memset(&_noise, 0, sizeof(_noise));
+        memset(&_dmc, 0, sizeof(_dmc));
+        _noise.shift = 1;
+        _noise.period = _noise_periods[0];
+        _dmc.period = _dmc_periods[0];
+        _dmc.sample_address = 0xC000;   // As written by $4012 = $4013 = 0
+        _dmc.sample_length = 1;
+        _frame_reset_value = 0;
+    }
+    else
+    {
+        _triangle.sequence = 0;
+        _dmc.output &= 1;
+    }
+
+    _cycle = 0;
+    _enabled = 0;
+    _pulse[0].length = _pulse[1].length = _triangle.length = _noise.length = 0;
+    _dmc.bytes_remaining = 0;
+    _dmc.buffer_full = false;
+    _dmc.bits_remaining = 8;
+    _dmc.silence = true;
+    _dmc.next_step = _dmc.period;
+
+    _frame_mode = _frame_reset_value >> 7;
+    _frame_irq_inhibit = (_frame_reset_value & 0x40) != 0;
+    _frame_irq = false;
+    _dmc_irq = false;
+    _frame_start = 0;
+    _frame_step = 0;
+    _frame_reset = Never;
+    _length_clock_cycle = Never;
+    _length_clocked = 0;
+
+    _pulse[0].next_step = _pulse[1].next_step = _triangle.next_step = _noise.next_step = Never;
+    update_timers();
+    update_irq();
+    update_next_event();
+    set_sample_rate(_sample_rate, _quality);
+}
+
+
+void Apu::cpu_write(uint16_t address, uint8_t value)
+{
+    run();
+
+    switch (address)
+    {
+        case PULSE1_BASE + 0:
+        case PULSE2_BASE + 0:
+        {
+            Pulse& pulse = _pulse[(address >> 2) & 1];
+            pulse.duty = value >> 6;
+            pulse.envelope.loop = (value & 0x20) != 0;
+            pulse.envelope.constant = (value & 0x10) != 0;
+            pulse.envelope.period = value & 0x0F;
+            break;
+        }
+        case PULSE1_BASE + 1:
+        case PULSE2_BASE + 1:
+        {
+            Pulse& pulse = _pulse[(address >> 2) & 1];
+            pulse.sweep_enabled = (value & 0x80) != 0;
+            pulse.sweep_period = (value >> 4) & 7;
+            pulse.sweep_negate = (value & 0x08) != 0;
+            pulse.sweep_shift = value & 7;
+            pulse.sweep_reload = true;
+            break;
+        }
+        case PULSE1_BASE + 2:
+        case PULSE2_BASE + 2:
+        {
+            Pulse& pulse = _pulse[(address >> 2) & 1];
+            pulse.period = (pulse.period & 0x700) | value;
+            break;
+        }
+        case PULSE1_BASE + 3:
+        case PULSE2_BASE + 3:
+        {
+            uint8_t channel = (address >> 2) & 1;
+            Pulse& pulse = _pulse[channel];
+            pulse.period = (pulse.period & 0xFF) | (uint16_t(value & 7) << 8);
+            pulse.sequence = 0;
+            pulse.envelope.start = true;
+            reload_length(channel, pulse.length, value);
+            break;
+        }
+        case TRIANGLE_BASE + 0:
+        {
+            _triangle.control = (value & 0x80) != 0;
+            _triangle.linear_period = value & 0x7F;
+            break;
+        }
+        case TRIANGLE_BASE + 2:
+        {
+            _triangle.period = (_triangle.period & 0x700) | value;
+            break;
+        }
+        case TRIANGLE_BASE + 3:
+        {
+            _triangle.period = (_triangle.period & 0xFF) | (uint16_t(value & 7) << 8);
+            _triangle.linear_reload = true;
+            reload_length(2, _triangle.length, value);
+            break;
+        }
+        case NOISE_BASE + 0:
+        {
+            _noise.envelope.loop = (value & 0x20) != 0;
+            _noise.envelope.constant = (value & 0x10) != 0;
+            _noise.envelope.period = value & 0x0F;
+            break;
+        }
+        case NOISE_BASE + 2:
+        {
+            _noise.mode = (value & 0x80) != 0;
+            _noise.period = _noise_periods[value & 0x0F];
+            break;
+        }
+        case NOISE_BASE + 3:
+        {
+            _noise.envelope.start = true;
+            reload_length(3, _noise.length, value);
+            break;
+        }
+        case DMC_BASE + 0:
+        {
+            _dmc.irq_enabled = (value & 0x80) != 0;
+            _dmc.loop = (value & 0x40) != 0;
+            _dmc.period = _dmc_periods[value & 0x0F];
+
+            if (!_dmc.irq_enabled)
+                _dmc_irq = false;
+
+            break;
+        }
+        case DMC_BASE + 1:
+        {
+            _dmc.output = value & 0x7F;
+            break;
+        }
+        case DMC_BASE + 2:
+        {
+            _dmc.sample_address = 0xC000 | (uint16_t(value) << 6);
+            break;
+        }
+        case DMC_BASE + 3:
+        {
+            _dmc.sample_length = (uint16_t(value) << 4) + 1;
+            break;
+        }
+        case STATUS:
+        {
+            _enabled = value & 0x1F;
+            _pulse[0].length = (value & 0x01) ? _pulse[0].length : 0;
+            _pulse[1].length = (value & 0x02) ? _pulse[1].length : 0;
+            _triangle.length = (value & 0x04) ? _triangle.length : 0;
+            _noise.length = (value & 0x08) ? _noise.length : 0;
+            _dmc_irq = false;
+
+            if ((value & 0x10) == 0)
+            {
+                _dmc.bytes_remaining = 0;
+            }
+            else if (_dmc.bytes_remaining == 0)
+            {
+                restart_dmc_sample();
+                fetch_dmc_sample();
+            }
+
+            break;
+        }
+        case FRAME_COUNTER:
+        {
+            /*
+                The new mode takes effect 3 or 4 CPU cycles after the write depending on whether it lands on an APU cycle (the APU is clocked
+                every other CPU cycle) but the IRQ inhibit flag applies immediately.
+            */
+            _frame_reset_value = value;
+            _frame_reset = _cycle + ((_cycle & 1) ? 4 : 3);
+            _frame_irq_inhibit = (value & 0x40) != 0;
+
+            if (_frame_irq_inhibit)
+                _frame_irq = false;
+
+            break;
+        }
+    }
+
+    update_timers();
+    update_irq();
+    update_next_event();
+    mix(_cycle);
+}
+
+
+uint8_t Apu::cpu_read(uint16_t address)
+{
+    uint8_t value = 0;
+
+    if (address == STATUS)
+    {
+        run();
+        value |= _pulse[0].length ? 0x01 : 0;
+        value |= _pulse[1].length ? 0x02 : 0;
+        value |= _triangle.length ? 0x04 : 0;
+        value |= _noise.length ? 0x08 : 0;
+        value |= _dmc.bytes_remaining ? 0x10 : 0;
+        value |= _frame_irq ? 0x40 : 0;
+        value |= _dmc_irq ? 0x80 : 0;
+
+        // Reading the status acknowledges the frame IRQ
+        _frame_irq = false;
+        update_irq();
+        update_next_event();
+    }
+
+    return value;
+}
+
+
+void Apu::run()
+{
+    // Up to the cycle a register access is actually made on, not the start of the instruction making it
+    run(_cpu->access_cycle());
+}
+
+
+void Apu::run(uint64_t cycle)
+{
+    // Everything due on or before the given CPU cycle, in order
+    for (;;)
+    {
+        uint64_t next = std::min({ next_frame_step(), _frame_reset, _pulse[0].next_step, _pulse[1].next_step, _triangle.next_step,
+                                   _noise.next_step, _dmc.next_step });
+
+        if (next > cycle)
+            break;
+
+        _cycle = next;
+
+        if (next == _frame_reset)
+        {
+            _frame_reset = Never;
+            _frame_mode = _frame_reset_value >> 7;
+            _frame_start = _cycle;
+            _frame_step = 0;
+
+            // Switching to the 5-step sequence clocks everything immediately
+            if (_frame_mode)
+            {
+                quarter_frame();
+                half_frame();
+            }
+        }
+
+        if (next == next_frame_step())
+            step_frame_counter();
+
+        if (next == _pulse[0].next_step)
+            step_pulse(_pulse[0]);
+
+        if (next == _pulse[1].next_step)
+            step_pulse(_pulse[1]);
+
+        if (next == _triangle.next_step)
+            step_triangle();
+
+        if (next == _noise.next_step)
+            step_noise();
+
+        if (next == _dmc.next_step)
+            step_dmc();
+
+        update_timers();
+        mix(_cycle);
+    }
+
+    _cycle = std::max(_cycle, cycle);
+    update_irq();
+    update_next_event();
+}
+
+
+uint64_t Apu::next_frame_step() const
+{
+    return _frame_start + _frame_steps[_frame_mode][_frame_step].cycle;
+}
+
+
+void Apu::step_frame_counter()
+{
+    const FrameStep& step = _frame_steps[_frame_mode][_frame_step];
+
+    if (step.actions & QuarterFrame)
+        quarter_frame();
+
+    if (step.actions & HalfFrame)
+        half_frame();
+
+    if ((step.actions & FrameIrq) && !_frame_irq_inhibit)
+        _frame_irq = true;
+
+    if (step.actions & SequenceEnd)
+    {
+        _frame_start += step.cycle;
+        _frame_step = 0;
+    }
+    else
+    {
+        _frame_step++;
+    }
+}
+
+
+void Apu::quarter_frame()
+{
+    // Envelopes and the triangle's linear counter
+    _pulse[0].envelope.clock();
+    _pulse[1].envelope.clock();
+    _noise.envelope.clock();
+
+    if (_triangle.linear_reload)
+        _triangle.linear = _triangle.linear_period;
+    else if (_triangle.linear)
+        _triangle.linear--;
+
+    if (!_triangle.control)
+        _triangle.linear_reload = false;
+}
+
+
+void Apu::half_frame()
+{
+    // Length counters and sweep units
+    _length_clock_cycle = _cycle;
+    _length_clocked = 0;
+
+    if (_pulse[0].length && !_pulse[0].envelope.loop)
+    {
+        _pulse[0].length--;
+        _length_clocked |= 1 << 0;
+    }
+
+    if (_pulse[1].length && !_pulse[1].envelope.loop)
+    {
+        _pulse[1].length--;
+        _length_clocked |= 1 << 1;
+    }
+
+    if (_triangle.length && !_triangle.control)
+    {
+        _triangle.length--;
+        _length_clocked |= 1 << 2;
+    }
+
+    if (_noise.length && !_noise.envelope.loop)
+    {
+        _noise.length--;
+        _length_clocked |= 1 << 3;
+    }
+
+    clock_sweep(_pulse[0], true);
+    clock_sweep(_pulse[1], false);
+}
+
+
+void Apu::reload_length(uint8_t channel, uint8_t& length, uint8_t value)
+{
+    /*
+        A write on the same cycle as a half frame clock comes after it (cpu_write() runs the APU up to the write first), but on the
+        console a reload of a length counter that clock decremented is lost. Counters which were zero or halted do reload.
+    */
+    bool clocked = _cycle == _length_clock_cycle && (_length_clocked & (1 << channel));
+
+    if ((_enabled & (1 << channel)) && !clocked)
+        length = LengthTable[value >> 3];
+}
+
+
+void Apu::clock_sweep(Pulse& pulse, bool ones_complement)
+{
+    if (pulse.sweep_divider == 0 && pulse.sweep_enabled && pulse.sweep_shift && !pulse.muted(ones_complement))
+        pulse.period = pulse.sweep_target(ones_complement);
+
+    if (pulse.sweep_divider == 0 || pulse.sweep_reload)
+    {
+        pulse.sweep_divider = pulse.sweep_period;
+        pulse.sweep_reload = false;
+    }
+    else
+    {
+        pulse.sweep_divider--;
+    }
+}
+
+
+void Apu::step_pulse(Pulse& pulse)
+{
+    // The pulse timers are clocked every APU cycle (every other CPU cycle)
+    pulse.sequence = (pulse.sequence + 1) & 7;
+    pulse.next_step += (uint64_t(pulse.period) + 1) * 2;
+}
+
+
+void Apu::step_triangle()
+{
+    _triangle.sequence = (_triangle.sequence + 1) & 31;
+    _triangle.next_step += uint64_t(_triangle.period) + 1;
+}
+
+
+void Apu::step_noise()
+{
+    uint16_t feedback = (_noise.shift ^ (_noise.shift >> (_noise.mode ? 6 : 1))) & 1;
+    _noise.shift = (_noise.shift >> 1) | (feedback << 14);
+    _noise.next_step += _noise.period;
+}
+
+
+void Apu::step_dmc()
+{
+    // https://wiki.nesdev.com/w/index.php/APU_DMC
+    if (!_dmc.silence)
+    {
+        if (_dmc.shift & 1)
+        {
+            if (_dmc.output <= 125)
+                _dmc.output += 2;
+        }
+        else if (_dmc.output >= 2)
+        {
+            _dmc.output -= 2;
+        }
+    }
+
+    _dmc.shift >>= 1;
+
+    if (--_dmc.bits_remaining == 0)
+    {
+        _dmc.bits_remaining = 8;
+        _dmc.silence = !_dmc.buffer_full;
+
+        if (_dmc.buffer_full)
+        {
+            _dmc.shift = _dmc.buffer;
+            _dmc.buffer_full = false;
+            fetch_dmc_sample();
+        }
+    }
+
+    _dmc.next_step += _dmc.period;
+}
+
+
+void Apu::fetch_dmc_sample()
+{
+    if (_dmc.buffer_full || _dmc.bytes_remaining == 0)
+        return;
+
+    // The CPU is halted for (usually) 4 cycles while the DMC reads the byte
+    _cpu->stall(4);
+    _dmc.buffer = _dma_read(_dmc.address);
+    _dmc.buffer_full = true;
+    _dmc.address = _dmc.address == 0xFFFF ? 0x8000 : _dmc.address + 1;
+
+    if (--_dmc.bytes_remaining == 0)
+    {
+        if (_dmc.loop)
+            restart_dmc_sample();
+        else if (_dmc.irq_enabled)
+            _dmc_irq = true;
+    }
+}
+
+
+void Apu::restart_dmc_sample()
+{
+    _dmc.address = _dmc.sample_address;
+    _dmc.bytes_remaining = _dmc.sample_length;
+}
+
+
+void Apu::update_irq()
+{
+    _cpu ? _cpu->set_irq_line(gli2A03::IrqApuFrameCounter, _frame_irq) : ((void)0);
+    _cpu ? _cpu->set_irq_line(gli2A03::IrqApuDmc, _dmc_irq) : ((void)0);
+}
+
+
+void Apu::update_timers()
+{
+    /*
+        Channels whose output can't change are parked rather than stepped: pulses with a zero length counter or muted by the sweep unit,
+        noise with a zero length counter and the triangle with either counter zero (it holds its output) or an ultrasonic period. A
+        parked channel's timer restarts from the current cycle.
+    */
+    auto schedule = [this](uint64_t& next_step, bool running, uint64_t period)
+    {
+        if (!running)
+            next_step = Never;
+        else if (next_step == Never)
+            next_step = _cycle + period;
+    };
+
+    schedule(_pulse[0].next_step, _pulse[0].length && !_pulse[0].muted(true), (uint64_t(_pulse[0].period) + 1) * 2);
+    schedule(_pulse[1].next_step, _pulse[1].length && !_pulse[1].muted(false), (uint64_t(_pulse[1].period) + 1) * 2);
+    schedule(_triangle.next_step, _triangle.length && _triangle.linear && _triangle.period >= 2, uint64_t(_triangle.period) + 1);
+    schedule(_noise.next_step, _noise.length != 0, _noise.period);
+}
+
+
+void Apu::update_next_event()
+{
+    // The frame IRQ being raised and DMC sample fetches (which stall the CPU and may raise the DMC IRQ)
+    uint64_t next = _frame_reset;
+
+    if (_frame_mode == 0 && !_frame_irq_inhibit && !_frame_irq)
+    {
+        uint8_t step = _frame_step;
+
+        while ((_frame_steps[0][step].actions & FrameIrq) == 0)
+        {
+            step++;
+        }
+
+        next = std::min(next, _frame_start + _frame_steps[0][step].cycle);
+    }
+
+    if (_dmc.bytes_remaining)
+    {
+        next = std::min(next, _dmc.next_step + uint64_t(_dmc.bits_remaining - 1) * _dmc.period);
+    }
+
+    _next_event = next;
+}
+
+
+uint8_t Apu::pulse_output(const Pulse& pulse, bool ones_complement) const
+{
+    if (!pulse.length || pulse.muted(ones_complement) || !DutyTable[pulse.duty][pulse.sequence])
+        return 0;
+
+    return pulse.envelope.volume();
+}
+
+
+void Apu::mix(uint64_t cycle)
+{
+    if (!_sample_rate)
+        return;
+
+    uint8_t pulse = pulse_output(_pulse[0], true) + pulse_output(_pulse[1], false);
+    uint8_t noise = (_noise.length && (_noise.shift & 1) == 0) ? _noise.envelope.volume() : 0;
+    uint8_t tnd = 3 * TriangleTable[_triangle.sequence] + 2 * noise + _dmc.output;
+    float level = PulseTable.level[pulse] + TndTable.level[tnd];
+
+    if (level != _level)
+    {
+        // Keep frame times within the blip buffer's 32-bit clocks if the samples aren't being flushed
+        if (cycle - _blip_cycle >= 0x1000000)
+            end_blip_frame(cycle);
+
+        _blip.add_delta(uint32_t(cycle - _blip_cycle), level - _level);
+        _level = level;
+    }
+}
+
+
+void Apu::set_sample_rate(uint32_t sample_rate, BlipBuffer::Quality quality)
+{
+    _sample_rate = sample_rate;
+    _quality = quality;
+    _samples.clear();
+
+    if (!_sample_rate)
+        return;
+
+    double master_clock = _region == Region::Pal ? PalTiming::MasterClock : (_region == Region::Dendy ? DendyTiming::MasterClock : NtscTiming::MasterClock);
+    double cpu_divider = _region == Region::Pal ? PalTiming::CpuDivider : (_region == Region::Dendy ? DendyTiming::CpuDivider : NtscTiming::CpuDivider);
+    _blip.set_quality(_quality);
+    _blip.set_rates(master_clock / cpu_divider, _sample_rate);
+    _blip_cycle = _cycle;
+    _level = 0.0f;
+}
+
+
+void Apu::flush()
+{
+    if (_cpu)
+        run();
+
+    if (_sample_rate)
+    {
+        end_blip_frame(_cycle);
+        _blip.read_samples(_samples);
+    }
+}
+
+
+void Apu::save_state(State& state) const
+{
+    state.cycle = _cycle;
+    state.next_event = _next_event;
+    state.frame_start = _frame_start;
+    state.frame_reset = _frame_reset;
+    state.length_clock_cycle = _length_clock_cycle;
+    memcpy(state.pulse, _pulse, sizeof(_pulse));
+    state.triangle = _triangle;
+    state.noise = _noise;
+    state.dmc = _dmc;
+    state.enabled = _enabled;
+    state.frame_mode = _frame_mode;
+    state.frame_irq_inhibit = _frame_irq_inhibit;
+    state.frame_irq = _frame_irq;
+    state.dmc_irq = _dmc_irq;
+    state.frame_step = _frame_step;
+    state.frame_reset_value = _frame_reset_value;
+    state.length_clocked = _length_clocked;
+}
+
+
+void Apu::load_state(const State& state)
+{
+    // Close the blip buffer's frame on the old timeline, the loaded one starts a new frame from its own cycle
+    if (_sample_rate)
+        end_blip_frame(_cycle);
+
+    _cycle = state.cycle;
+    _next_event = state.next_event;
+    _frame_start = state.frame_start;
+    _frame_reset = state.frame_reset;
+    _length_clock_cycle = state.length_clock_cycle;
+    memcpy(_pulse, state.pulse, sizeof(_pulse));
+    _triangle = state.triangle;
+    _noise = state.noise;
+    _dmc = state.dmc;
+    _enabled = state.enabled;
+    _frame_mode = state.frame_mode;
+    _frame_irq_inhibit = state.frame_irq_inhibit;
+    _frame_irq = state.frame_irq;
+    _dmc_irq = state.dmc_irq;
+    _frame_step = state.frame_step;
+    _frame_reset_value = state.frame_reset_value;
+    _length_clocked = state.length_clocked;
+    _blip_cycle = _cycle;
+}
+
+
+void Apu::end_blip_frame(uint64_t cycle)
+{
+    _blip.end_frame(uint32_t(cycle - _blip_cycle));
+    _blip_cycle = cycle;
+}
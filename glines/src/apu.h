@@ -0,0 +1,240 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "blip_buffer.h"
+#include "region.h"
+
+class gli2A03;
+
+/*
+    The 2A03's audio processing unit: two pulse channels, triangle, noise and the delta modulation channel, and the frame counter
+    which clocks their envelopes, sweeps and length counters and raises the frame IRQ.
+
+    Nothing is clocked per CPU cycle. The APU keeps the CPU cycle it has been run up to and catches up to the CPU when its registers
+    are accessed, when the samples are flushed and when next_event() is reached - the next cycle the rest of the system could see
+    something happen without accessing it (the frame IRQ being raised or the DMC fetching a sample byte). Catching up steps from one
+    channel timer expiry or frame counter step to the next rather than cycle by cycle.
+
+    https://wiki.nesdev.com/w/index.php/APU
+*/
+class Apu
+{
+public:
+    typedef std::function<uint8_t(uint16_t addr)> ReadCallback;
+
+    enum Registers : uint16_t
+    {
+        PULSE1_BASE = 0x4000,
+        PULSE2_BASE = 0x4004,
+        TRIANGLE_BASE = 0x4008,
+        NOISE_BASE = 0x400C,
+        DMC_BASE = 0x4010,
+        DMC_TOP = 0x4013,
+        STATUS = 0x4015,
+        FRAME_COUNTER = 0x4017,
+    };
+
+
+    Apu() = default;
+    ~Apu() = default;
+
+    // The DMC reads samples through the CPU's bus and stalls the CPU while it does
+    void connect(gli2A03* cpu, ReadCallback dma_read);
+    void set_region(Region region);
+
+    void reset(bool coldstart);
+
+    void cpu_write(uint16_t address, uint8_t value);
+    uint8_t cpu_read(uint16_t address);
+
+    // CPU cycle the APU must be run to with run() even if its registers aren't accessed
+    uint64_t next_event() const { return _next_event; }
+    void run();
+
+    /*
+        Mixed output at sample_rate Hz (0, the default, for none), band-limited from the mixer's level changes by a BlipBuffer of the
+        given quality. Samples are signed with DC removed and full scale is the mixer's full output. flush() brings the APU up to the
+        CPU's cycle so the samples cover everything emulated (less the synthesis delay), they accumulate until the caller clears them.
+    */
+    void set_sample_rate(uint32_t sample_rate, BlipBuffer::Quality quality = BlipBuffer::Quality::Medium);
+
+    // Scales the sample rate from the next flush(), see AudioOutput::rate_adjust()
+    void set_rate_adjust(double ratio) { _blip.set_rate_adjust(ratio); }
+    void flush();
+    std::vector<int16_t>& samples() { return _samples; }
+
+    /*
+        The channels and frame counter (see Nes::State). Audio output carries on across a load, samples already synthesised are kept and
+        the loaded state's output follows them.
+    */
+    struct State;
+    void save_state(State& state) const;
+    void load_state(const State& state);
+
+private:
+    struct Envelope
+    {
+        bool start;
+        bool loop;          // Also the length counter halt flag
+        bool constant;
+        uint8_t period;     // Also the constant volume
+        uint8_t divider;
+        uint8_t decay;
+
+        void clock();
+        uint8_t volume() const { return constant ? period : decay; }
+    };
+
+
+    struct Pulse
+    {
+        Envelope envelope;
+        uint8_t duty;
+        uint8_t sequence;
+        uint16_t period;
+        uint64_t next_step;     // CPU cycle the timer next expires on
+        uint8_t length;
+        bool sweep_enabled;
+        bool sweep_negate;
+        bool sweep_reload;
+        uint8_t sweep_period;
+        uint8_t sweep_shift;
+        uint8_t sweep_divider;
+
+        uint16_t sweep_target(bool ones_complement) const;
+        bool muted(bool ones_complement) const;
+    };
+
+
+    struct Triangle
+    {
+        bool control;       // Also the length counter halt flag
+        bool linear_reload;
+        uint8_t linear_period;
+        uint8_t linear;
+        uint8_t sequence;
+        uint16_t period;
+        uint64_t next_step;
+        uint8_t length;
+    };
+
+
+    struct Noise
+    {
+        Envelope envelope;
+        bool mode;
+        uint16_t period;
+        uint16_t shift;
+        uint64_t next_step;
+        uint8_t length;
+    };
+
+
+    struct Dmc
+    {
+        bool irq_enabled;
+        bool loop;
+        uint16_t period;
+        uint16_t sample_address;
+        uint16_t sample_length;
+        uint16_t address;
+        uint16_t bytes_remaining;
+        uint8_t buffer;
+        bool buffer_full;
+        uint8_t shift;
+        uint8_t bits_remaining;
+        bool silence;
+        uint64_t next_step;
+        uint8_t output;     // 7-bit output level
+    };
+
+
+    struct FrameStep
+    {
+        uint32_t cycle;     // CPU cycles from the start of the sequence
+        uint8_t actions;
+    };
+
+
+    gli2A03* _cpu = nullptr;
+    ReadCallback _dma_read;
+    Region _region = Region::Ntsc;
+    const uint16_t* _noise_periods = nullptr;
+    const uint16_t* _dmc_periods = nullptr;
+    const FrameStep* _frame_steps[2] = {};
+
+    uint64_t _cycle = 0;        // CPU cycle the APU has been run up to
+    uint64_t _next_event = 0;
+
+    uint8_t _enabled;               // $4015 channel enables
+    Pulse _pulse[2];
+    Triangle _triangle;
+    Noise _noise;
+    Dmc _dmc;
+
+    // Frame counter
+    uint8_t _frame_mode;            // 0: 4-step, 1: 5-step
+    bool _frame_irq_inhibit;
+    bool _frame_irq;
+    bool _dmc_irq;
+    uint64_t _frame_start;          // CPU cycle the current sequence started on
+    uint8_t _frame_step;            // Next step of the sequence
+    uint64_t _frame_reset;          // CPU cycle a $4017 write takes effect on, ~0 for none
+    uint8_t _frame_reset_value;
+    uint64_t _length_clock_cycle;   // CPU cycle of the last half frame clock
+    uint8_t _length_clocked;        // Length counters it decremented (bit per channel), a reload on that cycle is ignored for them
+
+    // Output
+    uint32_t _sample_rate = 0;
+    BlipBuffer::Quality _quality = BlipBuffer::Quality::Medium;
+    BlipBuffer _blip;
+    uint64_t _blip_cycle = 0;       // CPU cycle the blip buffer's current frame started on
+    float _level = 0.0f;            // Mixer output last added to the blip buffer
+    std::vector<int16_t> _samples;
+
+
+    void run(uint64_t cycle);
+    void step_frame_counter();
+    void quarter_frame();
+    void half_frame();
+    void reload_length(uint8_t channel, uint8_t& length, uint8_t value);
+    void clock_sweep(Pulse& pulse, bool ones_complement);
+    void step_pulse(Pulse& pulse);
+    void step_triangle();
+    void step_noise();
+    void step_dmc();
+    void fetch_dmc_sample();
+    void restart_dmc_sample();
+    void update_irq();
+    void update_timers();
+    uint8_t pulse_output(const Pulse& pulse, bool ones_complement) const;
+    void update_next_event();
+    uint64_t next_frame_step() const;
+    void mix(uint64_t cycle);
+    void end_blip_frame(uint64_t cycle);
+};
+
+
+struct Apu::State
+{
+    uint64_t cycle;
+    uint64_t next_event;
+    uint64_t frame_start;
+    uint64_t frame_reset;
+    uint64_t length_clock_cycle;
+    Pulse pulse[2];
+    Triangle triangle;
+    Noise noise;
+    Dmc dmc;
+    uint8_t enabled;
+    uint8_t frame_mode;
+    bool frame_irq_inhibit;
+    bool frame_irq;
+    bool dmc_irq;
+    uint8_t frame_step;
+    uint8_t frame_reset_value;
+    uint8_t length_clocked;
+};
@@ -0,0 +1,60 @@
+#include "audio_output.h"
+
+#include <algorithm>
+
+
+AudioOutput::AudioOutput(std::unique_ptr<AudioSink> sink, uint32_t sample_rate, uint32_t latency_ms)
+    : _sink(std::move(sink))
+    , _ring(size_t(sample_rate) * latency_ms * 2 / 1000)
+    , _sample_rate(sample_rate)
+    , _target(size_t(sample_rate) * latency_ms / 1000)
+{
+}
+
+
+AudioOutput::~AudioOutput()
+{
+    stop();
+}
+
+
+bool AudioOutput::start()
+{
+    if (!_started)
+    {
+        // Start at the target level so the sink doesn't run dry while the first frames arrive
+        std::vector<int16_t> silence(_target);
+        _ring.write(silence.data(), silence.size());
+        _started = _sink->open(_ring, _sample_rate);
+    }
+
+    return _started;
+}
+
+
+void AudioOutput::stop()
+{
+    if (_started)
+    {
+        _sink->close();
+        _started = false;
+    }
+}
+
+
+void AudioOutput::write(std::vector<int16_t>& samples)
+{
+    size_t written = _ring.write(samples.data(), samples.size());
+    _dropped += samples.size() - written;
+    samples.clear();
+}
+
+
+double AudioOutput::rate_adjust()
+{
+    // Full deviation at empty (produce more) and at twice the target (produce less)
+    static constexpr double DriftGain = 0.005;
+    double error = std::min(std::max((double(_target) - double(_ring.size())) / double(_target), -1.0), 1.0);
+    _drift = std::min(std::max(_drift + error * DriftGain, -1.0), 1.0);
+    return 1.0 + MaxRateDeviation * std::min(std::max(error + _drift, -1.0), 1.0);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "audio_ring.h"
+#include "audio_sink.h"
+
+/*
+    Hands samples from the emulation thread to a sink's thread through an AudioRing, keeping the two in step without either waiting
+    on the other.
+
+    Emulation is paced by the display, so the emulated console's audio rate and the audio device's clock drift apart. Dynamic rate
+    control (as described by byuu/Near) steers the fill level of the ring towards half full by nudging the rate samples are produced
+    at by up to MaxRateDeviation: rate_adjust() is the ratio to apply to the sample rate of the next frame of audio (see
+    Apu::set_rate_adjust()). A fraction of a percent is inaudible as pitch but absorbs the drift, so the ring neither fills (adding
+    latency, and eventually dropping samples) nor empties (stuttering).
+
+    The adjustment is proportional to the distance from the target plus a slowly accumulated term, without which a constant drift
+    would hold the level away from the target by an amount proportional to the drift (most of the way to empty for a 59.94Hz
+    display).
+*/
+class AudioOutput
+{
+public:
+    static constexpr double MaxRateDeviation = 0.005;
+
+    // The ring holds up to twice latency_ms of audio and the target is half of that
+    AudioOutput(std::unique_ptr<AudioSink> sink, uint32_t sample_rate, uint32_t latency_ms = 50);
+    ~AudioOutput();
+
+    bool start();
+    void stop();
+
+    // Queues the samples and clears them, samples which don't fit in the ring are dropped
+    void write(std::vector<int16_t>& samples);
+
+    // Call once per frame after write()
+    double rate_adjust();
+
+    uint32_t sample_rate() const { return _sample_rate; }
+    size_t buffered() const { return _ring.size(); }
+    uint64_t dropped() const { return _dropped; }
+    uint64_t underruns() const { return _sink->underruns(); }
+
+private:
+    std::unique_ptr<AudioSink> _sink;
+    AudioRing _ring;
+    uint32_t _sample_rate;
+    size_t _target;
+    double _drift = 0.0;        // Accumulated error, in units of MaxRateDeviation
+    bool _started = false;
+    uint64_t _dropped = 0;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+    Lock-free single producer, single consumer ring of samples between the emulation thread (writing) and an audio output thread
+    (reading). Each side only stores its own index, with release ordering so the other side's acquire load sees the samples copied
+    before it. The capacity is rounded up to a power of two and the indexes run freely, wrapping through the mask.
+*/
+class AudioRing
+{
+public:
+    explicit AudioRing(size_t capacity)
+    {
+        size_t size = 1;
+
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+
+        _buffer.resize(size);
+        _mask = size - 1;
+    }
+
+
+    size_t capacity() const { return _buffer.size(); }
+
+    // Samples waiting to be read, exact from the consumer and a lower bound from the producer
+    size_t size() const { return _write.load(std::memory_order_acquire) - _read.load(std::memory_order_acquire); }
+
+
+    // Producer only, returns the number of samples written (less than count if the ring fills)
+    size_t write(const int16_t* samples, size_t count)
+    {
+        size_t write = _write.load(std::memory_order_relaxed);
+        size_t read = _read.load(std::memory_order_acquire);
+        count = std::min(count, capacity() - (write - read));
+        copy_in(samples, count, write);
+        _write.store(write + count, std::memory_order_release);
+        return count;
+    }
+
+
+    // Consumer only, returns the number of samples read (less than count if the ring empties)
+    size_t read(int16_t* samples, size_t count)
+    {
+        size_t read = _read.load(std::memory_order_relaxed);
+        size_t write = _write.load(std::memory_order_acquire);
+        count = std::min(count, write - read);
+        copy_out(samples, count, read);
+        _read.store(read + count, std::memory_order_release);
+        return count;
+    }
+
+private:
+    std::vector<int16_t> _buffer;
+    size_t _mask;
+
+    // Padded onto separate cache lines so the two threads don't contend over them
+    std::atomic<size_t> _write{ 0 };
+    uint8_t _padding[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> _read{ 0 };
+
+
+    void copy_in(const int16_t* samples, size_t count, size_t index)
+    {
+        size_t start = index & _mask;
+        size_t first = std::min(count, capacity() - start);
+        memcpy(&_buffer[start], samples, first * sizeof(int16_t));
+        memcpy(&_buffer[0], samples + first, (count - first) * sizeof(int16_t));
+    }
+
+
+    void copy_out(int16_t* samples, size_t count, size_t index) const
+    {
+        size_t start = index & _mask;
+        size_t first = std::min(count, capacity() - start);
+        memcpy(samples, &_buffer[start], first * sizeof(int16_t));
+        memcpy(samples + first, &_buffer[0], (count - first) * sizeof(int16_t));
+    }
+};
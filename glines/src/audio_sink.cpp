@@ -0,0 +1,253 @@
+#include "audio_sink.h"
+
+#include "audio_ring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <mmsystem.h>
+
+#pragma comment(lib, "winmm.lib")
+#endif
+
+
+void AudioSink::pull(AudioRing& ring, int16_t* samples, size_t count)
+{
+    size_t read = ring.read(samples, count);
+
+    if (read)
+    {
+        _last_sample = samples[read - 1];
+    }
+
+    if (read < count)
+    {
+        std::fill(samples + read, samples + count, _last_sample);
+        _underruns.fetch_add(count - read, std::memory_order_relaxed);
+    }
+}
+
+
+bool write_wav_header(FILE* file, uint32_t sample_rate, uint32_t data_size)
+{
+    // Little endian like the samples themselves
+    struct
+    {
+        char riff[4];
+        uint32_t riff_size;
+        char wave[4];
+        char fmt[4];
+        uint32_t fmt_size;
+        uint16_t format;
+        uint16_t channels;
+        uint32_t sample_rate;
+        uint32_t byte_rate;
+        uint16_t block_align;
+        uint16_t bits_per_sample;
+        char data[4];
+        uint32_t data_size;
+    } header =
+    {
+        { 'R', 'I', 'F', 'F' }, 36 + data_size, { 'W', 'A', 'V', 'E' }, { 'f', 'm', 't', ' ' }, 16, 1, 1, sample_rate,
+        sample_rate * 2, 2, 16, { 'd', 'a', 't', 'a' }, data_size,
+    };
+
+    static_assert(sizeof(header) == 44, "WAV header must be packed");
+    return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+
+TimerAudioSink::~TimerAudioSink()
+{
+    close();
+}
+
+
+bool TimerAudioSink::open(AudioRing& ring, uint32_t sample_rate)
+{
+    // Only stop the thread, a derived class's open() has already set up what consume() writes to
+    TimerAudioSink::close();
+    _quit = false;
+    _thread = std::thread(&TimerAudioSink::run, this, &ring, sample_rate);
+    return true;
+}
+
+
+void TimerAudioSink::close()
+{
+    if (_thread.joinable())
+    {
+        _quit = true;
+        _thread.join();
+    }
+}
+
+
+void TimerAudioSink::run(AudioRing* ring, uint32_t sample_rate)
+{
+    // Samples due are worked out from the time since opening, so sleeping late doesn't change the rate samples are consumed at
+    auto start = std::chrono::steady_clock::now();
+    uint64_t consumed = 0;
+    std::vector<int16_t> samples;
+
+    while (!_quit)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(PeriodMilliseconds));
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        uint64_t due = uint64_t(elapsed.count()) * sample_rate / 1000000;
+        samples.resize(size_t(due - consumed));
+        pull(*ring, samples.data(), samples.size());
+        consume(samples.data(), samples.size());
+        consumed = due;
+    }
+}
+
+
+WavFileAudioSink::~WavFileAudioSink()
+{
+    close();
+}
+
+
+bool WavFileAudioSink::open(AudioRing& ring, uint32_t sample_rate)
+{
+    close();
+
+    _file = fopen(_path.c_str(), "wb");
+
+    if (!_file)
+    {
+        return false;
+    }
+
+    _sample_rate = sample_rate;
+    _data_size = 0;
+    write_wav_header(_file, _sample_rate, _data_size);
+    return TimerAudioSink::open(ring, sample_rate);
+}
+
+
+void WavFileAudioSink::close()
+{
+    TimerAudioSink::close();
+
+    if (_file)
+    {
+        // Fill in the sizes now they're known
+        fseek(_file, 0, SEEK_SET);
+        write_wav_header(_file, _sample_rate, _data_size);
+        fclose(_file);
+        _file = nullptr;
+    }
+}
+
+
+void WavFileAudioSink::consume(const int16_t* samples, size_t count)
+{
+    _data_size += uint32_t(fwrite(samples, sizeof(int16_t), count, _file) * sizeof(int16_t));
+}
+
+
+#if defined(_WIN32)
+WaveOutAudioSink::~WaveOutAudioSink()
+{
+    close();
+}
+
+
+bool WaveOutAudioSink::open(AudioRing& ring, uint32_t sample_rate)
+{
+    close();
+
+    WAVEFORMATEX format{};
+    format.wFormatTag = WAVE_FORMAT_PCM;
+    format.nChannels = 1;
+    format.nSamplesPerSec = sample_rate;
+    format.nAvgBytesPerSec = sample_rate * sizeof(int16_t);
+    format.nBlockAlign = sizeof(int16_t);
+    format.wBitsPerSample = 16;
+
+    _event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    HWAVEOUT device = nullptr;
+
+    if (!_event || waveOutOpen(&device, WAVE_MAPPER, &format, (DWORD_PTR)_event, 0, CALLBACK_EVENT) != MMSYSERR_NOERROR)
+    {
+        close();
+        return false;
+    }
+
+    _device = device;
+    _quit = false;
+    _thread = std::thread(&WaveOutAudioSink::run, this, &ring, sample_rate);
+    return true;
+}
+
+
+void WaveOutAudioSink::close()
+{
+    if (_thread.joinable())
+    {
+        _quit = true;
+        SetEvent((HANDLE)_event);
+        _thread.join();
+    }
+
+    if (_device)
+    {
+        waveOutClose((HWAVEOUT)_device);
+        _device = nullptr;
+    }
+
+    if (_event)
+    {
+        CloseHandle((HANDLE)_event);
+        _event = nullptr;
+    }
+}
+
+
+void WaveOutAudioSink::run(AudioRing* ring, uint32_t sample_rate)
+{
+    // The device plays the buffers in turn, each one is refilled from the ring as soon as it's finished with
+    HWAVEOUT device = (HWAVEOUT)_device;
+    size_t buffer_samples = sample_rate * BufferMilliseconds / 1000;
+    std::vector<int16_t> samples(buffer_samples * BufferCount);
+    WAVEHDR headers[BufferCount] = {};
+
+    for (int i = 0; i < BufferCount; ++i)
+    {
+        headers[i].lpData = (LPSTR)&samples[i * buffer_samples];
+        headers[i].dwBufferLength = DWORD(buffer_samples * sizeof(int16_t));
+        waveOutPrepareHeader(device, &headers[i], sizeof(WAVEHDR));
+        headers[i].dwFlags |= WHDR_DONE;
+    }
+
+    while (!_quit)
+    {
+        for (WAVEHDR& header : headers)
+        {
+            if (header.dwFlags & WHDR_DONE)
+            {
+                pull(*ring, (int16_t*)header.lpData, buffer_samples);
+                header.dwFlags &= ~WHDR_DONE;
+                waveOutWrite(device, &header, sizeof(WAVEHDR));
+            }
+        }
+
+        WaitForSingleObject((HANDLE)_event, INFINITE);
+    }
+
+    waveOutReset(device);
+
+    for (WAVEHDR& header : headers)
+    {
+        waveOutUnprepareHeader(device, &header, sizeof(WAVEHDR));
+    }
+}
+#endif
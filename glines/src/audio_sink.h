@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+class AudioRing;
+
+// Canonical 44 byte header for mono 16-bit PCM, written at the file's current position
+bool write_wav_header(FILE* file, uint32_t sample_rate, uint32_t data_size);
+
+/*
+    Where mono 16-bit samples from an AudioOutput go. A sink runs its own thread which pulls samples from the ring as its device
+    consumes them, so the ring's fill level reflects the device's clock rather than the emulator's.
+*/
+class AudioSink
+{
+public:
+    virtual ~AudioSink() = default;
+
+    virtual bool open(AudioRing& ring, uint32_t sample_rate) = 0;
+    virtual void close() = 0;
+
+    // Samples the device needed which weren't in the ring
+    uint64_t underruns() const { return _underruns.load(std::memory_order_relaxed); }
+
+protected:
+    /*
+        Fills samples from the ring, on an underrun the rest are filled with the last sample read rather than zero so a late frame is
+        a flat spot instead of a click.
+    */
+    void pull(AudioRing& ring, int16_t* samples, size_t count);
+
+private:
+    std::atomic<uint64_t> _underruns{ 0 };
+    int16_t _last_sample = 0;
+};
+
+
+/*
+    Consumes samples in real time from a timer instead of a device, handing them to consume() every PeriodMilliseconds. For running on
+    machines without audio output and for testing rate control.
+*/
+class TimerAudioSink : public AudioSink
+{
+public:
+    // Derived classes must close() in their destructor, the thread calls consume()
+    ~TimerAudioSink() override;
+
+    bool open(AudioRing& ring, uint32_t sample_rate) override;
+    void close() override;
+
+protected:
+    static constexpr uint32_t PeriodMilliseconds = 10;
+
+    virtual void consume(const int16_t* samples, size_t count) = 0;
+
+private:
+    std::thread _thread;
+    std::atomic<bool> _quit{ false };
+
+
+    void run(AudioRing* ring, uint32_t sample_rate);
+};
+
+
+// Discards everything
+class NullAudioSink : public TimerAudioSink
+{
+public:
+    ~NullAudioSink() override { close(); }
+
+protected:
+    void consume(const int16_t*, size_t) override {}
+};
+
+
+// Writes everything consumed to a mono 16-bit WAV file
+class WavFileAudioSink : public TimerAudioSink
+{
+public:
+    explicit WavFileAudioSink(const std::string& path) : _path(path) {}
+    ~WavFileAudioSink() override;
+
+    bool open(AudioRing& ring, uint32_t sample_rate) override;
+    void close() override;
+
+protected:
+    void consume(const int16_t* samples, size_t count) override;
+
+private:
+    std::string _path;
+    FILE* _file = nullptr;
+    uint32_t _sample_rate = 0;
+    uint32_t _data_size = 0;
+};
+
+
+#if defined(_WIN32)
+// The default output device through waveOut
+class WaveOutAudioSink : public AudioSink
+{
+public:
+    ~WaveOutAudioSink() override;
+
+    bool open(AudioRing& ring, uint32_t sample_rate) override;
+    void close() override;
+
+private:
+    static constexpr int BufferCount = 4;
+    static constexpr uint32_t BufferMilliseconds = 10;
+
+    void* _device = nullptr;        // HWAVEOUT
+    void* _event = nullptr;         // HANDLE signalled as buffers finish playing
+    std::thread _thread;
+    std::atomic<bool> _quit{ false };
+
+
+    void run(AudioRing* ring, uint32_t sample_rate);
+};
+#endif
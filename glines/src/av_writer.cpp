@@ -0,0 +1,453 @@
+#include "av_writer.h"
+
+#include "audio_sink.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+// Everything before the AVI's movi list contents (the headers, padded)
+static constexpr uint32_t HeaderSize = 2048;
+
+
+static constexpr uint32_t fourcc(const char (&id)[5])
+{
+    return uint32_t(uint8_t(id[0])) | uint32_t(uint8_t(id[1])) << 8 | uint32_t(uint8_t(id[2])) << 16 | uint32_t(uint8_t(id[3])) << 24;
+}
+
+
+// Little endian RIFF structures built up a field at a time, lists and chunks have their sizes filled in when they're ended
+class RiffBuilder
+{
+public:
+    std::vector<uint8_t> data;
+
+    void u16(uint16_t value) { put(&value, 2); }
+    void u32(uint32_t value) { put(&value, 4); }
+    void put(const void* bytes, size_t size) { data.insert(data.end(), (const uint8_t*)bytes, (const uint8_t*)bytes + size); }
+
+    void begin(uint32_t id, uint32_t list_type = 0)
+    {
+        u32(id);
+        _open.push_back(data.size());
+        u32(0);
+
+        if (list_type)
+            u32(list_type);
+    }
+
+    void end()
+    {
+        uint32_t size = uint32_t(data.size() - _open.back() - 4);
+        memcpy(&data[_open.back()], &size, 4);
+        _open.pop_back();
+    }
+
+private:
+    std::vector<size_t> _open;
+};
+
+
+AvWriter::~AvWriter()
+{
+    close();
+}
+
+
+bool AvWriter::open(const Settings& settings)
+{
+    close();
+
+    _settings = settings;
+    _error.clear();
+    _frames = 0;
+    _stalls = 0;
+
+    auto open_file = [this](const std::string& path, FILE*& file)
+    {
+        if (!path.empty() && (file = fopen(path.c_str(), "wb")) == nullptr)
+            fail("unable to open " + path);
+    };
+
+    open_file(_settings.wav_path, _wav);
+    open_file(_settings.video_path, _video);
+    open_file(_settings.avi_path, _avi);
+
+    if (!_error.empty())
+    {
+        for (FILE** file : { &_wav, &_video, &_avi })
+        {
+            if (*file)
+                fclose(*file);
+
+            *file = nullptr;
+        }
+
+        return false;
+    }
+
+    _wav_bytes = 0;
+    _avi_frames = 0;
+    _avi_samples = 0;
+    _avi_movi_size = 0;
+    _avi_index.clear();
+
+    if (_wav)
+        write_wav_header(_wav, _settings.sample_rate, 0);
+
+    if (_avi)
+        write_avi_header();
+
+    _slots.resize(std::max<size_t>(_settings.queue_frames, 1));
+    _free.clear();
+    _queued.clear();
+
+    for (Frame& slot : _slots)
+    {
+        _free.push_back(&slot);
+    }
+
+    _closing = false;
+    _thread = std::thread(&AvWriter::run, this);
+    return true;
+}
+
+
+void AvWriter::write_frame(const uint16_t* pixels, std::vector<int16_t>& samples)
+{
+    Frame* frame = nullptr;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (_free.empty())
+        {
+            ++_stalls;
+            _slot_freed.wait(lock, [this]() { return !_free.empty(); });
+        }
+
+        frame = _free.front();
+        _free.pop_front();
+    }
+
+    memcpy(frame->pixels.data(), pixels, sizeof(frame->pixels));
+    frame->samples.swap(samples);
+    samples.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queued.push_back(frame);
+        ++_frames;
+    }
+
+    _frame_queued.notify_one();
+}
+
+
+bool AvWriter::close()
+{
+    if (_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closing = true;
+        }
+
+        _frame_queued.notify_one();
+        _thread.join();
+    }
+
+    if (_wav)
+    {
+        fseek(_wav, 0, SEEK_SET);
+        write_wav_header(_wav, _settings.sample_rate, _wav_bytes);
+
+        if (fclose(_wav) != 0)
+            fail("unable to write " + _settings.wav_path);
+
+        _wav = nullptr;
+    }
+
+    if (_video)
+    {
+        if (fclose(_video) != 0)
+            fail("unable to write " + _settings.video_path);
+
+        _video = nullptr;
+    }
+
+    if (_avi && !finish_avi())
+    {
+        fail("unable to write " + _settings.avi_path);
+    }
+
+    return _error.empty();
+}
+
+
+void AvWriter::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;)
+    {
+        _frame_queued.wait(lock, [this]() { return _closing || !_queued.empty(); });
+
+        if (_queued.empty())
+        {
+            return;
+        }
+
+        Frame* frame = _queued.front();
+        _queued.pop_front();
+        lock.unlock();
+
+        write(*frame);
+
+        lock.lock();
+        _free.push_back(frame);
+        _slot_freed.notify_one();
+    }
+}
+
+
+void AvWriter::write(const Frame& frame)
+{
+    uint32_t sample_bytes = uint32_t(frame.samples.size() * sizeof(int16_t));
+
+    if (_wav)
+    {
+        if (fwrite(frame.samples.data(), 1, sample_bytes, _wav) != sample_bytes)
+            fail("unable to write " + _settings.wav_path);
+
+        _wav_bytes += sample_bytes;
+    }
+
+    if (_video)
+    {
+        _rgba.resize(frame.pixels.size());
+
+        for (size_t i = 0; i < frame.pixels.size(); ++i)
+        {
+            _rgba[i] = _settings.palette[frame.pixels[i] & 0x1FF];
+        }
+
+        if (fwrite(_rgba.data(), sizeof(uint32_t), _rgba.size(), _video) != _rgba.size())
+            fail("unable to write " + _settings.video_path);
+    }
+
+    if (_avi)
+    {
+        // Stop before the file outgrows RIFF's 32-bit sizes, leaving room for this frame's chunks and the index
+        uint64_t size = HeaderSize + uint64_t(_avi_movi_size) + Width * Height + sample_bytes + 16 + (_avi_index.size() + 2) * 16;
+
+        if (size > 0xFFFFFFFFull)
+        {
+            fail("AVI reached the 4GB limit of the format at frame " + std::to_string(_avi_frames));
+            finish_avi();
+            return;
+        }
+
+        // DIBs are stored bottom up
+        _indexed.resize(Width * Height);
+
+        for (int y = 0; y < Height; ++y)
+        {
+            const uint16_t* src = &frame.pixels[size_t(y) * Width];
+            uint8_t* dest = &_indexed[size_t(Height - 1 - y) * Width];
+
+            for (int x = 0; x < Width; ++x)
+            {
+                dest[x] = uint8_t(src[x] & 0x3F);
+            }
+        }
+
+        write_avi_chunk(fourcc("00db"), _indexed.data(), uint32_t(_indexed.size()));
+        _avi_frames++;
+
+        if (sample_bytes)
+        {
+            write_avi_chunk(fourcc("01wb"), frame.samples.data(), sample_bytes);
+            _avi_samples += uint32_t(frame.samples.size());
+        }
+    }
+}
+
+
+void AvWriter::write_avi_header()
+{
+    /*
+        https://docs.microsoft.com/en-us/windows/win32/directshow/avi-riff-file-reference
+
+        Written with zero counts when the file is opened and again with the final ones when it's finished, the movi list's contents
+        and the index follow it.
+    */
+    const bool audio = _settings.sample_rate != 0;
+    const uint32_t frame_size = Width * Height;
+    const uint32_t file_size = HeaderSize + _avi_movi_size + 8 + uint32_t(_avi_index.size()) * 16;
+    RiffBuilder riff;
+
+    riff.u32(fourcc("RIFF"));
+    riff.u32(0);
+    riff.u32(fourcc("AVI "));
+
+    riff.begin(fourcc("LIST"), fourcc("hdrl"));
+    {
+        riff.begin(fourcc("avih"));
+        riff.u32(uint32_t(1000000ull * _settings.frame_scale / std::max(_settings.frame_rate, 1u)));  // Microseconds per frame
+        riff.u32(0);                        // Max bytes per second
+        riff.u32(0);                        // Padding granularity
+        riff.u32(0x10);                     // AVIF_HASINDEX
+        riff.u32(_avi_frames);
+        riff.u32(0);                        // Initial frames
+        riff.u32(audio ? 2 : 1);            // Streams
+        riff.u32(frame_size);               // Suggested buffer size
+        riff.u32(Width);
+        riff.u32(Height);
+        riff.put(std::array<uint32_t, 4>{}.data(), 16);
+        riff.end();
+
+        riff.begin(fourcc("LIST"), fourcc("strl"));
+        {
+            riff.begin(fourcc("strh"));
+            riff.u32(fourcc("vids"));
+            riff.u32(0);                    // Handler
+            riff.u32(0);                    // Flags
+            riff.u16(0);                    // Priority
+            riff.u16(0);                    // Language
+            riff.u32(0);                    // Initial frames
+            riff.u32(_settings.frame_scale);
+            riff.u32(_settings.frame_rate);
+            riff.u32(0);                    // Start
+            riff.u32(_avi_frames);          // Length
+            riff.u32(frame_size);           // Suggested buffer size
+            riff.u32(~0u);                  // Quality
+            riff.u32(0);                    // Sample size
+            riff.u16(0); riff.u16(0); riff.u16(Width); riff.u16(Height);
+            riff.end();
+
+            // BITMAPINFOHEADER and the 64 colours of the palette (as RGBQUADs, blue first) padded to 256
+            riff.begin(fourcc("strf"));
+            riff.u32(40);
+            riff.u32(Width);
+            riff.u32(Height);               // Positive for bottom up
+            riff.u16(1);                    // Planes
+            riff.u16(8);                    // Bits per pixel
+            riff.u32(0);                    // BI_RGB
+            riff.u32(frame_size);
+            riff.u32(0);
+            riff.u32(0);
+            riff.u32(256);                  // Colours used
+            riff.u32(0);
+
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t rgba = i < 64 && _settings.palette ? _settings.palette[i] : 0;
+                riff.u32(((rgba & 0xFF) << 16) | (rgba & 0xFF00) | ((rgba >> 16) & 0xFF));
+            }
+
+            riff.end();
+        }
+        riff.end();
+
+        if (audio)
+        {
+            riff.begin(fourcc("LIST"), fourcc("strl"));
+            {
+                riff.begin(fourcc("strh"));
+                riff.u32(fourcc("auds"));
+                riff.u32(0);
+                riff.u32(0);
+                riff.u16(0);
+                riff.u16(0);
+                riff.u32(0);
+                riff.u32(sizeof(int16_t));  // Scale and rate give samples (blocks) per second
+                riff.u32(_settings.sample_rate * sizeof(int16_t));
+                riff.u32(0);
+                riff.u32(_avi_samples);
+                riff.u32(_settings.sample_rate * sizeof(int16_t));
+                riff.u32(~0u);
+                riff.u32(sizeof(int16_t));  // Sample size
+                riff.u16(0); riff.u16(0); riff.u16(0); riff.u16(0);
+                riff.end();
+
+                // WAVEFORMATEX for mono 16-bit PCM
+                riff.begin(fourcc("strf"));
+                riff.u16(1);
+                riff.u16(1);
+                riff.u32(_settings.sample_rate);
+                riff.u32(_settings.sample_rate * sizeof(int16_t));
+                riff.u16(sizeof(int16_t));
+                riff.u16(16);
+                riff.u16(0);
+                riff.end();
+            }
+            riff.end();
+        }
+
+    }
+    riff.end();
+
+    // Pad the header to a fixed size so the movi list always starts at the same offset
+    riff.begin(fourcc("JUNK"));
+    riff.data.resize(HeaderSize - 12, 0);
+    riff.end();
+
+    riff.u32(fourcc("LIST"));
+    riff.u32(4 + _avi_movi_size);
+    riff.u32(fourcc("movi"));
+
+    uint32_t riff_size = file_size - 8;
+    memcpy(&riff.data[4], &riff_size, 4);
+
+    if (fwrite(riff.data.data(), 1, riff.data.size(), _avi) != riff.data.size())
+        fail("unable to write " + _settings.avi_path);
+}
+
+
+void AvWriter::write_avi_chunk(uint32_t id, const void* data, uint32_t size)
+{
+    // Index offsets are from the movi list's type, chunks are padded to an even size
+    static const uint8_t pad = 0;
+    _avi_index.push_back({ id, 4 + _avi_movi_size, size });
+
+    bool written = fwrite(&id, 4, 1, _avi) == 1 && fwrite(&size, 4, 1, _avi) == 1 && fwrite(data, 1, size, _avi) == size;
+    written = written && ((size & 1) == 0 || fwrite(&pad, 1, 1, _avi) == 1);
+
+    if (!written)
+        fail("unable to write " + _settings.avi_path);
+
+    _avi_movi_size += 8 + ((size + 1) & ~1u);
+}
+
+
+bool AvWriter::finish_avi()
+{
+    RiffBuilder index;
+    index.begin(fourcc("idx1"));
+
+    for (const AviIndexEntry& entry : _avi_index)
+    {
+        index.u32(entry.id);
+        index.u32(0x10);    // AVIIF_KEYFRAME
+        index.u32(entry.offset);
+        index.u32(entry.size);
+    }
+
+    index.end();
+
+    bool written = fwrite(index.data.data(), 1, index.data.size(), _avi) == index.data.size();
+    fseek(_avi, 0, SEEK_SET);
+    write_avi_header();
+    written = fclose(_avi) == 0 && written;
+    _avi = nullptr;
+    return written;
+}
+
+
+void AvWriter::fail(const std::string& error)
+{
+    // Keep the first error, later ones tend to follow from it
+    if (_error.empty())
+        _error = error;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+    Writes emulated frames and their audio to files from a background thread, for offline rendering. The emulation thread only copies
+    each frame into a slot of a bounded queue; converting pixels and all file I/O happen on the writer thread. When the writer falls
+    behind the queue fills and write_frame() waits for a slot rather than letting memory grow.
+
+    Any combination of outputs can be written:
+        WAV        mono 16-bit PCM
+        raw video  256x240 RGBA32 frames back to back (e.g. ffmpeg -f rawvideo -pixel_format rgba -video_size 256x240)
+        AVI        8-bit palettized video (palette indexes, emphasis isn't represented) and PCM audio interleaved a frame at a time.
+                   An AVI 1.0 file is limited to 4GB, around 18 minutes of NTSC video.
+*/
+class AvWriter
+{
+public:
+    static constexpr int Width = 256;
+    static constexpr int Height = 240;
+
+    struct Settings
+    {
+        std::string wav_path;           // Empty for no output of each kind
+        std::string video_path;
+        std::string avi_path;
+        uint32_t frame_rate = 0;        // Frames per second as the fraction frame_rate / frame_scale
+        uint32_t frame_scale = 1;
+        uint32_t sample_rate = 0;
+        const uint32_t* palette = nullptr;  // 512 entry RGBA lookup for 9-bit pixels (see RgbaConverter::lut())
+        size_t queue_frames = 8;
+    };
+
+
+    AvWriter() = default;
+    ~AvWriter();
+
+    bool open(const Settings& settings);
+
+    // Pixels are 9-bit PPU output (see gli2C02::set_emphasis_output()), samples are taken and cleared
+    void write_frame(const uint16_t* pixels, std::vector<int16_t>& samples);
+
+    // Writes the queued frames and completes the files, false if anything failed to be written (see error())
+    bool close();
+
+    const std::string& error() const { return _error; }
+    uint32_t frames() const { return _frames; }
+    uint32_t stalls() const { return _stalls; }     // Times write_frame() had to wait for the writer to free a slot
+
+private:
+    struct Frame
+    {
+        std::array<uint16_t, Width * Height> pixels;
+        std::vector<int16_t> samples;
+    };
+
+
+    struct AviIndexEntry
+    {
+        uint32_t id;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+
+    Settings _settings;
+    std::vector<Frame> _slots;
+    std::deque<Frame*> _free;
+    std::deque<Frame*> _queued;
+    std::mutex _mutex;
+    std::condition_variable _slot_freed;
+    std::condition_variable _frame_queued;
+    std::thread _thread;
+    bool _closing = false;
+    uint32_t _frames = 0;
+    uint32_t _stalls = 0;
+
+    // Writer thread
+    FILE* _wav = nullptr;
+    FILE* _video = nullptr;
+    FILE* _avi = nullptr;
+    uint32_t _wav_bytes = 0;
+    uint32_t _avi_frames = 0;
+    uint32_t _avi_samples = 0;
+    uint32_t _avi_movi_size = 0;
+    std::vector<AviIndexEntry> _avi_index;
+    std::vector<uint32_t> _rgba;
+    std::vector<uint8_t> _indexed;
+    std::string _error;
+
+
+    void run();
+    void write(const Frame& frame);
+    void write_avi_header();
+    void write_avi_chunk(uint32_t id, const void* data, uint32_t size);
+    bool finish_avi();
+    void fail(const std::string& error);
+};
@@ -0,0 +1,167 @@
+#include "batch_engine.h"
+
+#include "nes.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+
+struct BatchEngine::Instance
+{
+    std::unique_ptr<Nes> nes;
+    uint32_t frames = 0;
+    uint32_t frame = 0;
+    bool stopped = false;
+    InputCallback input;
+    FrameCallback frame_done;
+};
+
+
+struct BatchEngine::Worker
+{
+    std::mutex mutex;
+    std::deque<size_t> queue;
+};
+
+
+BatchEngine::BatchEngine(uint32_t threads)
+    : _threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency()))
+{
+    for (uint32_t i = 0; i < _threads; ++i)
+    {
+        _workers.push_back(std::make_unique<Worker>());
+    }
+}
+
+
+BatchEngine::~BatchEngine() = default;
+
+
+size_t BatchEngine::add(std::unique_ptr<Nes> nes, uint32_t frames, InputCallback input, FrameCallback frame_done)
+{
+    std::unique_ptr<Instance> instance = std::make_unique<Instance>();
+    instance->nes = std::move(nes);
+    instance->frames = frames;
+    instance->input = std::move(input);
+    instance->frame_done = std::move(frame_done);
+    _instances.push_back(std::move(instance));
+    return _instances.size() - 1;
+}
+
+
+Nes& BatchEngine::instance(size_t index)
+{
+    return *_instances[index]->nes;
+}
+
+
+uint32_t BatchEngine::frames_run(size_t index) const
+{
+    return _instances[index]->frame;
+}
+
+
+void BatchEngine::run()
+{
+    // Deal the instances with frames left out to the workers, they balance the load from there
+    size_t next_worker = 0;
+
+    for (size_t i = 0; i < _instances.size(); ++i)
+    {
+        if (!_instances[i]->stopped && _instances[i]->frame < _instances[i]->frames)
+        {
+            _workers[next_worker]->queue.push_back(i);
+            next_worker = (next_worker + 1) % _threads;
+            ++_queued;
+            ++_running;
+        }
+    }
+
+    std::vector<std::thread> threads;
+
+    for (uint32_t i = 1; i < std::min<size_t>(_threads, _running); ++i)
+    {
+        threads.emplace_back(&BatchEngine::work, this, i);
+    }
+
+    work(0);
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+
+bool BatchEngine::take(size_t worker, size_t& instance)
+{
+    for (size_t i = 0; i < _threads; ++i)
+    {
+        Worker& victim = *_workers[(worker + i) % _threads];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if (!victim.queue.empty())
+        {
+            // Our own most recent instance (still warm in this core's caches), or another worker's longest waiting one
+            instance = i ? victim.queue.front() : victim.queue.back();
+            i ? victim.queue.pop_front() : victim.queue.pop_back();
+            --_queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void BatchEngine::wake_idle(bool all)
+{
+    // Locking orders this against a worker between finding nothing to do and sleeping, which would otherwise miss the wakeup
+    if (all || _idle_workers)
+    {
+        std::lock_guard<std::mutex> lock(_idle_mutex);
+        all ? _idle.notify_all() : _idle.notify_one();
+    }
+}
+
+
+void BatchEngine::work(size_t worker)
+{
+    while (_running)
+    {
+        size_t index;
+
+        if (!take(worker, index))
+        {
+            // Everything left is running on other workers, sleep until one of them puts an instance back or the last one finishes
+            std::unique_lock<std::mutex> lock(_idle_mutex);
+            ++_idle_workers;
+            _idle.wait(lock, [this] { return !_running || _queued; });
+            --_idle_workers;
+            continue;
+        }
+
+        Instance& instance = *_instances[index];
+        instance.input ? instance.input(*instance.nes, instance.frame) : ((void)0);
+        instance.nes->run_frame();
+        instance.stopped = instance.frame_done && !instance.frame_done(*instance.nes, instance.frame);
+        ++instance.frame;
+
+        if (!instance.stopped && instance.frame < instance.frames)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_workers[worker]->mutex);
+                _workers[worker]->queue.push_back(index);
+                ++_queued;
+            }
+
+            wake_idle(false);
+        }
+        else if (--_running == 0)
+        {
+            wake_idle(true);
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Nes;
+
+/*
+    Runs many independent emulator instances in one process (test ROMs, regression movies, bot rollouts), a frame at a time on a pool
+    of worker threads, one per hardware thread by default.
+
+    Each worker has its own queue of instances waiting to run a frame. A worker runs a frame of the instance at the back of its queue
+    and puts it back there, so an instance tends to stay on one core; a worker with nothing queued steals from the front of another's
+    queue. The queues are only locked to take or return an instance, once a frame, so workers don't contend with each other. A worker
+    that finds every queue empty sleeps until an instance is put back or the last one finishes.
+
+    Per instance callbacks set its inputs before each frame and see its state after each one. They run on whichever worker runs the
+    frame, never concurrently for the same instance, but callbacks of different instances do run concurrently.
+*/
+class BatchEngine
+{
+public:
+    // Before each frame, e.g. to set the joypads or reset from a movie
+    typedef std::function<void(Nes& nes, uint32_t frame)> InputCallback;
+
+    // After each frame, false stops the instance before its frame count
+    typedef std::function<bool(Nes& nes, uint32_t frame)> FrameCallback;
+
+
+    explicit BatchEngine(uint32_t threads = 0);     // 0 for one worker per hardware thread
+    ~BatchEngine();
+
+    // The instance should be loaded and reset, returns its index
+    size_t add(std::unique_ptr<Nes> nes, uint32_t frames, InputCallback input = nullptr, FrameCallback frame_done = nullptr);
+
+    // Runs every instance until it has run its frames or been stopped, instances added later run in the next call
+    void run();
+
+    size_t size() const { return _instances.size(); }
+    Nes& instance(size_t index);
+    uint32_t frames_run(size_t index) const;
+    uint32_t threads() const { return _threads; }
+
+private:
+    struct Instance;
+    struct Worker;
+
+
+    uint32_t _threads;
+    std::vector<std::unique_ptr<Instance>> _instances;
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::atomic<size_t> _running{ 0 };
+    std::atomic<size_t> _queued{ 0 };           // Instances in the queues, only changed with their queue locked
+    std::atomic<uint32_t> _idle_workers{ 0 };
+    std::mutex _idle_mutex;
+    std::condition_variable _idle;
+
+
+    bool take(size_t worker, size_t& instance);
+    void wake_idle(bool all);
+    void work(size_t worker);
+};
@@ -0,0 +1,166 @@
+#include "blip_buffer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+// The console's output stage has a 90Hz high-pass (the first of its filters), which also keeps the integrator centred on zero
+static constexpr double HighPassCutoff = 90.0;
+
+
+void BlipBuffer::set_rates(double clock_rate, uint32_t sample_rate)
+{
+    _base_factor = sample_rate / clock_rate;
+    _factor = _next_factor = adjusted_factor();
+    _high_pass = float(1.0 - std::exp(-2.0 * std::acos(-1.0) * HighPassCutoff / sample_rate));
+
+    if (!_taps)
+        build_kernels();
+
+    clear();
+}
+
+
+void BlipBuffer::set_rate_adjust(double ratio)
+{
+    _rate_adjust = ratio;
+    _next_factor = adjusted_factor();
+}
+
+
+uint64_t BlipBuffer::adjusted_factor() const
+{
+    // Round up so a frame's samples never end short of its last clock
+    return uint64_t(std::ceil(_base_factor * _rate_adjust * 4294967296.0));
+}
+
+
+void BlipBuffer::set_quality(Quality quality)
+{
+    _quality = quality;
+    build_kernels();
+    clear();
+}
+
+
+void BlipBuffer::clear()
+{
+    _offset = 0;
+    std::fill(_buffer.begin(), _buffer.end(), 0.0f);
+    _integrator = 0.0f;
+    _dc = 0.0f;
+}
+
+
+void BlipBuffer::build_kernels()
+{
+    /*
+        Each sample of the buffer holds the step's contribution between it and the previous sample, which for a band-limited step is
+        the low-pass filter's impulse response at the midpoint. Phase p is a step (p + 0.5) / Phases of a sample after the first tap's
+        sample, centred taps / 2 - 1 samples later. The cutoff is pulled further below Nyquist the shorter the kernel as its transition
+        band widens; each phase is normalized so steps keep their exact height.
+    */
+    _taps = _quality == Quality::Low ? 8 : (_quality == Quality::Medium ? 16 : 32);
+    _kernels.resize(size_t(Phases) * _taps);
+
+    const double pi = std::acos(-1.0);
+    const double cutoff = 0.5 - 2.0 / _taps;
+    const double width = _taps + 1.0;
+
+    for (int phase = 0; phase < Phases; ++phase)
+    {
+        float* kernel = &_kernels[size_t(phase) * _taps];
+        double fraction = (phase + 0.5) / Phases;
+        double sum = 0.0;
+
+        for (int tap = 0; tap < _taps; ++tap)
+        {
+            double x = tap + 0.5 - fraction - _taps / 2.0;
+            double y = 2.0 * cutoff * x;
+            double sinc = y == 0.0 ? 1.0 : std::sin(pi * y) / (pi * y);
+            double u = (x + width / 2.0) / width;
+            double window = 0.42 - 0.5 * std::cos(2.0 * pi * u) + 0.08 * std::cos(4.0 * pi * u);
+            kernel[tap] = float(sinc * window);
+            sum += kernel[tap];
+        }
+
+        for (int tap = 0; tap < _taps; ++tap)
+        {
+            kernel[tap] = float(kernel[tap] / sum);
+        }
+    }
+}
+
+
+void BlipBuffer::add_delta(uint32_t clock, float delta)
+{
+    uint64_t position = _offset + clock * _factor;
+    size_t index = size_t(position >> 32);
+    size_t phase = size_t(position >> (32 - PhaseBits)) & (Phases - 1);
+
+    if (index + _taps > _buffer.size())
+    {
+        _buffer.resize((index + _taps) * 2, 0.0f);
+    }
+
+    float* out = &_buffer[index];
+    const float* kernel = &_kernels[phase * _taps];
+    int tap = 0;
+
+#if defined(__AVX2__)
+    const __m256 scale = _mm256_set1_ps(delta);
+
+    for (; tap < _taps; tap += 8)
+    {
+        __m256 sum = _mm256_add_ps(_mm256_loadu_ps(out + tap), _mm256_mul_ps(_mm256_loadu_ps(kernel + tap), scale));
+        _mm256_storeu_ps(out + tap, sum);
+    }
+#endif
+
+    for (; tap < _taps; ++tap)
+    {
+        out[tap] += kernel[tap] * delta;
+    }
+}
+
+
+void BlipBuffer::end_frame(uint32_t clocks)
+{
+    _offset += clocks * _factor;
+    _factor = _next_factor;
+}
+
+
+void BlipBuffer::read_samples(std::vector<int16_t>& samples)
+{
+    size_t count = size_t(_offset >> 32);
+
+    if (!count)
+    {
+        return;
+    }
+
+    if (count + _taps > _buffer.size())
+    {
+        _buffer.resize(count + _taps, 0.0f);
+    }
+
+    samples.reserve(samples.size() + count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        _integrator += _buffer[i];
+        float out = _integrator - _dc;
+        _dc += out * _high_pass;
+        samples.push_back(int16_t(std::min(std::max(out, -1.0f), 1.0f) * 32767.0f));
+    }
+
+    // Steps near the end of the frame carry on into samples which haven't been completed yet
+    std::copy(_buffer.begin() + count, _buffer.end(), _buffer.begin());
+    std::fill(_buffer.end() - count, _buffer.end(), 0.0f);
+    _offset -= uint64_t(count) << 32;
+}
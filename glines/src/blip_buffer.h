@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/*
+    Band-limited step synthesis in the style of blargg's blip_buf. Rather than sampling a signal at its source clock and decimating,
+    the source reports each change in its level (a delta at a clock time) and the step is added to the output directly at the output
+    sample rate. The buffer holds the difference between adjacent samples, so a step is a band-limited impulse: a polyphase windowed
+    sinc FIR with one phase per 1/Phases of a sample, selected by where between two samples the step lands. Reading the samples
+    integrates the differences back into a signal. Work is proportional to the number of steps, not the source clock rate.
+
+    Output is delayed by just under half the kernel width (taps / 2 - 1 samples).
+*/
+class BlipBuffer
+{
+public:
+    // FIR taps per step, trading cost per step for how close to Nyquist the passband extends
+    enum class Quality : uint8_t
+    {
+        Low,        // 8 taps
+        Medium,     // 16 taps
+        High,       // 32 taps
+    };
+
+
+    BlipBuffer() = default;
+    ~BlipBuffer() = default;
+
+    // Clears the buffer
+    void set_rates(double clock_rate, uint32_t sample_rate);
+
+    // Scales the sample rate by ratio (e.g. for dynamic rate control), from the next frame so the current one stays consistent
+    void set_rate_adjust(double ratio);
+    void set_quality(Quality quality);
+    void clear();
+
+    // Clock times are relative to the start of the current frame
+    void add_delta(uint32_t clock, float delta);
+    void end_frame(uint32_t clocks);
+
+    // Appends every sample completed by the frames ended so far, signed with a DC blocking high-pass, and removes them from the buffer
+    void read_samples(std::vector<int16_t>& samples);
+
+private:
+    static constexpr int PhaseBits = 8;
+    static constexpr int Phases = 1 << PhaseBits;
+
+    Quality _quality = Quality::Medium;
+    int _taps = 0;
+    std::vector<float> _kernels;    // [phase][tap]
+
+    double _base_factor = 0.0;      // Output samples per clock at the unadjusted rate
+    double _rate_adjust = 1.0;
+    uint64_t _factor = 0;           // Output samples per clock, 32.32 fixed point
+    uint64_t _next_factor = 0;      // _factor from the next frame
+    uint64_t _offset = 0;           // Position of the start of the frame relative to the start of the buffer, 32.32 fixed point
+    std::vector<float> _buffer;     // Differences between adjacent samples
+
+    float _integrator = 0.0f;
+    float _dc = 0.0f;               // Tracks the integrator's DC level for the high-pass
+    float _high_pass = 0.0f;        // High-pass coefficient for the sample rate
+
+
+    uint64_t adjusted_factor() const;
+    void build_kernels();
+};
@@ -0,0 +1,42 @@
+#include "corpus.h"
+
+#include <fstream>
+#include <sstream>
+
+
+static std::string directory_of(const std::string& path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+
+bool read_corpus(const std::string& path, std::vector<CorpusEntry>& entries)
+{
+    std::ifstream ifs(path);
+
+    if (!ifs)
+        return false;
+
+    std::string base = directory_of(path);
+    std::string line;
+
+    while (std::getline(ifs, line))
+    {
+        std::istringstream fields(line);
+        CorpusEntry entry;
+
+        if (!(fields >> entry.name) || entry.name[0] == '#')
+            continue;
+
+        if (!(fields >> entry.movie >> entry.frames >> entry.golden))
+            return false;
+
+        entry.rom = base + entry.name;
+        entry.movie = entry.movie == "-" ? std::string() : base + entry.movie;
+        entry.golden = base + entry.golden;
+        entries.push_back(entry);
+    }
+
+    return true;
+}
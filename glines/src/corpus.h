@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+    ROM corpora for the headless tools (hashcheck's regression tests, glines-run's benchmarks). Corpus files list one ROM per line,
+    paths relative to the corpus file and '-' for no movie:
+
+        # rom                   movie               frames  golden
+        smb.nes                 smb.fm2             3000    smb.hashes
+
+    Movies are FCEUX .fm2 files (see movie.h), golden files are hashcheck's per frame hashes. Entries are returned with their paths
+    resolved (relative to the working directory), name is the ROM as the corpus file gives it.
+*/
+struct CorpusEntry
+{
+    std::string name;
+    std::string rom;
+    std::string movie;  // Empty for no movie
+    uint32_t frames = 0;
+    std::string golden;
+};
+
+
+bool read_corpus(const std::string& path, std::vector<CorpusEntry>& entries);
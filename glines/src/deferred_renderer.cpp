@@ -0,0 +1,410 @@
+#include "deferred_renderer.h"
+
+#include "gamepak.h"
+#include "gli2c02.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+static constexpr uint32_t DotsPerScanline = 341;
+static constexpr int16_t VisibleScanlines = 240;
+
+
+DeferredRenderer::DeferredRenderer(int threads)
+{
+    threads = std::max(threads, 1);
+
+    // One frame recording, one per worker rendering and one waiting to be presented
+    _frames.resize(threads + 2);
+
+    for (Frame& frame : _frames)
+    {
+        frame.ppu = std::make_unique<gli2C02>();
+    }
+
+    for (int i = 0; i < threads; ++i)
+    {
+        _workers.emplace_back(&DeferredRenderer::worker, this);
+    }
+}
+
+
+DeferredRenderer::~DeferredRenderer()
+{
+    detach();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+
+    _queued.notify_all();
+
+    for (std::thread& worker : _workers)
+    {
+        worker.join();
+    }
+}
+
+
+void DeferredRenderer::attach(gli2C02& ppu)
+{
+    detach();
+    _ppu = &ppu;
+    _ppu->_deferred_renderer = this;
+}
+
+
+void DeferredRenderer::detach()
+{
+    if (_ppu)
+    {
+        _ppu->_deferred_renderer = nullptr;
+        _ppu = nullptr;
+    }
+
+    discard_recording();
+}
+
+
+bool DeferredRenderer::present(uint32_t frame, gli2C02& ppu, std::bitset<240>& dirty_lines)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    Frame* match = nullptr;
+
+    for (Frame& f : _frames)
+    {
+        if (f.number == frame && f.state != FrameState::Free && f.state != FrameState::Recording)
+        {
+            if (!match || f.sequence > match->sequence)
+                match = &f;
+        }
+    }
+
+    if (!match)
+    {
+        return false;
+    }
+
+    _done.wait(lock, [match]() { return match->state == FrameState::Done; });
+
+    const gli2C02& rendered = *match->ppu;
+
+    if (rendered._render_target.pixels)
+    {
+        // Rendered straight into the caller's target, which also tracked the lines it changed
+        dirty_lines = rendered._dirty_lines;
+    }
+    else
+    {
+        present_screen(rendered, ppu, dirty_lines);
+    }
+
+    // Frames recorded before this one can't be presented any more
+    for (Frame& f : _frames)
+    {
+        if (f.state == FrameState::Done && f.sequence < match->sequence)
+            f.state = FrameState::Free;
+    }
+
+    match->state = FrameState::Free;
+    return true;
+}
+
+
+void DeferredRenderer::present_screen(const gli2C02& rendered, gli2C02& ppu, std::bitset<240>& dirty_lines)
+{
+    // The frame was rendered over an older screen than the one it replaces, so work out which lines changed as they're copied
+    for (size_t line = 0; line < 240; ++line)
+    {
+        size_t offset = line * 256;
+        bool dirty = memcmp(&ppu._screen[offset], &rendered._screen[offset], 256) != 0;
+
+        if (rendered._emphasis_output)
+            dirty = dirty || memcmp(&ppu._screen9[offset], &rendered._screen9[offset], 256 * sizeof(uint16_t)) != 0;
+
+        if (dirty)
+        {
+            memcpy(&ppu._screen[offset], &rendered._screen[offset], 256);
+
+            if (rendered._emphasis_output)
+                memcpy(&ppu._screen9[offset], &rendered._screen9[offset], 256 * sizeof(uint16_t));
+        }
+
+        dirty_lines[line] = dirty;
+    }
+}
+
+
+void DeferredRenderer::begin_frame(gli2C02& ppu)
+{
+    discard_recording();
+
+    Mapping mapping{};
+
+    if (!capture_mapping(ppu, mapping))
+    {
+        // The mapper can't describe its CHR banks, leave rendering to the PPU
+        detach();
+        return;
+    }
+
+    Frame* frame = nullptr;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _done.wait(lock, [this, &frame]()
+            {
+                // Take a free frame, otherwise drop the oldest one which hasn't been presented
+                for (Frame& f : _frames)
+                {
+                    if (f.state == FrameState::Free)
+                    {
+                        frame = &f;
+                        return true;
+                    }
+
+                    if (f.state == FrameState::Done && (!frame || f.sequence < frame->sequence))
+                        frame = &f;
+                }
+
+                return frame != nullptr;
+            });
+
+        frame->state = FrameState::Recording;
+    }
+
+    frame->number = ppu._frame;
+    frame->sequence = ++_sequence;
+    frame->events.clear();
+    frame->mappings.clear();
+    frame->mapping = mapping;
+
+    // CHR memory only needs copying again if it's been written to (or the game pak changed) since this frame last used it
+    const std::vector<uint8_t>* chr_source = ppu._game_pak ? &ppu._game_pak->chr_rom() : nullptr;
+
+    if (chr_source != _chr_source)
+    {
+        _chr_source = chr_source;
+        ++_chr_generation;
+    }
+
+    if (frame->chr_generation != _chr_generation)
+    {
+        frame->chr = chr_source ? *chr_source : std::vector<uint8_t>();
+        frame->chr_generation = _chr_generation;
+    }
+
+    // The copy renders the frame itself, pattern data comes from the snapshot of CHR memory
+    gli2C02& snapshot = *frame->ppu;
+    snapshot = ppu;
+    snapshot._game_pak = nullptr;
+    snapshot._deferred_renderer = nullptr;
+    snapshot._chr = frame->chr.empty() ? nullptr : frame->chr.data();
+    snapshot._chr_banks = mapping.chr_banks;
+
+    _recording = frame;
+}
+
+
+void DeferredRenderer::end_frame()
+{
+    if (!_recording)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _recording->state = FrameState::Queued;
+        _recording = nullptr;
+    }
+
+    _queued.notify_one();
+}
+
+
+void DeferredRenderer::record_write(const gli2C02& ppu, uint16_t address, uint8_t value)
+{
+    record(ppu, EventType::Write, address, value);
+}
+
+
+void DeferredRenderer::record_read(const gli2C02& ppu, uint16_t address)
+{
+    record(ppu, EventType::Read, address, 0);
+}
+
+
+void DeferredRenderer::record_chr_write(const gli2C02& ppu, uint16_t address, uint8_t value)
+{
+    // Every frame's snapshot of CHR memory is now out of date
+    ++_chr_generation;
+    record(ppu, EventType::ChrWrite, address, value);
+}
+
+
+void DeferredRenderer::invalidate_chr()
+{
+    ++_chr_generation;
+}
+
+
+void DeferredRenderer::record_mapping(const gli2C02& ppu)
+{
+    if (!_recording)
+    {
+        return;
+    }
+
+    Mapping mapping{};
+
+    if (!capture_mapping(ppu, mapping))
+    {
+        // Finish off this frame with the old mapping, begin_frame will give up on deferred rendering
+        return;
+    }
+
+    if (mapping == _recording->mapping)
+    {
+        return;
+    }
+
+    _recording->mapping = mapping;
+    _recording->mappings.push_back(mapping);
+    record(ppu, EventType::Mapping, uint16_t(_recording->mappings.size() - 1), 0);
+}
+
+
+void DeferredRenderer::record(const gli2C02& ppu, EventType type, uint16_t address, uint8_t value)
+{
+    if (!_recording || ppu._scanline < 0 || ppu._scanline >= VisibleScanlines)
+    {
+        return;
+    }
+
+    _recording->events.push_back({ uint32_t(ppu._scanline) * DotsPerScanline + ppu._cycle, type, value, address });
+}
+
+
+bool DeferredRenderer::capture_mapping(const gli2C02& ppu, Mapping& mapping)
+{
+    mapping.nametable_map = ppu._nametable_map;
+    mapping.chr_banks.fill(0);
+
+    if (!ppu._game_pak)
+    {
+        return true;
+    }
+
+    if (!ppu._game_pak->ppu_chr_banks(mapping.chr_banks))
+    {
+        return false;
+    }
+
+    // Keep out of range bank numbers inside the snapshot
+    size_t chr_size = ppu._game_pak->chr_rom().size();
+
+    for (uint32_t& bank : mapping.chr_banks)
+    {
+        bank = chr_size ? uint32_t(bank % chr_size) : 0;
+    }
+
+    return true;
+}
+
+
+void DeferredRenderer::discard_recording()
+{
+    if (_recording)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _recording->state = FrameState::Free;
+        _recording = nullptr;
+    }
+
+    _done.notify_all();
+}
+
+
+void DeferredRenderer::worker()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;)
+    {
+        Frame* frame = nullptr;
+
+        _queued.wait(lock, [this, &frame]()
+            {
+                for (Frame& f : _frames)
+                {
+                    if (f.state == FrameState::Queued && (!frame || f.sequence < frame->sequence))
+                        frame = &f;
+                }
+
+                return _quit || frame != nullptr;
+            });
+
+        if (_quit)
+        {
+            return;
+        }
+
+        frame->state = FrameState::Rendering;
+        lock.unlock();
+
+        render(*frame);
+
+        lock.lock();
+        frame->state = FrameState::Done;
+        _done.notify_all();
+    }
+}
+
+
+void DeferredRenderer::render(Frame& frame)
+{
+    gli2C02& ppu = *frame.ppu;
+    size_t next = 0;
+
+    while (ppu._scanline < VisibleScanlines)
+    {
+        uint32_t dot = uint32_t(ppu._scanline) * DotsPerScanline + ppu._cycle;
+
+        for (; next < frame.events.size() && frame.events[next].dot <= dot; ++next)
+        {
+            const Event& event = frame.events[next];
+
+            switch (event.type)
+            {
+                case EventType::Write:
+                {
+                    ppu.cpu_write(event.address, event.value);
+                    break;
+                }
+                case EventType::Read:
+                {
+                    ppu.cpu_read(event.address);
+                    break;
+                }
+                case EventType::ChrWrite:
+                {
+                    frame.chr[ppu._chr_banks[event.address >> 10] + (event.address & 0x3FF)] = event.value;
+                    break;
+                }
+                case EventType::Mapping:
+                {
+                    const Mapping& mapping = frame.mappings[event.address];
+                    ppu._chr_banks = mapping.chr_banks;
+                    ppu._nametable_map = mapping.nametable_map;
+                    break;
+                }
+            }
+        }
+
+        ppu.clock();
+    }
+}
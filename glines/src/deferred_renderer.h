@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class gli2C02;
+
+/*
+    Renders the pixels of a frame on worker threads while the PPU carries on emulating the next one.
+
+    While attached the PPU still does everything the rest of the system can observe (memory fetches and so the MMC3's A12 clocking,
+    the scroll registers, sprite evaluation, sprite zero hit and the status flags) but leaves pixel output to the renderer. Instead it
+    records every register access that affects rendering, writes to CHR RAM and changes to the CHR bank and nametable mappings, time
+    stamped with the scanline and dot they happened before. A worker replays the log against a copy of the PPU taken at the start of
+    the frame which reads pattern data from its own snapshot of CHR memory, producing output identical to rendering inline.
+
+    Only the visible scanlines are replayed, so a frame can be handed to the workers as soon as the PPU reaches scanline 240.
+
+    attach(), detach() and the calls from the PPU belong to the thread clocking it. present() can be called from one other thread (a
+    UI thread, say) while that one carries on: it only touches the frames under the lock, the screen it copies the frame to and the
+    dirty lines it hands back, never the PPU's emulation state. The PPU doesn't write its own screen while the renderer is attached,
+    but the renderer detaches itself from a mapper whose CHR banks it can't describe, so a caller on another thread should render to
+    its own targets (gli2C02::set_render_target) rather than the PPU's screen.
+*/
+class DeferredRenderer
+{
+public:
+    explicit DeferredRenderer(int threads = 1);
+    ~DeferredRenderer();
+
+    // Must be called from the thread clocking the PPU, rendering is deferred from the start of the next frame
+    void attach(gli2C02& ppu);
+    void detach();
+
+    // Waits for a frame to finish rendering and copies it to the PPU's output buffers, false if it wasn't recorded or was dropped. Frames
+    // rendered to an external target (gli2C02::set_render_target) are already in place. dirty_lines gets the lines the frame changed,
+    // the PPU's own _dirty_lines are left to the thread clocking it.
+    bool present(uint32_t frame, gli2C02& ppu, std::bitset<240>& dirty_lines);
+
+    // Called by the PPU
+    void begin_frame(gli2C02& ppu);
+    void end_frame();
+    void record_write(const gli2C02& ppu, uint16_t address, uint8_t value);
+    void record_read(const gli2C02& ppu, uint16_t address);
+    void record_chr_write(const gli2C02& ppu, uint16_t address, uint8_t value);
+    void record_mapping(const gli2C02& ppu);
+    void invalidate_chr();  // CHR memory changed other than through the PPU (e.g. a state was loaded)
+
+private:
+    enum class EventType : uint8_t
+    {
+        Write,      // CPU write to a PPU register
+        Read,       // CPU read of PPUSTATUS or PPUDATA
+        ChrWrite,   // Write to CHR RAM through PPUDATA
+        Mapping,    // CHR bank or nametable mapping changed, address is the index into Frame::mappings
+    };
+
+
+    struct Event
+    {
+        uint32_t dot;   // scanline * 341 + cycle
+        EventType type;
+        uint8_t value;
+        uint16_t address;
+    };
+
+
+    struct Mapping
+    {
+        std::array<uint32_t, 8> chr_banks;
+        std::array<uint8_t, 4> nametable_map;
+
+        bool operator==(const Mapping& other) const
+        {
+            return chr_banks == other.chr_banks && nametable_map == other.nametable_map;
+        }
+    };
+
+
+    enum class FrameState
+    {
+        Free,
+        Recording,
+        Queued,
+        Rendering,
+        Done,
+    };
+
+
+    struct Frame
+    {
+        FrameState state = FrameState::Free;
+        uint32_t number = 0;
+        uint64_t sequence = 0;          // Order frames were recorded in, frame numbers restart when the PPU is reset
+        std::unique_ptr<gli2C02> ppu;   // PPU state at the start of the frame, holds the output once rendered
+        std::vector<uint8_t> chr;
+        uint64_t chr_generation = ~0ull;
+        Mapping mapping{};              // Mapping as of the last recorded event
+        std::vector<Event> events;
+        std::vector<Mapping> mappings;
+    };
+
+
+    std::vector<Frame> _frames;
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _queued;
+    std::condition_variable _done;
+    bool _quit = false;
+
+    // Only accessed from the thread clocking the PPU
+    gli2C02* _ppu = nullptr;
+    Frame* _recording = nullptr;
+    uint64_t _sequence = 0;
+    const std::vector<uint8_t>* _chr_source = nullptr;
+    uint64_t _chr_generation = 0;
+
+
+    void record(const gli2C02& ppu, EventType type, uint16_t address, uint8_t value);
+    bool capture_mapping(const gli2C02& ppu, Mapping& mapping);
+    void discard_recording();
+    void present_screen(const gli2C02& rendered, gli2C02& ppu, std::bitset<240>& dirty_lines);
+    void worker();
+    void render(Frame& frame);
+};
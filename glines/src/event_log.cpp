@@ -0,0 +1,113 @@
+#include "event_log.h"
+
+#include "gli2a03.h"
+#include "gli2c02.h"
+
+#include <algorithm>
+#include <fstream>
+
+
+EventLog::EventLog(gli2A03& cpu, gli2C02& ppu, size_t capacity)
+    : _cpu{ cpu }
+    , _ppu{ ppu }
+{
+    size_t size = 1;
+
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    _events.resize(size);
+    _mask = size - 1;
+}
+
+
+void EventLog::record(EventType type, uint16_t address, uint8_t value)
+{
+    Event& event = _events[_count++ & _mask];
+    event.cpu_cycle = _cpu.cycle_count();
+    event.frame = _ppu.frame_number();
+    event.scanline = _ppu.scanline();
+    event.dot = _ppu.cycle();
+    event.address = address;
+    event.value = value;
+    event.type = type;
+}
+
+
+void EventLog::frame_events(uint32_t frame, std::vector<Event>& events) const
+{
+    events.clear();
+
+    uint64_t oldest = _count > _events.size() ? _count - _events.size() : 0;
+    uint64_t end = _count;
+
+    // Newest events first, skipping anything after the frame
+    while (end > oldest && _events[(end - 1) & _mask].frame != frame)
+    {
+        --end;
+    }
+
+    uint64_t begin = end;
+
+    while (begin > oldest && _events[(begin - 1) & _mask].frame == frame)
+    {
+        --begin;
+    }
+
+    if (begin == oldest && oldest != 0)
+    {
+        // The start of the frame has been overwritten
+        return;
+    }
+
+    for (uint64_t i = begin; i < end; ++i)
+    {
+        events.push_back(_events[i & _mask]);
+    }
+}
+
+
+static void put(std::vector<char>& buffer, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+    {
+        buffer.push_back(char(value >> (i * 8)));
+    }
+}
+
+
+bool EventLog::save(const std::string& path) const
+{
+    std::ofstream f(path, std::ios::binary);
+
+    if (!f)
+    {
+        return false;
+    }
+
+    uint64_t count = std::min<uint64_t>(_count, _events.size());
+    std::vector<char> buffer;
+    buffer.reserve(12 + size_t(count) * 24);
+
+    buffer.insert(buffer.end(), { 'G', 'L', 'E', 'V' });
+    put(buffer, 1, 4);
+    put(buffer, count, 4);
+
+    for (uint64_t i = _count - count; i < _count; ++i)
+    {
+        const Event& event = _events[i & _mask];
+        put(buffer, event.cpu_cycle, 8);
+        put(buffer, event.frame, 4);
+        put(buffer, uint16_t(event.scanline), 2);
+        put(buffer, event.dot, 2);
+        put(buffer, event.address, 2);
+        put(buffer, event.value, 1);
+        put(buffer, uint8_t(event.type), 1);
+        put(buffer, 0, 4);  // Padding to 24 bytes
+    }
+
+    f.write(buffer.data(), buffer.size());
+    return !!f;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class gli2A03;
+class gli2C02;
+
+/*
+    Ring buffer of the bus events which matter for raster effects and interrupt timing, each stamped with the CPU cycle and the PPU
+    frame, scanline and dot it happened on.
+
+    Components record into the log through a pointer which is null while logging is off, so the only cost when it isn't connected is
+    the test of that pointer. Once the buffer is full the oldest events are overwritten.
+*/
+class EventLog
+{
+public:
+    enum class EventType : uint8_t
+    {
+        PpuRegisterWrite,   // CPU write to $2000-$2007 (address is the register with mirrors removed)
+        OamDma,             // Write to $4014, value is the source page
+        MapperWrite,        // Mapper register loaded (MMC1 serial load completed or reset, MMC3 bank/mirroring/IRQ registers)
+        Irq,                // IRQ line asserted
+        IrqAcknowledge,     // CPU took the IRQ
+        Nmi,                // NMI asserted
+    };
+
+
+    struct Event
+    {
+        uint64_t cpu_cycle;
+        uint32_t frame;
+        int16_t scanline;
+        uint16_t dot;
+        uint16_t address;
+        uint8_t value;
+        EventType type;
+    };
+
+
+    // Capacity is rounded up to a power of two
+    EventLog(gli2A03& cpu, gli2C02& ppu, size_t capacity = 0x10000);
+    ~EventLog() = default;
+
+    void record(EventType type, uint16_t address = 0, uint8_t value = 0);
+    void clear() { _count = 0; }
+
+    // Events recorded during a frame, oldest first - empty if the frame has been overwritten or not recorded
+    void frame_events(uint32_t frame, std::vector<Event>& events) const;
+
+    /*
+        Binary export, all values little endian:
+            char[4]     "GLEV"
+            uint32_t    version (1)
+            uint32_t    event count
+            Event[]     oldest first, 24 bytes each: uint64_t cpu_cycle, uint32_t frame, int16_t scanline, uint16_t dot,
+                        uint16_t address, uint8_t value, uint8_t type, 4 bytes padding
+    */
+    bool save(const std::string& path) const;
+
+private:
+    gli2A03& _cpu;
+    gli2C02& _ppu;
+    std::vector<Event> _events;
+    size_t _mask;
+    uint64_t _count = 0;
+};
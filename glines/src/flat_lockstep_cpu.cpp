@@ -0,0 +1,586 @@
+#include "flat_lockstep_cpu.h"
+
+#include "bits.h"
+#include "gli2a03_instructions.h"
+
+#include <cstring>
+
+/*
+    Everything here is a loop over the lanes with inactive lanes blended back to their old values rather than branched around, so the
+    compiler can turn the loops into vector instructions. Instruction semantics (including the unofficial ones and the quirks) follow
+    gli2A03::exec().
+*/
+
+
+static uint8_t instruction_length(AddressingMode mode)
+{
+    switch (mode)
+    {
+        case Implied: return 1;
+        case Indirect:
+        case Absolute:
+        case Absolute_X:
+        case Absolute_Y: return 3;
+        default: return 2;
+    }
+}
+
+
+template <size_t Lanes>
+FlatLockstepCpu<Lanes>::FlatLockstepCpu()
+    : _memory(0x10000 * Lanes)
+{
+    reset();
+}
+
+
+template <size_t Lanes>
+void FlatLockstepCpu<Lanes>::reset()
+{
+    for (size_t l = 0; l < Lanes; ++l)
+    {
+        _pc[l] = word(peek(l, 0xFFFC), peek(l, 0xFFFD));
+        _p[l] = 0x34;
+        _a[l] = _x[l] = _y[l] = 0;
+        _s[l] = 0xFD;
+        _stopped[l] = 0;
+        _cycles[l] = 0;
+    }
+
+    _steps = 0;
+    _groups = 0;
+}
+
+
+template <size_t Lanes>
+void FlatLockstepCpu<Lanes>::load(uint16_t address, const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        memset(&_memory[((address + i) & 0xFFFF) * Lanes], data[i], Lanes);
+    }
+}
+
+
+template <size_t Lanes>
+void FlatLockstepCpu<Lanes>::step()
+{
+    Row pending;
+
+    for (size_t l = 0; l < Lanes; ++l)
+    {
+        pending[l] = ~_stopped[l];
+    }
+
+    ++_steps;
+
+    for (size_t leader = 0; leader < Lanes; ++leader)
+    {
+        if (!pending[leader])
+            continue;
+
+        // The lanes at the leader's PC with the same instruction bytes run with it
+        uint16_t pc = _pc[leader];
+        const uint8_t* code[3] = { &_memory[size_t(pc) * Lanes], &_memory[size_t(uint16_t(pc + 1)) * Lanes],
+            &_memory[size_t(uint16_t(pc + 2)) * Lanes] };
+        uint8_t opcode = code[0][leader];
+        uint8_t length = instruction_length(InstructionTable[opcode].addressing_mode);
+        Row mask;
+
+        for (size_t l = 0; l < Lanes; ++l)
+        {
+            bool same = _pc[l] == pc && code[0][l] == opcode && (length < 2 || code[1][l] == code[1][leader]) &&
+                (length < 3 || code[2][l] == code[2][leader]);
+            mask[l] = pending[l] & (same ? 0xFF : 0);
+            pending[l] &= ~mask[l];
+        }
+
+        ++_groups;
+        execute(opcode, pc, word(code[1][leader], code[2][leader]), mask);
+    }
+}
+
+
+template <size_t Lanes>
+typename FlatLockstepCpu<Lanes>::Row FlatLockstepCpu<Lanes>::read(const Addresses& address, bool uniform) const
+{
+    Row value;
+
+    if (uniform)
+    {
+        memcpy(value.data(), &_memory[size_t(address[0]) * Lanes], Lanes);
+    }
+    else
+    {
+        for (size_t l = 0; l < Lanes; ++l)
+        {
+            value[l] = _memory[size_t(address[l]) * Lanes + l];
+        }
+    }
+
+    return value;
+}
+
+
+template <size_t Lanes>
+void FlatLockstepCpu<Lanes>::write(const Addresses& address, bool uniform, const Row& value, const Row& mask)
+{
+    if (uniform)
+    {
+        uint8_t* row = &_memory[size_t(address[0]) * Lanes];
+
+        for (size_t l = 0; l < Lanes; ++l)
+        {
+            row[l] = (value[l] & mask[l]) | (row[l] & ~mask[l]);
+        }
+    }
+    else
+    {
+        for (size_t l = 0; l < Lanes; ++l)
+        {
+            mask[l] ? (void)(_memory[size_t(address[l]) * Lanes + l] = value[l]) : ((void)0);
+        }
+    }
+}
+
+
+template <size_t Lanes>
+typename FlatLockstepCpu<Lanes>::Row FlatLockstepCpu<Lanes>::pop(const Row& mask)
+{
+    Addresses address;
+
+    for (size_t l = 0; l < Lanes; ++l)
+    {
+        _s[l] += mask[l] & 1;
+        address[l] = 0x100 + _s[l];
+    }
+
+    return read(address, false);
+}
+
+
+template <size_t Lanes>
+void FlatLockstepCpu<Lanes>::push(const Row& value, const Row& mask)
+{
+    Addresses address;
+
+    for (size_t l = 0; l < Lanes; ++l)
+    {
+        address[l] = 0x100 + _s[l];
+        _s[l] -= mask[l] & 1;
+    }
+
+    write(address, false, value, mask);
+}
+
+
+template <size_t Lanes>
+void FlatLockstepCpu<Lanes>::execute(uint8_t opcode, uint16_t pc, uint16_t operand, const Row& mask)
+{
+    const Instruction& instruction = InstructionTable[opcode];
+    AddressingMode mode = instruction.addressing_mode;
+    bool page_crossing_penalty = !!get_bit(instruction.cycles & mode, 7);
+    uint16_t next = uint16_t(pc + instruction_length(mode));
+
+    auto each = [](auto f)
+    {
+        for (size_t l = 0; l < Lanes; ++l)
+        {
+            f(l);
+        }
+    };
+
+    // Effective address: the same for every lane unless it's indexed or indirect
+    Addresses address{};
+    Row extra_cycles{};
+    bool uniform = true;
+
+    switch (mode)
+    {
+        case Implied:
+        case Immediate:
+        {
+            address.fill(uint16_t(pc + 1));
+            break;
+        }
+        case ZeroPage:
+        {
+            address.fill(lo(operand));
+            break;
+        }
+        case Relative:
+        {
+            address.fill(uint16_t(next + int8_t(lo(operand))));
+            break;
+        }
+        case Absolute:
+        {
+            address.fill(operand);
+            break;
+        }
+        case ZeroPage_X:
+        case ZeroPage_Y:
+        {
+            const Row& index = mode == ZeroPage_X ? _x : _y;
+            each([&](size_t l) { address[l] = lo(operand + index[l]); });
+            uniform = false;
+            break;
+        }
+        case Absolute_X:
+        case Absolute_Y:
+        {
+            const Row& index = mode == Absolute_X ? _x : _y;
+            each([&](size_t l) {
+                address[l] = uint16_t(operand + index[l]);
+                extra_cycles[l] = page_crossing_penalty && hi(address[l]) != hi(operand);
+            });
+            uniform = false;
+            break;
+        }
+        case Indirect:
+        {
+            Addresses pointer_lo;
+            Addresses pointer_hi;
+            pointer_lo.fill(operand);
+            pointer_hi.fill(word(lo(operand + 1), hi(operand)));
+            Row address_lo = read(pointer_lo, true);
+            Row address_hi = read(pointer_hi, true);
+            each([&](size_t l) { address[l] = word(address_lo[l], address_hi[l]); });
+            uniform = false;
+            break;
+        }
+        case Indirect_X:
+        case Indirect_Y:
+        {
+            Addresses pointer_lo;
+            Addresses pointer_hi;
+            bool indexed_pointer = mode == Indirect_X;
+            each([&](size_t l) {
+                pointer_lo[l] = lo(operand + (indexed_pointer ? _x[l] : 0));
+                pointer_hi[l] = lo(pointer_lo[l] + 1);
+            });
+            Row address_lo = read(pointer_lo, !indexed_pointer);
+            Row address_hi = read(pointer_hi, !indexed_pointer);
+            each([&](size_t l) {
+                uint16_t base = word(address_lo[l], address_hi[l]);
+                address[l] = indexed_pointer ? base : uint16_t(base + _y[l]);
+                extra_cycles[l] = !indexed_pointer && page_crossing_penalty && hi(address[l]) != address_hi[l];
+            });
+            uniform = false;
+            break;
+        }
+    }
+
+    Addresses new_pc;
+    new_pc.fill(next);
+
+    auto blend = [&](Row& reg, const Row& value) { each([&](size_t l) { reg[l] = (value[l] & mask[l]) | (reg[l] & ~mask[l]); }); };
+
+    auto set_flag = [&](uint8_t bit, const Row& set) {
+        each([&](size_t l) { _p[l] = mask[l] ? uint8_t((_p[l] & ~(1 << bit)) | ((set[l] & 1) << bit)) : _p[l]; });
+    };
+
+    auto set_nz = [&](const Row& value) {
+        each([&](size_t l) { _p[l] = mask[l] ? uint8_t((_p[l] & 0x7D) | (value[l] & 0x80) | (value[l] ? 0 : 0x02)) : _p[l]; });
+    };
+
+    auto load_register = [&](Row& reg, const Row& value) {
+        blend(reg, value);
+        set_nz(value);
+    };
+
+    auto map = [&](auto f) {
+        Row result;
+        each([&](size_t l) { result[l] = uint8_t(f(l)); });
+        return result;
+    };
+
+    auto adc = [&](const Row& value) {
+        Row carry = map([&](size_t l) {
+            uint16_t sum = _a[l] + value[l] + (_p[l] & 1);
+            return sum >> 8;
+        });
+        Row overflow = map([&](size_t l) {
+            uint16_t sum = _a[l] + value[l] + (_p[l] & 1);
+            return ((_a[l] ^ sum) & (value[l] ^ sum)) >> 7;
+        });
+        Row sum = map([&](size_t l) { return _a[l] + value[l] + (_p[l] & 1); });
+        set_flag(StatusBits::Carry, carry);
+        set_flag(StatusBits::Overflow, overflow);
+        load_register(_a, sum);
+    };
+
+    auto compare = [&](const Row& reg, const Row& value) {
+        set_flag(StatusBits::Carry, map([&](size_t l) { return reg[l] >= value[l]; }));
+        set_flag(StatusBits::Zero, map([&](size_t l) { return reg[l] == value[l]; }));
+        set_flag(StatusBits::Negative, map([&](size_t l) { return (reg[l] - value[l]) >> 7; }));
+    };
+
+    auto branch = [&](uint8_t bit, int taken_when) {
+        each([&](size_t l) {
+            bool taken = get_bit(_p[l], bit) == taken_when;
+            new_pc[l] = taken ? address[l] : next;
+            extra_cycles[l] = taken ? ((hi(address[l]) == hi(next)) ? 1 : 2) : 0;
+        });
+    };
+
+    // Shifts and rotates of A or memory, setting C, Z and N, returning the result
+    auto shift = [&](auto f, auto carry_out) {
+        Row value = mode == Implied ? _a : read(address, uniform);
+        Row result = map([&](size_t l) { return f(value[l], _p[l] & 1); });
+        set_flag(StatusBits::Carry, map([&](size_t l) { return carry_out(value[l]); }));
+        set_nz(result);
+        mode == Implied ? blend(_a, result) : write(address, uniform, result, mask);
+        return result;
+    };
+
+    auto asl = [](uint8_t v, int) { return v << 1; };
+    auto lsr = [](uint8_t v, int) { return v >> 1; };
+    auto rol = [](uint8_t v, int c) { return (v << 1) | c; };
+    auto ror = [](uint8_t v, int c) { return (v >> 1) | (c << 7); };
+    auto bit7 = [](uint8_t v) { return v >> 7; };
+    auto bit0 = [](uint8_t v) { return v & 1; };
+
+    switch (instruction.opcode)
+    {
+        case Opcode::ADC: adc(read(address, uniform)); break;
+        case Opcode::SBC:
+        {
+            Row value = read(address, uniform);
+            adc(map([&](size_t l) { return value[l] ^ 0xFF; }));
+            break;
+        }
+        case Opcode::AND:
+        {
+            Row value = read(address, uniform);
+            load_register(_a, map([&](size_t l) { return _a[l] & value[l]; }));
+            break;
+        }
+        case Opcode::ORA:
+        {
+            Row value = read(address, uniform);
+            load_register(_a, map([&](size_t l) { return _a[l] | value[l]; }));
+            break;
+        }
+        case Opcode::EOR:
+        {
+            Row value = read(address, uniform);
+            load_register(_a, map([&](size_t l) { return _a[l] ^ value[l]; }));
+            break;
+        }
+        case Opcode::ASL: shift(asl, bit7); break;
+        case Opcode::LSR: shift(lsr, bit0); break;
+        case Opcode::ROL: shift(rol, bit7); break;
+        case Opcode::ROR: shift(ror, bit0); break;
+        case Opcode::BCC: branch(StatusBits::Carry, 0); break;
+        case Opcode::BCS: branch(StatusBits::Carry, 1); break;
+        case Opcode::BNE: branch(StatusBits::Zero, 0); break;
+        case Opcode::BEQ: branch(StatusBits::Zero, 1); break;
+        case Opcode::BPL: branch(StatusBits::Negative, 0); break;
+        case Opcode::BMI: branch(StatusBits::Negative, 1); break;
+        case Opcode::BVC: branch(StatusBits::Overflow, 0); break;
+        case Opcode::BVS: branch(StatusBits::Overflow, 1); break;
+        case Opcode::BIT:
+        {
+            Row value = read(address, uniform);
+            set_flag(StatusBits::Zero, map([&](size_t l) { return (_a[l] & value[l]) == 0; }));
+            set_flag(StatusBits::Overflow, map([&](size_t l) { return value[l] >> 6; }));
+            set_flag(StatusBits::Negative, map([&](size_t l) { return value[l] >> 7; }));
+            break;
+        }
+        case Opcode::BRK:
+        {
+            // Without an interrupt to service BRK stops the CPU, as it does in gli2A03
+            uint16_t ret = uint16_t(pc + 2);
+            Row ret_hi;
+            Row ret_lo;
+            ret_hi.fill(hi(ret));
+            ret_lo.fill(lo(ret));
+            push(ret_hi, mask);
+            push(ret_lo, mask);
+            push(_p, mask);
+            set_flag(StatusBits::InterruptDisable, map([](size_t) { return 1; }));
+            Addresses vector_lo;
+            Addresses vector_hi;
+            vector_lo.fill(0xFFFE);
+            vector_hi.fill(0xFFFF);
+            Row target_lo = read(vector_lo, true);
+            Row target_hi = read(vector_hi, true);
+            each([&](size_t l) { new_pc[l] = word(target_lo[l], target_hi[l]); });
+            each([&](size_t l) { _stopped[l] |= mask[l]; });
+            break;
+        }
+        case Opcode::STP:
+        {
+            // Jams the lane, as it does gli2A03
+            each([&](size_t l) { _stopped[l] |= mask[l]; });
+            break;
+        }
+        case Opcode::CLC: set_flag(StatusBits::Carry, map([](size_t) { return 0; })); break;
+        case Opcode::CLD: set_flag(StatusBits::Decimal, map([](size_t) { return 0; })); break;
+        case Opcode::CLI: set_flag(StatusBits::InterruptDisable, map([](size_t) { return 0; })); break;
+        case Opcode::CLV: set_flag(StatusBits::Overflow, map([](size_t) { return 0; })); break;
+        case Opcode::SEC: set_flag(StatusBits::Carry, map([](size_t) { return 1; })); break;
+        case Opcode::SED: set_flag(StatusBits::Decimal, map([](size_t) { return 1; })); break;
+        case Opcode::SEI: set_flag(StatusBits::InterruptDisable, map([](size_t) { return 1; })); break;
+        case Opcode::CMP: compare(_a, read(address, uniform)); break;
+        case Opcode::CPX: compare(_x, read(address, uniform)); break;
+        case Opcode::CPY: compare(_y, read(address, uniform)); break;
+        case Opcode::DEC:
+        case Opcode::INC:
+        {
+            Row value = read(address, uniform);
+            int delta = instruction.opcode == Opcode::INC ? 1 : -1;
+            Row result = map([&](size_t l) { return value[l] + delta; });
+            set_nz(result);
+            write(address, uniform, result, mask);
+            break;
+        }
+        case Opcode::DEX: load_register(_x, map([&](size_t l) { return _x[l] - 1; })); break;
+        case Opcode::DEY: load_register(_y, map([&](size_t l) { return _y[l] - 1; })); break;
+        case Opcode::INX: load_register(_x, map([&](size_t l) { return _x[l] + 1; })); break;
+        case Opcode::INY: load_register(_y, map([&](size_t l) { return _y[l] + 1; })); break;
+        case Opcode::JMP: new_pc = address; break;
+        case Opcode::JSR:
+        {
+            uint16_t ret = uint16_t(next - 1);
+            Row ret_hi;
+            Row ret_lo;
+            ret_hi.fill(hi(ret));
+            ret_lo.fill(lo(ret));
+            push(ret_hi, mask);
+            push(ret_lo, mask);
+            new_pc = address;
+            break;
+        }
+        case Opcode::LDA: load_register(_a, read(address, uniform)); break;
+        case Opcode::LDX: load_register(_x, read(address, uniform)); break;
+        case Opcode::LDY: load_register(_y, read(address, uniform)); break;
+        case Opcode::LAX:
+        {
+            Row value = read(address, uniform);
+            load_register(_a, value);
+            load_register(_x, value);
+            break;
+        }
+        case Opcode::PHA: push(_a, mask); break;
+        case Opcode::PHP: push(map([&](size_t l) { return _p[l] | 0x30; }), mask); break;
+        case Opcode::PLA: load_register(_a, pop(mask)); break;
+        case Opcode::PLP:
+        {
+            Row value = pop(mask);
+            blend(_p, map([&](size_t l) { return value[l] & 0xCF; }));
+            break;
+        }
+        case Opcode::RTI:
+        case Opcode::RTS:
+        {
+            if (instruction.opcode == Opcode::RTI)
+            {
+                Row value = pop(mask);
+                blend(_p, map([&](size_t l) { return value[l] & 0xCF; }));
+            }
+
+            Row ret_lo = pop(mask);
+            Row ret_hi = pop(mask);
+            int offset = instruction.opcode == Opcode::RTS ? 1 : 0;
+            each([&](size_t l) { new_pc[l] = uint16_t(word(ret_lo[l], ret_hi[l]) + offset); });
+            break;
+        }
+        case Opcode::STA: write(address, uniform, _a, mask); break;
+        case Opcode::STX: write(address, uniform, _x, mask); break;
+        case Opcode::STY: write(address, uniform, _y, mask); break;
+        case Opcode::SAX: write(address, uniform, map([&](size_t l) { return _a[l] & _x[l]; }), mask); break;
+        case Opcode::TAX: load_register(_x, _a); break;
+        case Opcode::TAY: load_register(_y, _a); break;
+        case Opcode::TSX: load_register(_x, _s); break;
+        case Opcode::TXA: load_register(_a, _x); break;
+        case Opcode::TYA: load_register(_a, _y); break;
+        case Opcode::TXS: blend(_s, _x); break;
+        // Unofficial opcodes
+        case Opcode::ALR:
+        {
+            Row value = read(address, uniform);
+            Row result = map([&](size_t l) { return _a[l] & value[l]; });
+            set_flag(StatusBits::Carry, result);
+            load_register(_a, map([&](size_t l) { return result[l] >> 1; }));
+            break;
+        }
+        case Opcode::ANC:
+        {
+            Row value = read(address, uniform);
+            Row result = map([&](size_t l) { return _a[l] & value[l]; });
+            load_register(_a, result);
+            set_flag(StatusBits::Carry, map([&](size_t l) { return result[l] >> 7; }));
+            break;
+        }
+        case Opcode::ARR:
+        {
+            Row value = read(address, uniform);
+            Row result = map([&](size_t l) { return ((_a[l] & value[l]) >> 1) | ((_p[l] & 1) << 7); });
+            load_register(_a, result);
+            set_flag(StatusBits::Carry, map([&](size_t l) { return result[l] >> 6; }));
+            set_flag(StatusBits::Overflow, map([&](size_t l) { return (result[l] >> 6) ^ (result[l] >> 5); }));
+            break;
+        }
+        case Opcode::AXS:
+        {
+            Row value = read(address, uniform);
+            set_flag(StatusBits::Carry, map([&](size_t l) { return (_a[l] & _x[l]) >= value[l]; }));
+            load_register(_x, map([&](size_t l) { return (_a[l] & _x[l]) - value[l]; }));
+            break;
+        }
+        case Opcode::DCP:
+        {
+            Row value = read(address, uniform);
+            Row result = map([&](size_t l) { return value[l] - 1; });
+            write(address, uniform, result, mask);
+            compare(_a, result);
+            break;
+        }
+        case Opcode::ISC:
+        {
+            Row value = read(address, uniform);
+            Row result = map([&](size_t l) { return value[l] + 1; });
+            write(address, uniform, result, mask);
+            adc(map([&](size_t l) { return result[l] ^ 0xFF; }));
+            break;
+        }
+        case Opcode::RLA:
+        {
+            Row result = shift(rol, bit7);
+            load_register(_a, map([&](size_t l) { return _a[l] & result[l]; }));
+            break;
+        }
+        case Opcode::RRA: adc(shift(ror, bit0)); break;
+        case Opcode::SLO:
+        {
+            Row result = shift(asl, bit7);
+            load_register(_a, map([&](size_t l) { return _a[l] | result[l]; }));
+            break;
+        }
+        case Opcode::SRE:
+        {
+            Row result = shift(lsr, bit0);
+            load_register(_a, map([&](size_t l) { return _a[l] ^ result[l]; }));
+            break;
+        }
+        default:
+        {
+            // Unimplemented unofficial instructions are NOPs, as they are in gli2A03
+            break;
+        }
+    }
+
+    uint8_t cycles = uint8_t(instruction.cycles & 0x7F);
+
+    each([&](size_t l) {
+        _pc[l] = mask[l] ? new_pc[l] : _pc[l];
+        _cycles[l] += mask[l] ? cycles + extra_cycles[l] : 0;
+    });
+}
+
+
+template class FlatLockstepCpu<1>;
+template class FlatLockstepCpu<8>;
+template class FlatLockstepCpu<16>;
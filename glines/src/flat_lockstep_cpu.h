@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+    Pure CPU experiment, not an emulator: a structure of arrays 6502 core with a number of lanes, each a CPU on its own flat 64KB of
+    memory, all running the same program. Registers are arrays indexed by lane, and memory is interleaved so the
+    same address in every lane is one contiguous row, which makes a load or store through an address all the lanes share a single
+    vector access.
+
+    Each step runs one instruction on every lane. Lanes at the same PC with the same instruction bytes are decoded once and execute it
+    together, lanes which aren't in the group are masked off; lanes that have diverged run as further groups in the same step and join
+    up again when their PCs meet. groups() / steps() measures how well the lanes stay in lockstep (1 is perfect).
+
+    Only the CPU and flat memory are in lanes: there's no bus to the PPU, APU or a mapper, and no interrupts, so no ROM can run on it.
+    It measures what lanes buy the CPU alone. Instructions match gli2A03's and so do their cycle counts, but the lanes are stepped
+    an instruction at a time rather than clocked. One lane is the scalar baseline on the same memory and stepping.
+*/
+template <size_t Lanes>
+class FlatLockstepCpu
+{
+public:
+    typedef std::array<uint8_t, Lanes> Row;
+
+    FlatLockstepCpu();
+
+    void reset();   // Power on state, PCs from each lane's reset vector
+    void step();
+
+    // Writes the same data to every lane, e.g. to load a program
+    void load(uint16_t address, const uint8_t* data, size_t size);
+
+    uint8_t peek(size_t lane, uint16_t address) const { return _memory[size_t(address) * Lanes + lane]; }
+    void poke(size_t lane, uint16_t address, uint8_t value) { _memory[size_t(address) * Lanes + lane] = value; }
+
+    uint64_t steps() const { return _steps; }
+    uint64_t groups() const { return _groups; }
+
+    std::array<uint16_t, Lanes> _pc;
+    Row _p;
+    Row _a;
+    Row _x;
+    Row _y;
+    Row _s;
+    Row _stopped;                       // 0xFF once the lane has executed BRK (there are no interrupts to return from) or STP
+    std::array<uint64_t, Lanes> _cycles;    // Cycles taken by the lane's instructions since reset
+
+private:
+    typedef std::array<uint16_t, Lanes> Addresses;
+
+    std::vector<uint8_t> _memory;       // 64KB per lane, byte N of every lane together
+    uint64_t _steps = 0;
+    uint64_t _groups = 0;
+
+
+    void execute(uint8_t opcode, uint16_t pc, uint16_t operand, const Row& mask);
+
+    Row read(const Addresses& address, bool uniform) const;
+    void write(const Addresses& address, bool uniform, const Row& value, const Row& mask);
+    Row pop(const Row& mask);
+    void push(const Row& value, const Row& mask);
+};
+
+
+extern template class FlatLockstepCpu<1>;
+extern template class FlatLockstepCpu<8>;
+extern template class FlatLockstepCpu<16>;
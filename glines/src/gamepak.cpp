@@ -1,6 +1,7 @@
 #include "gamepak.h"
 
 #include "bits.h"
+#include "gli2c02.h"
 #include "mapper.h"
 #include "mapper_000.h"
 #include "mapper_001.h"
@@ -8,6 +9,7 @@
 #include "mapper_003.h"
 #include "mapper_004.h"
 
+#include <algorithm>
 #include <fstream>
 
 
@@ -45,9 +47,15 @@ bool GamePak::load(const std::string& path)
         return false;
     }
 
-    ifs.read(_header_mem.data(), 16);
+    return load(ifs);
+}
 
-    if (!ifs)
+
+bool GamePak::load(std::istream& is)
+{
+    is.read(_header_mem.data(), 16);
+
+    if (!is)
     {
         return false;
     }
@@ -59,70 +67,104 @@ bool GamePak::load(const std::string& path)
         return false;
     }
 
+    INesHeader* header = (INesHeader*)_header_mem.data();
+    const uint8_t* bytes = (const uint8_t*)_header_mem.data();
+    uint16_t mapper_num = (header->mapper_hi << 4) | header->mapper_lo;
+    size_t chr_ram_size = DefaultChrRamSize;
+
     if ((_header_mem[7] & 0x0C) == 0x08)
     {
         // NES2.0
+        // Byte 8 - Mapper bits 8-11 (and the submapper, which none of the mappers here have)
+        mapper_num |= (bytes[8] & 0x0F) << 8;
+
+        // Byte 9 - PRG/CHR ROM size MSBs, the mappers take their bank counts from bytes 4 and 5 so only images that fit those load
+        if (bytes[9] != 0)
+            return false;
+
+        // Byte 11 - CHR RAM (bits 0-3) and battery backed CHR RAM (bits 4-7) sizes, 64 << shift bytes (0 = none)
+        uint8_t chr_ram_shift = bytes[11] & 0x0F;
+        uint8_t chr_nvram_shift = bytes[11] >> 4;
+        chr_ram_size = (chr_ram_shift ? (size_t(64) << chr_ram_shift) : 0) + (chr_nvram_shift ? (size_t(64) << chr_nvram_shift) : 0);
+
+        // Boards with both CHR ROM and RAM, or more CHR RAM than a state holds, have no mapper here. Less than the 8KB the pattern
+        // tables span is rounded up, the mappers index all of it.
+        if ((header->chr_rom_size && chr_ram_size) || chr_ram_size > MaxChrRamSize)
+            return false;
+
+        chr_ram_size = chr_ram_size ? std::max<size_t>(chr_ram_size, DefaultChrRamSize) : 0;
+
+        // Byte 12 - CPU/PPU timing: 0 = NTSC, 1 = PAL, 2 = multiple region, 3 = Dendy
+        static const Region regions[4] = { Region::Ntsc, Region::Pal, Region::Ntsc, Region::Dendy };
+        _region = regions[bytes[12] & 3];
     }
     else
     {
         // iNES
-        INesHeader* header = (INesHeader*)_header_mem.data();
+        // Flags 9 is the official TV system bit, flags 10 is an unofficial extension (0 = NTSC, 2 = PAL, 1/3 = dual compatible)
+        _region = (header->pal || header->tv_system == 2) ? Region::Pal : Region::Ntsc;
+    }
 
-        // Skip 512 byte trainer
-        if (header->trainer)
-            ifs.seekg(512, std::ios_base::cur);
+    // Skip 512 byte trainer
+    if (header->trainer)
+        is.seekg(512, std::ios_base::cur);
 
-        if (!ifs)
-            return false;
+    if (!is)
+        return false;
 
-        // Read PRG ROM
-        _prg_rom.resize(header->prg_rom_size * size_t(0x4000));
-        ifs.read((char*)(_prg_rom.data()), _prg_rom.size());
+    // Read PRG ROM
+    _prg_rom.resize(header->prg_rom_size * size_t(0x4000));
+    is.read((char*)(_prg_rom.data()), _prg_rom.size());
 
-        // Read CHR ROM
-        if (header->chr_rom_size == 0)
-        {
-            // FIXME: Must have CHR RAM?
-            header->chr_rom_size = 0x10;
-        }
+    // Read CHR ROM, boards without any have CHR RAM in its place (8KB unless a NES 2.0 header says otherwise, in 8KB banks as far
+    // as the mappers are concerned)
+    _chr_ram_size = header->chr_rom_size ? 0 : chr_ram_size;
 
+    if (_chr_ram_size)
+    {
+        header->chr_rom_size = uint8_t(_chr_ram_size / 0x2000);
+        _chr_rom.assign(_chr_ram_size, 0);
+    }
+    else
+    {
         _chr_rom.resize(header->chr_rom_size * size_t(0x2000));
-        ifs.read((char*)(_chr_rom.data()), _chr_rom.size());
+        is.read((char*)(_chr_rom.data()), _chr_rom.size());
+    }
 
-        // Setup mapper
-        uint8_t mapper_num = (header->mapper_hi << 4) | header->mapper_lo;
+    if (!is || _prg_rom.empty() || _chr_rom.empty())
+        return false;
 
-        switch (mapper_num)
+    // Setup mapper
+    switch (mapper_num)
+    {
+        case 0:
         {
-            case 0:
-            {
-                _mapper = std::make_shared<Mapper_000>(*this);
-                break;
-            }
-            case 1:
-            {
-                _mapper = std::make_shared<Mapper_001>(*this);
-                break;
-            }
-            case 2:
-            {
-                _mapper = std::make_shared<Mapper_002>(*this);
-                break;
-            }
-            case 3:
-            {
-                _mapper = std::make_shared<Mapper_003>(*this);
-                break;
-            }
-            case 4:
-            {
-                _mapper = std::make_shared<Mapper_004>(*this);
-                break;
-            }
-            default:
-            {
-                return false;
-            }
+            _mapper = std::make_shared<Mapper_000>(*this);
+            break;
+        }
+        case 1:
+        {
+            _mapper = std::make_shared<Mapper_001>(*this);
+            break;
+        }
+        case 2:
+        {
+            _mapper = std::make_shared<Mapper_002>(*this);
+            break;
+        }
+        case 3:
+        {
+            _mapper = std::make_shared<Mapper_003>(*this);
+            break;
+        }
+        case 4:
+        {
+            _mapper = std::make_shared<Mapper_004>(*this);
+            break;
+        }
+        default:
+        {
+            return false;
         }
     }
 
@@ -140,6 +182,7 @@ void GamePak::connect(gli2A03* cpu, gli2C02* ppu)
 void GamePak::reset(bool coldstart)
 {
     _mapper ? _mapper->reset(coldstart) : ((void)0);
+    _ppu ? _ppu->notify_mapper_write() : ((void)0);
 }
 
 
@@ -152,6 +195,8 @@ uint8_t GamePak::cpu_read(uint16_t address)
 void GamePak::cpu_write(uint16_t address, uint8_t value)
 {
     _mapper ? _mapper->cpu_write(address, value) : ((void)0);
+
+    _ppu ? _ppu->notify_mapper_write() : ((void)0);
 }
 
 
@@ -167,6 +212,42 @@ bool GamePak::ppu_write(uint16_t address, uint8_t value)
 }
 
 
+bool GamePak::ppu_peek(uint16_t address, uint8_t& value)
+{
+    return _mapper ? _mapper->ppu_peek(address, value) : false;
+}
+
+
+bool GamePak::ppu_chr_banks(std::array<uint32_t, 8>& banks)
+{
+    return _mapper ? _mapper->ppu_chr_banks(banks) : false;
+}
+
+
+bool GamePak::ppu_clocked_irq() const
+{
+    return _mapper ? _mapper->ppu_clocked_irq() : false;
+}
+
+
+void GamePak::save_state(Mapper::State& state) const
+{
+    _mapper ? _mapper->save_state(state) : ((void)0);
+}
+
+
+void GamePak::load_state(const Mapper::State& state)
+{
+    _mapper ? _mapper->load_state(state) : ((void)0);
+}
+
+
+uint8_t* GamePak::prg_ram()
+{
+    return _mapper ? _mapper->prg_ram() : nullptr;
+}
+
+
 uint16_t GamePak::ppu_remap_address(uint16_t address)
 {
     if (!_mapper || !_mapper->ppu_remap_address(address))
@@ -1,21 +1,31 @@
 #pragma once
 
 #include <array>
+#include <istream>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "mapper.h"
+#include "region.h"
+
+class EventLog;
 class gli2A03;
 class gli2C02;
 
 class GamePak
 {
 public:
+    static constexpr size_t DefaultChrRamSize = 0x2000;    // What every board with CHR RAM and an iNES header has
+    static constexpr size_t MaxChrRamSize = 0x8000;        // The most a NES 2.0 header can ask for that a state holds
+
     GamePak() = default;
     ~GamePak() = default;
 
     bool load(const std::string& path);
+    bool load(std::istream& is);   // An iNES image, e.g. one built in memory
     void connect(gli2A03* cpu, gli2C02* ppu);
+    void connect_event_log(EventLog* event_log) { _event_log = event_log; }
     void reset(bool coldstart);
 
     uint8_t cpu_read(uint16_t address);
@@ -23,7 +33,23 @@ public:
 
     bool ppu_read(uint16_t address, uint8_t& value);
     bool ppu_write(uint16_t address, uint8_t value);
+    bool ppu_peek(uint16_t address, uint8_t& value);
     uint16_t ppu_remap_address(uint16_t address);
+    bool ppu_chr_banks(std::array<uint32_t, 8>& banks);
+    bool ppu_clocked_irq() const;
+
+    const std::vector<uint8_t>& chr_rom() const { return _chr_rom; }
+    Region region() const { return _region; }
+
+    /*
+        What changes on the board as it runs (see Nes::State), the ROM doesn't: the mapper's registers and the RAM, Mapper::PrgRamSize
+        bytes of PRG RAM and chr_ram_size() bytes of CHR RAM (held in chr_rom()), nullptr where the board has none.
+    */
+    void save_state(Mapper::State& state) const;
+    void load_state(const Mapper::State& state);
+    uint8_t* prg_ram();
+    uint8_t* chr_ram() { return _chr_ram_size ? _chr_rom.data() : nullptr; }
+    size_t chr_ram_size() const { return _chr_ram_size; }
 
 protected:
     friend class Mapper;
@@ -31,7 +57,10 @@ protected:
     std::array<char, 16> _header_mem{};
     std::vector<uint8_t> _prg_rom;
     std::vector<uint8_t> _chr_rom;
+    size_t _chr_ram_size = 0;
     std::shared_ptr<class Mapper> _mapper;
-    gli2A03* _cpu;
-    gli2C02* _ppu;
+    Region _region = Region::Ntsc;
+    gli2A03* _cpu = nullptr;
+    gli2C02* _ppu = nullptr;
+    EventLog* _event_log = nullptr;
 };
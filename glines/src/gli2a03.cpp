@@ -1,121 +1,12 @@
-#include "gli2A03.h"
+#include "gli2a03.h"
 
 #include "bits.h"
+#include "event_log.h"
+#include "gli2a03_instructions.h"
 #include "log.h"
 
-// Addressing mode - high bit set means instructions which load across a page boundary using the addressing mode will incur a 1-cycle penalty.
-// Instruction length (in bytes) is determined by addressing mode
-enum AddressingMode : uint8_t
-{
-    Implied     = 0x00, // 1 byte
-    Immediate   = 0x01, // 2 bytes
-    ZeroPage    = 0x02, // 2 bytes
-    ZeroPage_X  = 0x03, // 2 bytes
-    ZeroPage_Y  = 0x04, // 2 bytes
-    Relative    = 0x05, // 2 bytes
-    Indirect_X  = 0x06, // (Indirect,X) 2 bytes
-    Indirect_Y  = 0x87, // (Indirect),Y 2 bytes
-    Indirect    = 0x08, // (Indirect) 3 bytes
-    Absolute_X  = 0x89, // 3 bytes
-    Absolute_Y  = 0x8A, // 3 bytes
-    Absolute    = 0x0B, // 3 bytes
-};
-
-
-// Opcodes - undocumented opcodes commented with a '*'
-enum Opcode : uint8_t
-{
-    ADC,
-    ALR,    // *
-    ANC,    // *
-    AND,
-    AHX,    // * aka AXA
-    ARR,    // *
-    ASL,
-    AXS,    // *
-    BCC,
-    BCS,
-    BEQ,
-    BIT,
-    BMI,
-    BNE,
-    BPL,
-    BRK,
-    BVC,
-    BVS,
-    CLC,
-    CLD,
-    CLI,
-    CLV,
-    CMP,
-    CPX,
-    CPY,
-    DCP,    // * aka DCM
-    DEC,
-    DEX,
-    DEY,
-    EOR,
-    INC,
-    INX,
-    INY,
-    ISC,    // * aka INS
-    JMP,
-    JSR,
-    LAS,    // *
-    LAX,    // *
-    LDA,
-    LDX,
-    LDY,
-    LSR,
-    NOP,
-    ORA,
-    PHA,
-    PHP,
-    PLA,
-    PLP,
-    RLA,    // *
-    ROL,
-    ROR,
-    RRA,    // *
-    RTI,
-    RTS,
-    SAX,    // *
-    SBC,
-    SEC,
-    SED,
-    SEI,
-    SHX,    // * aka XAS
-    SHY,    // * aka SAY
-    SLO,    // * aka ASO
-    SRE,    // * aka LSE
-    STA,
-    STP,    // * aka HLT
-    STX,
-    STY,
-    TAS,    // *
-    TAX,
-    TAY,
-    TSX,
-    TXA,
-    TXS,
-    TYA,
-    XAA,    // *
-};
-
-
-// Instruction description - high byte of cycles is set for instructions which will incur a penalty when using an indexed addressing mode and
-// crossing a page boundary when cacluating the address.
-struct Instruction
-{
-    const char* mnemonic;
-    Opcode opcode;
-    AddressingMode addressing_mode;
-    int cycles;
-};
-
-
 // Instruction lookup table
-static const Instruction InstructionTable[] =
+const Instruction InstructionTable[256] =
 {
     { "BRK", Opcode::BRK, AddressingMode::Implied,       0x07 },    // 00
     { "ORA", Opcode::ORA, AddressingMode::Indirect_X,    0x06 },    // 01
@@ -383,19 +274,6 @@ static const Instruction InstructionTable[] =
 };
 
 
-enum StatusBits : uint8_t
-{
-    Carry = 0,
-    Zero = 1,
-    InterruptDisable = 2,
-    Decimal = 3,
-    BFlag = 4,
-    X = 5,
-    Overflow = 6,
-    Negative = 7
-};
-
-
 void gli2A03::connect(ReadCallback read_callback, WriteCallback write_callback)
 {
     read = read_callback;
@@ -426,17 +304,71 @@ void gli2A03::reset(bool coldstart)
     _instruction_cycles_remaining = 6;
     _nmi = 0;
     _irq = 0;
+    _irq_lines = 0;
+    _interrupt = 0;
+    _interrupt_disable = 0;
+    _stall = 0;
     _dma = 0;
 }
 
 
+void gli2A03::save_state(State& state) const
+{
+    state.cycle_counter = _cycle_counter;
+    state.pc = _pc;
+    state.dmaaddr = _dmaaddr;
+    state.p = _p;
+    state.a = _a;
+    state.x = _x;
+    state.y = _y;
+    state.s = _s;
+    state.stopped = _stopped;
+    state.ir = _ir;
+    state.instruction_cycles_remaining = _instruction_cycles_remaining;
+    state.nmi = _nmi;
+    state.irq = _irq;
+    state.irq_lines = _irq_lines;
+    state.interrupt = _interrupt;
+    state.interrupt_disable = _interrupt_disable;
+    state.stall = _stall;
+    state.dma = _dma;
+}
+
+
+void gli2A03::load_state(const State& state)
+{
+    _cycle_counter = state.cycle_counter;
+    _pc = state.pc;
+    _dmaaddr = state.dmaaddr;
+    _p = state.p;
+    _a = state.a;
+    _x = state.x;
+    _y = state.y;
+    _s = state.s;
+    _stopped = state.stopped;
+    _ir = state.ir;
+    _instruction_cycles_remaining = state.instruction_cycles_remaining;
+    _nmi = state.nmi;
+    _irq = state.irq;
+    _irq_lines = state.irq_lines;
+    _interrupt = state.interrupt;
+    _interrupt_disable = state.interrupt_disable;
+    _stall = state.stall;
+    _dma = state.dma;
+}
+
+
 void gli2A03::clock()
 {
     if (!_stopped)
     {
         ++_cycle_counter;
 
-        if (_dma)
+        if (_stall)
+        {
+            --_stall;
+        }
+        else if (_dma)
         {
             if ((_cycle_counter & 1) == 0)
             {
@@ -448,17 +380,30 @@ void gli2A03::clock()
         }
         else
         {
+            if (_instruction_cycles_remaining == 1)
+            {
+                /*
+                    Interrupts are polled on an instruction's next to last cycle, one raised on its last waits for the next
+                    instruction. Whatever was raised on that cycle has been by the time the last one starts, so the poll is made then.
+                */
+                uint8_t interrupt_disable = _interrupt_disable ? (_interrupt_disable & 1) : get_bit(_p, StatusBits::InterruptDisable);
+                _interrupt = _nmi || ((_irq || _irq_lines) && !interrupt_disable);
+                _interrupt_disable = 0;
+            }
+
             if (!_instruction_cycles_remaining)
             {
-                // Fetch, decode & execute the next instruction
+                // Fetch, decode & execute the next instruction, or start the interrupt the last one polled
 
-                if (_nmi)
+                if (_interrupt && _nmi)
                 {
                     _ir = 0x00;
                     _pc -= 1;
                 }
-                else if (_irq && get_bit(_p, StatusBits::InterruptDisable) == 0)
+                else if (_interrupt)
                 {
+                    // The BRK sequence acknowledges _irq, the lines stay asserted until their source releases them
+                    _irq = 1;
                     _ir = 0x00;
                     _pc -= 1;
                 }
@@ -474,6 +419,7 @@ void gli2A03::clock()
                     _ir = read(_pc++);
                 }
 
+                _interrupt = 0;
                 exec();
             }
 
@@ -493,12 +439,30 @@ void gli2A03::dma(uint8_t page)
 void gli2A03::irq()
 {
     _irq = 1;
+    _event_log ? _event_log->record(EventLog::EventType::Irq) : ((void)0);
+}
+
+
+void gli2A03::set_irq_line(IrqLine line, bool asserted)
+{
+    if (asserted && !(_irq_lines & line))
+        _event_log ? _event_log->record(EventLog::EventType::Irq) : ((void)0);
+
+    _irq_lines = asserted ? (_irq_lines | line) : (_irq_lines & ~line);
 }
 
 
 void gli2A03::nmi()
 {
     _nmi = 1;
+    _event_log ? _event_log->record(EventLog::EventType::Nmi) : ((void)0);
+}
+
+
+void gli2A03::delay_interrupt_disable()
+{
+    // CLI, SEI and PLP change the I flag after the interrupt poll, which sees the old one
+    _interrupt_disable = 0x80 | get_bit(_p, StatusBits::InterruptDisable);
 }
 
 
@@ -558,7 +522,9 @@ void gli2A03::exec()
         }
         case Relative:
         {
-            address = (int8_t)read(_pc++) + _pc;
+            // The offset is from the following instruction, _pc must be incremented before it's added
+            int8_t offset = (int8_t)read(_pc++);
+            address = offset + _pc;
             break;
         }
         case Absolute:
@@ -626,6 +592,9 @@ void gli2A03::exec()
         }
     }
 
+    // The operand is accessed on the last cycle, including any page crossing penalty
+    _access_offset = _instruction_cycles_remaining - 1;
+
     uint8_t value = 0xcd;
 
     auto load_register = [this, &value](uint8_t& reg)
@@ -785,9 +754,14 @@ void gli2A03::exec()
                 _stopped = true;
 
             if (_nmi)
+            {
                 _nmi = 0;
+            }
             else if (_irq)
+            {
                 _irq = 0;
+                _event_log ? _event_log->record(EventLog::EventType::IrqAcknowledge) : ((void)0);
+            }
 
             break;
         }
@@ -821,6 +795,7 @@ void gli2A03::exec()
         }
         case Opcode::CLI:
         {
+            delay_interrupt_disable();
             set_bit(_p, StatusBits::InterruptDisable, 0);
             break;
         }
@@ -946,6 +921,12 @@ void gli2A03::exec()
         {
             break;
         }
+        case Opcode::STP:
+        {
+            // Jams the CPU until it's reset (it has no cycle count, left to run it would take 256 cycles and carry on)
+            _stopped = true;
+            break;
+        }
         case Opcode::ORA:
         {
             value = read(address);
@@ -974,6 +955,7 @@ void gli2A03::exec()
         }
         case Opcode::PLP:
         {
+            delay_interrupt_disable();
             value = pop();
             set_bit(value, StatusBits::BFlag, 0);
             set_bit(value, StatusBits::X, 0);
@@ -1074,6 +1056,7 @@ void gli2A03::exec()
         }
         case Opcode::SEI:
         {
+            delay_interrupt_disable();
             set_bit(_p, StatusBits::InterruptDisable, 1);
             break;
         }
@@ -1151,7 +1134,6 @@ void gli2A03::exec()
             // Similar to AND #i then ROR A, except sets the flags differently.N and Z are normal, but C is bit 6 and V is bit 6 xor bit 5. A fast
             // way to perform signed division by 4 is: CMP #$80; ARR #$FF; ROR.This can be extended to larger powers of two.
             value = _a & read(address);
-            int c = get_bit(value, 0);
             value >>= 1;
             set_bit(value, 7, get_bit(_p, StatusBits::Carry));
             load_register(_a);
@@ -1258,6 +1240,8 @@ void gli2A03::exec()
             break;
         }
     }
+
+    _access_offset = 0;
 }
 
 
@@ -1274,8 +1258,8 @@ std::string gli2A03::disassemble(uint16_t addr)
 
     const char* format = "";
     uint8_t opbytes[2]{};
-    uint8_t len;
-    uint16_t operand;
+    uint8_t len = 0;
+    uint16_t operand = 0;
 
     switch (instruction.addressing_mode)
     {
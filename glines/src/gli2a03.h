@@ -4,16 +4,26 @@
 #include <functional>
 #include <string>
 
+class EventLog;
+
 class gli2A03
 {
 public:
     typedef std::function<uint8_t(uint16_t addr)> ReadCallback;
     typedef std::function<void(uint16_t addr, uint8_t data)> WriteCallback;
 
+    // Level triggered IRQ sources, see set_irq_line()
+    enum IrqLine : uint8_t
+    {
+        IrqApuFrameCounter = 1 << 0,
+        IrqApuDmc = 1 << 1,
+    };
+
     gli2A03() = default;
     ~gli2A03() = default;
 
     void connect(ReadCallback read_callback, WriteCallback write_callback);
+    void connect_event_log(EventLog* event_log) { _event_log = event_log; }
 
     void reset(bool coldstart);
     void clock();
@@ -22,8 +32,53 @@ public:
     void irq();
     void nmi();
 
+    /*
+        irq() requests a single interrupt, these are held asserted by their source until it's acknowledged there (e.g. reading $4015) and
+        interrupt the CPU whenever the I flag is clear.
+    */
+    void set_irq_line(IrqLine line, bool asserted);
+
+    // Halt the CPU for a number of cycles, e.g. while the DMC reads a sample byte
+    void stall(uint8_t cycles) { _stall += cycles; }
+
+    uint64_t cycle_count() { return _cycle_counter; }
+
+    /*
+        The cycle of the bus access being made. Instructions are executed on their first cycle, but their loads and stores happen on
+        their last (read-modify-writes are timed by their write).
+    */
+    uint64_t access_cycle() { return _cycle_counter + _access_offset; }
+
+    bool dma_active() { return _dma != 0; }
+
     std::string disassemble(uint16_t addr);
 
+    // Registers and the progress of the current instruction, interrupt or DMA (see Nes::State)
+    struct State
+    {
+        uint64_t cycle_counter;
+        uint16_t pc;
+        uint16_t dmaaddr;
+        uint8_t p;
+        uint8_t a;
+        uint8_t x;
+        uint8_t y;
+        uint8_t s;
+        bool stopped;
+        uint8_t ir;
+        uint8_t instruction_cycles_remaining;
+        uint8_t nmi;
+        uint8_t irq;
+        uint8_t irq_lines;
+        uint8_t interrupt;
+        uint8_t interrupt_disable;
+        uint8_t stall;
+        uint8_t dma;
+    };
+
+    void save_state(State& state) const;
+    void load_state(const State& state);
+
     uint16_t    _pc;        // program counter
     uint8_t     _p;         // status register
     uint8_t     _a;         // accumulator
@@ -35,15 +90,22 @@ public:
 private:
     ReadCallback read;
     WriteCallback write;
+    EventLog* _event_log = nullptr;
 
     uint64_t _cycle_counter;
     uint8_t _ir;
     uint8_t _instruction_cycles_remaining;
     uint8_t _nmi;       // NMI pulled down
     uint8_t _irq;       // IRQ pulled down
+    uint8_t _irq_lines; // Level triggered IRQ sources asserted (IrqLine)
+    uint8_t _interrupt; // Interrupt seen by the last instruction's poll, taken instead of the next
+    uint8_t _interrupt_disable; // $80 | the I flag the poll sees instead of the current one, see delay_interrupt_disable()
+    uint8_t _access_offset = 0; // Cycles from the start of the instruction being executed to its load or store
+    uint8_t _stall;     // Cycles left halted
     uint8_t _dma;       // DMA requested
     uint16_t _dmaaddr;  // Source address for DMA transfer
 
+    void delay_interrupt_disable();
     uint16_t read_word(uint16_t addr);
     void push(uint8_t value);
     uint8_t pop();
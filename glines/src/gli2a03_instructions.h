@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+    The 2A03's instruction set: the decode table shared by gli2A03 and FlatLockstepCpu. Private to the CPU implementations, the names are
+    all unscoped.
+*/
+
+// Addressing mode - high bit set means instructions which load across a page boundary using the addressing mode will incur a 1-cycle penalty.
+// Instruction length (in bytes) is determined by addressing mode
+enum AddressingMode : uint8_t
+{
+    Implied     = 0x00, // 1 byte
+    Immediate   = 0x01, // 2 bytes
+    ZeroPage    = 0x02, // 2 bytes
+    ZeroPage_X  = 0x03, // 2 bytes
+    ZeroPage_Y  = 0x04, // 2 bytes
+    Relative    = 0x05, // 2 bytes
+    Indirect_X  = 0x06, // (Indirect,X) 2 bytes
+    Indirect_Y  = 0x87, // (Indirect),Y 2 bytes
+    Indirect    = 0x08, // (Indirect) 3 bytes
+    Absolute_X  = 0x89, // 3 bytes
+    Absolute_Y  = 0x8A, // 3 bytes
+    Absolute    = 0x0B, // 3 bytes
+};
+
+
+// Opcodes - undocumented opcodes commented with a '*'
+enum Opcode : uint8_t
+{
+    ADC,
+    ALR,    // *
+    ANC,    // *
+    AND,
+    AHX,    // * aka AXA
+    ARR,    // *
+    ASL,
+    AXS,    // *
+    BCC,
+    BCS,
+    BEQ,
+    BIT,
+    BMI,
+    BNE,
+    BPL,
+    BRK,
+    BVC,
+    BVS,
+    CLC,
+    CLD,
+    CLI,
+    CLV,
+    CMP,
+    CPX,
+    CPY,
+    DCP,    // * aka DCM
+    DEC,
+    DEX,
+    DEY,
+    EOR,
+    INC,
+    INX,
+    INY,
+    ISC,    // * aka INS
+    JMP,
+    JSR,
+    LAS,    // *
+    LAX,    // *
+    LDA,
+    LDX,
+    LDY,
+    LSR,
+    NOP,
+    ORA,
+    PHA,
+    PHP,
+    PLA,
+    PLP,
+    RLA,    // *
+    ROL,
+    ROR,
+    RRA,    // *
+    RTI,
+    RTS,
+    SAX,    // *
+    SBC,
+    SEC,
+    SED,
+    SEI,
+    SHX,    // * aka XAS
+    SHY,    // * aka SAY
+    SLO,    // * aka ASO
+    SRE,    // * aka LSE
+    STA,
+    STP,    // * aka HLT
+    STX,
+    STY,
+    TAS,    // *
+    TAX,
+    TAY,
+    TSX,
+    TXA,
+    TXS,
+    TYA,
+    XAA,    // *
+};
+
+
+// Instruction description - high byte of cycles is set for instructions which will incur a penalty when using an indexed addressing mode and
+// crossing a page boundary when cacluating the address.
+struct Instruction
+{
+    const char* mnemonic;
+    Opcode opcode;
+    AddressingMode addressing_mode;
+    int cycles;
+};
+
+
+// Decode table, indexed by the instruction's first byte
+extern const Instruction InstructionTable[256];
+
+
+enum StatusBits : uint8_t
+{
+    Carry = 0,
+    Zero = 1,
+    InterruptDisable = 2,
+    Decimal = 3,
+    BFlag = 4,
+    X = 5,
+    Overflow = 6,
+    Negative = 7
+};
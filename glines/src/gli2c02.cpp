@@ -1,8 +1,12 @@
 #include "gli2c02.h"
 
 #include "bits.h"
+#include "deferred_renderer.h"
 #include "gamepak.h"
 
+#include <algorithm>
+#include <cstring>
+
 
 enum PpuRegisters : uint16_t
 {
@@ -70,6 +74,7 @@ enum StateFlags
     OamReadMask = 0x02, // Reads from OAMDATA return 0xFF
 };
 
+
 void gli2C02::reset(bool coldstart)
 {
     /*
@@ -109,6 +114,11 @@ void gli2C02::reset(bool coldstart)
 
     _clocks = 0;
     _frame = 0;
+    _burst_phase = 0;
+    _line_changes = 0;
+    _frame_dirty_lines.reset();
+    _dirty_lines.set();
+    _render_target = _next_render_target;
     _scanline = 0;
     _cycle = 0;
     _state_flags = StateFlags::Reset;
@@ -121,20 +131,39 @@ void gli2C02::reset(bool coldstart)
         _ppuaddr = 0;
         _temp_vram_address = 0;
         _fine_x_scroll = 0;
+
+        // Unspecified at power on, cleared so runs are reproducible (rendering can start before the first fetches fill the shifters)
+        _ram.fill(0);
+        _oam.fill(0);
+        _secondary_oam.fill(0);
+        _secondary_oam_index.fill(0);
+        _palette.fill(0);
+        _sprite_output_units.fill({});
+        _bl_shift = _bh_shift = 0;
+        _al_shift = _ah_shift = 0;
+        _nt_latch = _bl_latch = _bh_latch = _attribute_latch = 0;
     }
+
+    update_nametable_map();
+    rebuild_attribute_cache();
+
+    if (_deferred_renderer)
+        _deferred_renderer->begin_frame(*this);
 }
 
 
+template <class Timing>
 void gli2C02::clock()
 {
     ++_clocks;
 
     if (_state_flags & StateFlags::Reset)
     {
-        if (_scanline >= 0 && _scanline < 240 && _cycle < 256)
+        if (_scanline >= 0 && _scanline < 240 && _cycle < 256 && !_deferred_renderer)
         {
             uint8_t p = read(PpuMemoryMap::PALETTE_BASE);
-            _screen[size_t(_scanline) * 256 + _cycle] = p;
+            output_pixel(_cycle, p);
+            _render_target.layers ? output_layers(_cycle, 0, 0, 0, 0xFF) : ((void)0);
         }
     }
     else
@@ -196,10 +225,21 @@ void gli2C02::clock()
                             // Fetch attribute byte
                             uint16_t coarse_y = (_ppuaddr & PpuAddrCoarseYMask) >> PpuAddrCoarseYShift;
                             uint16_t coarse_x = (_ppuaddr & PpuAddrCoarseXMask) >> PpuAddrCoarseXShift;
-                            uint16_t attribute_address = 0x23C0 | (_ppuaddr & 0x0C00) | ((coarse_y >> 2) << 3) | (coarse_x >> 2);
-                            _attribute_latch = read(attribute_address);
-                            if (coarse_y & 0x02) _attribute_latch >>= 4;
-                            if (coarse_x & 0x02) _attribute_latch >>= 2;
+
+                            if (coarse_y < 30)
+                            {
+                                uint8_t nametable = _nametable_map[(_ppuaddr >> PpuAddrNametableXShift) & 3];
+                                _attribute_latch = _attribute_cache[nametable][(coarse_y << 5) | coarse_x];
+                            }
+                            else
+                            {
+                                // Coarse Y set out of bounds, the attribute table is being rendered as tiles
+                                uint16_t attribute_address = 0x23C0 | (_ppuaddr & 0x0C00) | ((coarse_y >> 2) << 3) | (coarse_x >> 2);
+                                _attribute_latch = read(attribute_address);
+                                if (coarse_y & 0x02) _attribute_latch >>= 4;
+                                if (coarse_x & 0x02) _attribute_latch >>= 2;
+                            }
+
                             break;
                         }
                         case 5:
@@ -294,6 +334,8 @@ void gli2C02::clock()
 
                                 if (active_sprites < 8)
                                 {
+                                    _secondary_oam_index[active_sprites] = oam_read_ptr >> 2;
+
                                     for (uint8_t i = 0; i < 4; ++i)
                                         _secondary_oam[oam_write_ptr++] = _oam[oam_read_ptr++];
 
@@ -331,6 +373,7 @@ void gli2C02::clock()
                             uint8_t tile_index = _secondary_oam[oam_read_ptr + 1];
                             _sprite_output_units[sprite].attributes = _secondary_oam[oam_read_ptr + 2];
                             _sprite_output_units[sprite].x_position = _secondary_oam[oam_read_ptr + 3];
+                            _sprite_output_units[sprite].oam_index = _secondary_oam_index[sprite];
 
                             uint8_t pattern_table;
                             uint16_t lsb_address;
@@ -474,13 +517,15 @@ void gli2C02::clock()
                 _nt_latch = read(tile_address);
             }
 
-            if (_scanline >= 0 && _cycle > 0 && _cycle <= 256)
+            // The deferred renderer produces the pixels, only sprite zero hit has to be evaluated here and only while it can still happen
+            if (_scanline >= 0 && _cycle > 0 && _cycle <= 256 && (!_deferred_renderer || ((_sprite_zero_visible & 1) && !_ppustatus.S)))
             {
                 uint8_t bg_pixel = 0;
                 uint8_t bg_palette = 0;
                 uint8_t fg_pixel = 0;
                 uint8_t fg_palette = 0;
                 uint8_t fg_priority = 0;
+                uint8_t fg_sprite = 0;
 
                 if (_ppumask.b && _cycle > (_ppumask.m ? 0 : 8))
                 {
@@ -513,6 +558,7 @@ void gli2C02::clock()
 
                                 if (fg_pixel)
                                 {
+                                    fg_sprite = sprite;
                                     sprite_zero_drawn = (sprite == 0);
                                     break;
                                 }
@@ -525,32 +571,41 @@ void gli2C02::clock()
                         _ppustatus.S |= _sprite_zero_visible & 1;
                 }
 
-                // Mux fg & bg pixels
-                uint8_t pixel = 0x00;
-                uint8_t palette = 0x00;
-
-                if (bg_pixel && fg_pixel)
-                {
-                    pixel = fg_priority ? fg_pixel : bg_pixel;
-                    palette = fg_priority ? fg_palette : bg_palette;
-                }
-                else if (bg_pixel)
+                if (!_deferred_renderer)
                 {
-                    pixel = bg_pixel;
-                    palette = bg_palette;
-                }
-                else if (fg_pixel)
-                {
-                    pixel = fg_pixel;
-                    palette = fg_palette;
-                }
+                    // Mux fg & bg pixels
+                    uint8_t pixel = 0x00;
+                    uint8_t palette = 0x00;
 
-                _screen[_scanline * 256 + (_cycle - 1)] = read(PpuMemoryMap::PALETTE_BASE | (palette << 2) | pixel);
+                    if (bg_pixel && fg_pixel)
+                    {
+                        pixel = fg_priority ? fg_pixel : bg_pixel;
+                        palette = fg_priority ? fg_palette : bg_palette;
+                    }
+                    else if (bg_pixel)
+                    {
+                        pixel = bg_pixel;
+                        palette = bg_palette;
+                    }
+                    else if (fg_pixel)
+                    {
+                        pixel = fg_pixel;
+                        palette = fg_palette;
+                    }
+
+                    output_pixel(_cycle - 1, read(PpuMemoryMap::PALETTE_BASE | (palette << 2) | pixel));
+
+                    if (_render_target.layers)
+                    {
+                        output_layers(_cycle - 1, bg_pixel ? (bg_palette << 2) | bg_pixel : 0, fg_pixel ? (fg_palette << 2) | fg_pixel : 0,
+                                      fg_pixel ? fg_priority : 0, fg_pixel ? _sprite_output_units[fg_sprite].oam_index : 0xFF);
+                    }
+                }
             }
         } // if _scanline < 240
     }
 
-    if (_scanline == 241 && _cycle == 1)
+    if (_scanline == Timing::VblankScanline && _cycle == 1)
     {
         _ppustatus.V = 1;
 
@@ -566,18 +621,25 @@ void gli2C02::clock()
 
     ++_cycle;
 
-    if (_scanline == -1 && _cycle == 340 && (_frame & 1))
+    if (Timing::SkipOddFrameDot && _scanline == -1 && _cycle == 340 && (_frame & 1))
     {
         // Skip the last cycle on the prerender scanline of odd frames
         ++_cycle;
+        _burst_phase = (_burst_phase + 1) % 3;
     }
 
     if (_cycle == 341)
     {
+        if (_scanline >= 0 && _scanline < 240)
+        {
+            _frame_dirty_lines[_scanline] = _line_changes != 0;
+            _line_changes = 0;
+        }
+
         _cycle = 0;
         ++_scanline;
 
-        if (_scanline == 261)
+        if (_scanline > Timing::LastScanline)
         {
             _scanline = -1;
         }
@@ -585,8 +647,140 @@ void gli2C02::clock()
 
     if (_scanline == 0 && _cycle == 0)
     {
+        // A frame is 262 * 341 * 8 samples long, 4 samples more than a whole number of subcarrier cycles
         _frame++;
+        _burst_phase = (_burst_phase + 1) % 3;
         _sprite_zero_visible = 0;
+        _render_target = _next_render_target;
+
+        if (_deferred_renderer)
+            _deferred_renderer->begin_frame(*this);
+    }
+    else if (_scanline == 240 && _cycle == 0)
+    {
+        _dirty_lines = _frame_dirty_lines;
+
+        if (_deferred_renderer)
+            _deferred_renderer->end_frame();
+    }
+}
+
+
+template void gli2C02::clock<NtscTiming>();
+template void gli2C02::clock<PalTiming>();
+template void gli2C02::clock<DendyTiming>();
+
+
+template <class Timing>
+uint32_t gli2C02::idle_clocks() const
+{
+    // Positions in the frame counting from the start of the pre-render scanline
+    const uint32_t frame_start = 341;
+    const uint32_t frame_length = (Timing::LastScanline + 2) * 341;
+    const uint32_t vblank = (Timing::VblankScanline + 1) * 341 + 2; // Just after the dot which sets the vblank flag
+    uint32_t position = uint32_t(_scanline + 1) * 341 + _cycle;
+
+    if (position >= frame_start && position < vblank)
+    {
+        return vblank - position;
+    }
+
+    uint32_t clocks = position < frame_start ? frame_start - position : frame_length - position + frame_start;
+
+    if (Timing::SkipOddFrameDot && (_frame & 1) && (position < 340 || position >= frame_start))
+    {
+        // The next pre-render scanline will skip its last dot
+        clocks--;
+    }
+
+    return clocks;
+}
+
+
+template <class Timing>
+void gli2C02::advance(uint32_t clocks)
+{
+    while (clocks)
+    {
+        /*
+            Only the backdrop output, the sprite output units shifting and clearing secondary OAM happen in runs of dots. The dots which
+            start and end scanlines, evaluate sprites, reset OAMADDR or fetch nametable bytes go through clock().
+        */
+        uint16_t end = (_cycle < 2 || _cycle == 65 || _cycle == 256 || _cycle >= 338) ? _cycle : (_cycle < 65 ? 65 : (_cycle < 256 ? 256 : 338));
+
+        if (end == _cycle)
+        {
+            clock<Timing>();
+            clocks--;
+        }
+        else
+        {
+            uint16_t count = uint16_t(std::min<uint32_t>(clocks, end - _cycle));
+            idle_span(count);
+            clocks -= count;
+        }
+    }
+}
+
+
+template uint32_t gli2C02::idle_clocks<NtscTiming>() const;
+template uint32_t gli2C02::idle_clocks<PalTiming>() const;
+template uint32_t gli2C02::idle_clocks<DendyTiming>() const;
+template void gli2C02::advance<NtscTiming>(uint32_t clocks);
+template void gli2C02::advance<PalTiming>(uint32_t clocks);
+template void gli2C02::advance<DendyTiming>(uint32_t clocks);
+
+
+void gli2C02::idle_span(uint16_t count)
+{
+    // What clock() does for a run of dots on one scanline with rendering disabled, see advance()
+    uint16_t first = _cycle;
+    uint16_t last = _cycle + count;
+    _cycle = last;
+    _clocks += count;
+
+    if (_scanline >= 240)
+    {
+        return;
+    }
+
+    if (_state_flags & StateFlags::Reset)
+    {
+        if (_scanline >= 0 && first < 256 && !_deferred_renderer)
+            output_backdrop(first, std::min<uint16_t>(last, 256) - first);
+
+        return;
+    }
+
+    if (_scanline >= 0)
+    {
+        for (uint16_t cycle = first + (first & 1); cycle < last && cycle <= 64; cycle += 2)
+        {
+            _secondary_oam[(cycle - 1) >> 1] = 0xFF;
+        }
+
+        if (first > 256 && first <= 320)
+        {
+            _oamaddr = 0;
+        }
+    }
+
+    if (first <= 256)
+    {
+        uint16_t dots = std::min<uint16_t>(last, 257) - first;
+
+        for (uint8_t sprite = 0; sprite < (_active_sprites & 0xF); ++sprite)
+        {
+            SpriteOutputUnit& unit = _sprite_output_units[sprite];
+            uint16_t wait = std::min<uint16_t>(unit.x_position, dots);
+            uint16_t shift = dots - wait;
+            unit.x_position -= uint8_t(wait);
+            unit.pattern_lo = shift < 8 ? uint8_t(unit.pattern_lo << shift) : 0;
+            unit.pattern_hi = shift < 8 ? uint8_t(unit.pattern_hi << shift) : 0;
+        }
+
+        if (_scanline >= 0 && !_deferred_renderer)
+            output_backdrop(first - 1, dots);
     }
 }
 
@@ -594,6 +788,20 @@ void gli2C02::clock()
 void gli2C02::connect_game_pak(std::shared_ptr<GamePak>& game_pak)
 {
     _game_pak = game_pak;
+    update_nametable_map();
+
+    if (_deferred_renderer)
+        _deferred_renderer->record_mapping(*this);
+}
+
+
+void gli2C02::notify_mapper_write()
+{
+    // Bank switches can change the nametable mirroring, and what the deferred renderer fetches for the rest of the frame
+    update_nametable_map();
+
+    if (_deferred_renderer)
+        _deferred_renderer->record_mapping(*this);
 }
 
 
@@ -610,6 +818,9 @@ void gli2C02::cpu_write(uint16_t address, uint8_t value)
         See https://wiki.nesdev.com/w/index.php/PPU_scrolling for information on how the internal registers are written by writes to $2005 & $2006.
     */
 
+    if (_deferred_renderer)
+        _deferred_renderer->record_write(*this, address, value);
+
     switch (address)
     {
         case PpuRegisters::PPUCTRL:
@@ -754,6 +965,9 @@ uint8_t gli2C02::cpu_read(uint16_t address)
 
     uint8_t value = _ppudatabuffer;
 
+    if (_deferred_renderer && (address == PpuRegisters::PPUSTATUS || address == PpuRegisters::PPUDATA))
+        _deferred_renderer->record_read(*this, address);
+
     switch (address)
     {
         case PpuRegisters::PPUSTATUS:
@@ -803,38 +1017,287 @@ uint8_t gli2C02::cpu_read(uint16_t address)
 }
 
 
-void gli2C02::get_pattern_table(uint8_t table_index, uint8_t palette_index, std::array<uint8_t, 0x4000>& pattern_table)
+void gli2C02::save_state(State& state) const
 {
-    for (uint16_t t = 0; t < 256; ++t)
+    state.ram = _ram;
+    state.oam = _oam;
+    state.secondary_oam = _secondary_oam;
+    state.secondary_oam_index = _secondary_oam_index;
+    state.palette = _palette;
+    state.sprite_output_units = _sprite_output_units;
+    state.clocks = _clocks;
+    state.frame = _frame;
+    state.ppuaddr = _ppuaddr;
+    state.temp_vram_address = _temp_vram_address;
+    state.bl_shift = _bl_shift;
+    state.bh_shift = _bh_shift;
+    state.al_shift = _al_shift;
+    state.ah_shift = _ah_shift;
+    state.scanline = _scanline;
+    state.cycle = _cycle;
+    state.ppuctrl = _ppuctrl;
+    state.ppumask = _ppumask;
+    state.ppustatus = _ppustatus;
+    state.oamaddr = _oamaddr;
+    state.ppudatabuffer = _ppudatabuffer;
+    state.fine_x_scroll = _fine_x_scroll;
+    state.address_latch = _address_latch;
+    state.nt_latch = _nt_latch;
+    state.bl_latch = _bl_latch;
+    state.bh_latch = _bh_latch;
+    state.attribute_latch = _attribute_latch;
+    state.active_sprites = _active_sprites;
+    state.sprite_zero_visible = _sprite_zero_visible;
+    state.state_flags = _state_flags;
+    state.nmi = _nmi;
+    state.burst_phase = _burst_phase;
+}
+
+
+void gli2C02::load_state(const State& state)
+{
+    _ram = state.ram;
+    _oam = state.oam;
+    _secondary_oam = state.secondary_oam;
+    _secondary_oam_index = state.secondary_oam_index;
+    _palette = state.palette;
+    _sprite_output_units = state.sprite_output_units;
+    _clocks = state.clocks;
+    _frame = state.frame;
+    _ppuaddr = state.ppuaddr;
+    _temp_vram_address = state.temp_vram_address;
+    _bl_shift = state.bl_shift;
+    _bh_shift = state.bh_shift;
+    _al_shift = state.al_shift;
+    _ah_shift = state.ah_shift;
+    _scanline = state.scanline;
+    _cycle = state.cycle;
+    _ppuctrl = state.ppuctrl;
+    _ppumask = state.ppumask;
+    _ppustatus = state.ppustatus;
+    _oamaddr = state.oamaddr;
+    _ppudatabuffer = state.ppudatabuffer;
+    _fine_x_scroll = state.fine_x_scroll;
+    _address_latch = state.address_latch;
+    _nt_latch = state.nt_latch;
+    _bl_latch = state.bl_latch;
+    _bh_latch = state.bh_latch;
+    _attribute_latch = state.attribute_latch;
+    _active_sprites = state.active_sprites;
+    _sprite_zero_visible = state.sprite_zero_visible;
+    _state_flags = state.state_flags;
+    _nmi = state.nmi;
+    _burst_phase = state.burst_phase;
+
+    // The game pak's state must already be loaded for the mirroring
+    update_nametable_map();
+    rebuild_attribute_cache();
+
+    // What's on screen no longer follows from the state, so as on reset everything is dirty
+    _line_changes = 0;
+    _frame_dirty_lines.set();
+    _dirty_lines.set();
+
+    // The frame being recorded started from another state, and CHR RAM may have changed under the renderer's snapshot of it
+    if (_deferred_renderer)
+    {
+        _deferred_renderer->invalidate_chr();
+        _deferred_renderer->begin_frame(*this);
+    }
+}
+
+
+void gli2C02::update_nametable_map()
+{
+    /*
+        Nametables are always in the PPU's internal RAM (none of the supported mappers provide their own), so the mirroring can be
+        reduced to which half of _ram each of the logical nametables at $2000, $2400, $2800 and $2C00 uses.
+    */
+    for (uint16_t nametable = 0; nametable < 4; ++nametable)
     {
-        uint8_t tx = (t & 0xF) << 3;
-        uint8_t ty = (t >> 4) << 3;
+        uint16_t address = PpuMemoryMap::NAMETABLE_BASE + (nametable << 10);
 
-        for (uint8_t y = 0; y < 8; ++y)
+        if (_game_pak)
+            address = _game_pak->ppu_remap_address(address);
+
+        _nametable_map[nametable] = (address >> 10) & 1;
+    }
+}
+
+
+void gli2C02::update_attribute_cache(uint16_t address)
+{
+    // Each attribute byte holds the palettes for a 4x4 tile area, 2 bits for each 2x2 tile quadrant
+    uint8_t nametable = (address >> 10) & 1;
+    uint8_t attribute = address & 0x3F;
+    uint8_t value = _ram[address & 0x7FF];
+    uint8_t tile_x = (attribute & 7) << 2;
+    uint8_t tile_y = (attribute >> 3) << 2;
+
+    for (uint8_t y = tile_y; y < tile_y + 4 && y < 30; ++y)
+    {
+        for (uint8_t x = tile_x; x < tile_x + 4; ++x)
         {
-            uint16_t addr = static_cast<uint16_t>(table_index) << 12 | t << 4 | y;
-            uint8_t tile_lsb = read(addr);
-            uint8_t tile_msb = read(addr + 8);
+            uint8_t shift = ((y & 2) << 1) | (x & 2);
+            _attribute_cache[nametable][(y << 5) | x] = (value >> shift) & 3;
+        }
+    }
+}
 
-            for (uint8_t x = 0; x < 8; ++x)
-            {
-                uint8_t bit = 7 - x;
-                uint8_t lsb = get_bit(tile_lsb, bit);
-                uint8_t msb = get_bit(tile_msb, bit);
-                uint8_t pixel = (msb << 1) | lsb;
-                uint16_t offset = ((ty + y) << 7) + (tx + x);
-                pattern_table[offset] = read(pixel ? (PALETTE_BASE | (palette_index << 2) | pixel) : PALETTE_BASE);
-            }
+
+void gli2C02::rebuild_attribute_cache()
+{
+    for (uint16_t address = 0; address < 0x800; address += 0x400)
+    {
+        for (uint16_t attribute = 0x3C0; attribute < 0x400; ++attribute)
+        {
+            update_attribute_cache(address | attribute);
+        }
+    }
+}
+
+
+void gli2C02::output_pixel(uint16_t x, uint8_t color)
+{
+    // Palette RAM is only 6 bits wide, greyscale mode forces the colour to the grey column of the palette
+    color &= _ppumask.g ? 0x30 : 0x3F;
+    uint16_t color9 = color | (uint16_t(_ppumask.reg & 0xE0) << 1);
+
+    if (!_render_target.pixels)
+    {
+        size_t offset = size_t(_scanline) * 256 + x;
+        _line_changes |= _screen[offset] ^ color;
+        _screen[offset] = color;
+
+        if (_emphasis_output)
+        {
+            _line_changes |= _screen9[offset] ^ color9;
+            _screen9[offset] = color9;
+        }
+
+        return;
+    }
+
+    uint8_t* line = (uint8_t*)_render_target.pixels + size_t(_scanline) * _render_target.stride;
+
+    switch (_render_target.format)
+    {
+        case PixelFormat::Index8:
+        {
+            _line_changes |= line[x] ^ color;
+            line[x] = color;
+            break;
+        }
+        case PixelFormat::Index9:
+        {
+            uint16_t* pixel = (uint16_t*)line + x;
+            _line_changes |= *pixel ^ color9;
+            *pixel = color9;
+            break;
+        }
+        case PixelFormat::Rgba32:
+        {
+            uint32_t* pixel = (uint32_t*)line + x;
+            uint32_t rgba = _render_target.palette[color9];
+            _line_changes |= *pixel != rgba;
+            *pixel = rgba;
+            break;
         }
     }
 }
 
 
-void gli2C02::get_palette(uint8_t palette_index, std::array<uint8_t, 4>& palette)
+void gli2C02::output_layers(uint16_t x, uint8_t background, uint8_t sprite, uint8_t priority, uint8_t oam_index)
 {
-    for (uint8_t i = 0; i < 4; ++i)
+    LayerPlanes& layers = *_render_target.layers;
+    size_t offset = size_t(_scanline) * 256 + x;
+    layers.background[offset] = background;
+    layers.sprite[offset] = sprite;
+    layers.sprite_priority[offset] = priority;
+    layers.sprite_oam_index[offset] = oam_index;
+}
+
+
+void gli2C02::output_backdrop(uint16_t x, uint16_t count)
+{
+    // output_pixel() (and output_layers()) for a run of backdrop pixels
+    uint8_t color = read(PpuMemoryMap::PALETTE_BASE) & (_ppumask.g ? 0x30 : 0x3F);
+    uint16_t color9 = color | (uint16_t(_ppumask.reg & 0xE0) << 1);
+    size_t offset = size_t(_scanline) * 256 + x;
+
+    if (!_render_target.pixels)
     {
-        palette[i] = read(PpuMemoryMap::PALETTE_BASE | (palette_index << 2) | i);
+        uint8_t changes = 0;
+
+        for (uint16_t i = 0; i < count; ++i)
+        {
+            changes |= _screen[offset + i] ^ color;
+        }
+
+        memset(&_screen[offset], color, count);
+
+        if (_emphasis_output)
+        {
+            for (uint16_t i = 0; i < count; ++i)
+            {
+                _line_changes |= _screen9[offset + i] ^ color9;
+                _screen9[offset + i] = color9;
+            }
+        }
+
+        _line_changes |= changes;
+    }
+    else
+    {
+        uint8_t* line = (uint8_t*)_render_target.pixels + size_t(_scanline) * _render_target.stride;
+
+        switch (_render_target.format)
+        {
+            case PixelFormat::Index8:
+            {
+                for (uint16_t i = 0; i < count; ++i)
+                {
+                    _line_changes |= line[x + i] ^ color;
+                }
+
+                memset(line + x, color, count);
+                break;
+            }
+            case PixelFormat::Index9:
+            {
+                uint16_t* pixels = (uint16_t*)line + x;
+
+                for (uint16_t i = 0; i < count; ++i)
+                {
+                    _line_changes |= pixels[i] ^ color9;
+                    pixels[i] = color9;
+                }
+
+                break;
+            }
+            case PixelFormat::Rgba32:
+            {
+                uint32_t* pixels = (uint32_t*)line + x;
+                uint32_t rgba = _render_target.palette[color9];
+
+                for (uint16_t i = 0; i < count; ++i)
+                {
+                    _line_changes |= pixels[i] != rgba;
+                    pixels[i] = rgba;
+                }
+
+                break;
+            }
+        }
+    }
+
+    if (_render_target.layers)
+    {
+        LayerPlanes& layers = *_render_target.layers;
+        memset(&layers.background[offset], 0, count);
+        memset(&layers.sprite[offset], 0, count);
+        memset(&layers.sprite_priority[offset], 0, count);
+        memset(&layers.sprite_oam_index[offset], 0xFF, count);
     }
 }
 
@@ -848,6 +1311,8 @@ uint8_t gli2C02::read(uint16_t address)
     {
         if (_game_pak)
             _game_pak->ppu_read(address, value);
+        else if (_chr)
+            value = _chr[_chr_banks[address >> 10] + (address & 0x3FF)];
     }
     else if (address <= NAMETABLE_MIRROR_TOP)
     {
@@ -855,6 +1320,8 @@ uint8_t gli2C02::read(uint16_t address)
 
         if (_game_pak)
             address = _game_pak->ppu_remap_address(address);
+        else
+            address = (uint16_t(_nametable_map[(address >> 10) & 3]) << 10) | (address & 0x3FF);
 
         if (!_game_pak || !_game_pak->ppu_read(address, value))
         {
@@ -880,8 +1347,8 @@ void gli2C02::write(uint16_t address, uint8_t value)
 {
     if (address <= PpuMemoryMap::PATTERN_TABLE_TOP)
     {
-        if (_game_pak)
-            _game_pak->ppu_write(address, value);
+        if (_game_pak && _game_pak->ppu_write(address, value) && _deferred_renderer)
+            _deferred_renderer->record_chr_write(*this, address, value);
     }
     else if (address <= NAMETABLE_MIRROR_TOP)
     {
@@ -889,11 +1356,16 @@ void gli2C02::write(uint16_t address, uint8_t value)
 
         if (_game_pak)
             address = _game_pak->ppu_remap_address(address);
+        else
+            address = (uint16_t(_nametable_map[(address >> 10) & 3]) << 10) | (address & 0x3FF);
 
         if (!_game_pak || !_game_pak->ppu_write(address, value))
         {
             address = address & 0x7FF;
             _ram[address] = value;
+
+            if ((address & 0x3FF) >= 0x3C0)
+                update_attribute_cache(address);
         }
     }
     else if (address <= PpuMemoryMap::PALETTE_TOP)
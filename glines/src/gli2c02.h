@@ -1,35 +1,119 @@
 #pragma once
 
 #include <array>
+#include <bitset>
 #include <memory>
 
+#include "region.h"
+
+class DeferredRenderer;
 class GamePak;
 
 class gli2C02
 {
 public:
+    enum class PixelFormat : uint8_t
+    {
+        Index8,     // uint8_t palette index (bits 0-5), the same as _screen
+        Index9,     // uint16_t palette index plus PPUMASK emphasis bits (bits 6-8), the same as _screen9
+        Rgba32,     // uint32_t from a 512 entry table indexed by the Index9 value (e.g. RgbaConverter::lut())
+    };
+
+
+    /*
+        The layers behind each composited pixel, produced alongside it for analysis tools. Background and sprite values are palette RAM
+        indexes before greyscale is applied, so either can be looked up in the palette whether it won or not.
+    */
+    struct LayerPlanes
+    {
+        std::array<uint8_t, 256 * 240> background;          // 0x01-0x0F, 0 where the background is transparent or disabled
+        std::array<uint8_t, 256 * 240> sprite;              // 0x11-0x1F, 0 where there's no opaque sprite pixel
+        std::array<uint8_t, 256 * 240> sprite_priority;     // 1 where the sprite is in front of the background
+        std::array<uint8_t, 256 * 240> sprite_oam_index;    // OAM entry (0-63) of the sprite, 0xFF where there's no opaque sprite pixel
+    };
+
+
+    /*
+        Memory the PPU renders into. Lines are written straight into it as they're produced, it is never copied anywhere else and
+        _screen/_screen9 aren't written while it's attached. _dirty_lines is relative to what the target held before the frame, so a
+        ring of targets gets the lines which changed since that target was last used.
+
+        With the deferred renderer a frame's target is written by a worker thread, it must be left alone until present() returns.
+    */
+    struct RenderTarget
+    {
+        void* pixels = nullptr;             // nullptr to render to _screen (and _screen9, see set_emphasis_output())
+        size_t stride = 0;                  // Bytes from the start of one line to the next
+        PixelFormat format = PixelFormat::Index8;
+        const uint32_t* palette = nullptr;  // Rgba32 only
+        LayerPlanes* layers = nullptr;      // Optional, written as well as the composite (whether it goes to pixels or _screen)
+    };
+
+
     gli2C02() = default;
     ~gli2C02() = default;
 
     void reset(bool coldstart);
+    // Instantiated for NtscTiming, PalTiming and DendyTiming (see region.h)
+    template <class Timing = NtscTiming>
     void clock();
 
+    /*
+        While rendering is disabled the PPU does nothing the rest of the system can see until the CPU accesses its registers, vblank
+        starts or the next frame starts, so it can be advanced in bulk. idle_clocks() is the number of clocks to the end of the next of
+        those events and advance() is equivalent to calling clock() that many times (and only valid while rendering stays disabled).
+    */
+    bool rendering_enabled() const { return _ppumask.b || _ppumask.s; }
+
+    template <class Timing = NtscTiming>
+    uint32_t idle_clocks() const;
+
+    template <class Timing = NtscTiming>
+    void advance(uint32_t clocks);
+
     void connect_game_pak(std::shared_ptr<GamePak>& game_pak);
+    void notify_mapper_write();
 
     void cpu_write(uint16_t address, uint8_t value);
     uint8_t cpu_read(uint16_t address);
 
     uint32_t frame_number() { return _frame; }
-    void get_pattern_table(uint8_t table_index, uint8_t palette_index, std::array<uint8_t, 0x4000>& pattern_table);
-    void get_palette(uint8_t palette_index, std::array<uint8_t, 4>& palette);
+    int16_t scanline() { return _scanline; }
+    uint16_t cycle() { return _cycle; }
+    void set_emphasis_output(bool enable) { _emphasis_output = enable; }
+
+    // Takes effect at the start of the next frame (or on reset) so it can be changed every frame
+    void set_render_target(const RenderTarget& target) { _next_render_target = target; }
+    const RenderTarget& render_target() const { return _render_target; }
+    uint8_t burst_phase() { return _burst_phase; }
 
     void clear_nmi() { _nmi = 0; }
     uint8_t nmi() { return _nmi; }
     uint64_t clock_count() { return _clocks; }
 
+    /*
+        Memory, registers and position in the frame (see Nes::State). The attribute cache and nametable map are rebuilt on loading and
+        the output isn't state: restored part way through a frame the lines already drawn keep what they held until the next one.
+    */
+    struct State;
+    void save_state(State& state) const;
+    void load_state(const State& state);
+
     std::array<uint8_t, 256 * 240> _screen;
+    std::array<uint16_t, 256 * 240> _screen9;   // Palette index (bits 0-5) plus PPUMASK emphasis bits (bits 6-8), see set_emphasis_output()
+
+    /*
+        Scanlines of the screen (and _screen9 with emphasis output enabled) which changed in the last frame, so presentation, scaling and
+        capture can skip the lines that didn't. Updated at the end of the visible frame. With rendering deferred the PPU draws nothing
+        itself and DeferredRenderer::present() hands back the lines of each frame it presents instead. Everything is marked dirty on
+        reset, consumers which have their own reasons to redraw (e.g. a back buffer older than one frame) need to accumulate it.
+    */
+    std::bitset<240> _dirty_lines;
 
 private:
+    friend class DeferredRenderer;
+    friend class PpuViewer;
+
     union PpuCtrlRegister
     {
         uint8_t reg;
@@ -85,6 +169,7 @@ private:
         uint8_t pattern_hi;
         uint8_t attributes;
         uint8_t x_position;
+        uint8_t oam_index;
     };
 
 
@@ -92,8 +177,24 @@ private:
     std::array<uint8_t, 0x800> _ram;
     std::array<uint8_t, 0x100> _oam;
     std::array<uint8_t, 0x20> _secondary_oam;
+    std::array<uint8_t, 8> _secondary_oam_index; // OAM entry each secondary OAM sprite was copied from
     std::array<uint8_t, 0x20> _palette;
 
+    /*
+        Palette index (attribute bits) for every tile of the two nametables in _ram, kept up to date as attribute bytes are written, and
+        which of them each of the four logical nametables is currently mapped to.
+    */
+    std::array<std::array<uint8_t, 960>, 2> _attribute_cache;
+    std::array<uint8_t, 4> _nametable_map;
+
+    /*
+        When a deferred renderer is attached pixel output is left to it and everything affecting rendering is recorded instead. The
+        renderer's own copies of the PPU have no game pak, they read pattern data from a snapshot of CHR memory through a bank map.
+    */
+    DeferredRenderer* _deferred_renderer = nullptr;
+    const uint8_t* _chr = nullptr;
+    std::array<uint32_t, 8> _chr_banks{};
+
 
     // Registers
     PpuCtrlRegister _ppuctrl;
@@ -143,8 +244,58 @@ private:
     uint16_t _cycle;
     uint8_t _state_flags;
     uint8_t _nmi;
-
-
+    bool _emphasis_output = false;
+    uint8_t _burst_phase; // Colour burst phase at the start of the frame (in units of 4 of the 12 subcarrier phases)
+    uint16_t _line_changes; // Bits which differed between the pixels output on the current scanline and the ones they replaced
+    std::bitset<240> _frame_dirty_lines;
+    RenderTarget _render_target;
+    RenderTarget _next_render_target;
+
+
+    void update_nametable_map();
+    void update_attribute_cache(uint16_t address);
+    void rebuild_attribute_cache();
+    void output_pixel(uint16_t x, uint8_t color);
+    void output_layers(uint16_t x, uint8_t background, uint8_t sprite, uint8_t priority, uint8_t oam_index);
+    void output_backdrop(uint16_t x, uint16_t count);
+    void idle_span(uint16_t count);
     uint8_t read(uint16_t address);
     void write(uint16_t address, uint8_t value);
 };
+
+
+struct gli2C02::State
+{
+    std::array<uint8_t, 0x800> ram;
+    std::array<uint8_t, 0x100> oam;
+    std::array<uint8_t, 0x20> secondary_oam;
+    std::array<uint8_t, 8> secondary_oam_index;
+    std::array<uint8_t, 0x20> palette;
+    std::array<SpriteOutputUnit, 8> sprite_output_units;
+    uint64_t clocks;
+    uint32_t frame;
+    uint16_t ppuaddr;
+    uint16_t temp_vram_address;
+    uint16_t bl_shift;
+    uint16_t bh_shift;
+    uint16_t al_shift;
+    uint16_t ah_shift;
+    int16_t scanline;
+    uint16_t cycle;
+    PpuCtrlRegister ppuctrl;
+    PpuMaskRegister ppumask;
+    PpuStatusRegister ppustatus;
+    uint8_t oamaddr;
+    uint8_t ppudatabuffer;
+    uint8_t fine_x_scroll;
+    uint8_t address_latch;
+    uint8_t nt_latch;
+    uint8_t bl_latch;
+    uint8_t bh_latch;
+    uint8_t attribute_latch;
+    uint8_t active_sprites;
+    uint8_t sprite_zero_visible;
+    uint8_t state_flags;
+    uint8_t nmi;
+    uint8_t burst_phase;
+};
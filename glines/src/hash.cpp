@@ -0,0 +1,108 @@
+#include "hash.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+static constexpr size_t StripeSize = 64;
+static constexpr int Lanes = 8;
+
+static constexpr uint64_t InitialKeys[Lanes] =
+{
+    0x9E3779B185EBCA87ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x85EBCA77C2B2AE63ull,
+    0x27D4EB2F165667C5ull, 0xFF51AFD7ED558CCDull, 0xC4CEB9FE1A85EC53ull, 0x9FB21C651E98DF25ull,
+};
+
+static constexpr uint64_t KeyStep = 0x2545F4914F6CDD1Dull;
+
+
+static void accumulate(uint64_t* acc, uint64_t* keys, const uint8_t* stripe)
+{
+    for (int lane = 0; lane < Lanes; ++lane)
+    {
+        uint64_t data;
+        memcpy(&data, stripe + lane * 8, 8);
+        uint64_t keyed = data ^ keys[lane];
+        acc[lane] += data + (keyed & 0xFFFFFFFF) * (keyed >> 32);
+        keys[lane] += KeyStep;
+    }
+}
+
+
+static uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+
+uint64_t hash64(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t acc[Lanes];
+    uint64_t keys[Lanes];
+    size_t stripes = size / StripeSize;
+    size_t i = 0;
+
+    for (int lane = 0; lane < Lanes; ++lane)
+    {
+        acc[lane] = seed;
+        keys[lane] = InitialKeys[lane];
+    }
+
+#if defined(__AVX2__)
+    __m256i acc0 = _mm256_loadu_si256((const __m256i*)acc);
+    __m256i acc1 = _mm256_loadu_si256((const __m256i*)(acc + 4));
+    __m256i key0 = _mm256_loadu_si256((const __m256i*)keys);
+    __m256i key1 = _mm256_loadu_si256((const __m256i*)(keys + 4));
+    const __m256i step = _mm256_set1_epi64x((long long)KeyStep);
+
+    for (; i < stripes; ++i)
+    {
+        __m256i d0 = _mm256_loadu_si256((const __m256i*)(bytes + i * StripeSize));
+        __m256i d1 = _mm256_loadu_si256((const __m256i*)(bytes + i * StripeSize + 32));
+        __m256i k0 = _mm256_xor_si256(d0, key0);
+        __m256i k1 = _mm256_xor_si256(d1, key1);
+        acc0 = _mm256_add_epi64(acc0, _mm256_add_epi64(d0, _mm256_mul_epu32(k0, _mm256_srli_epi64(k0, 32))));
+        acc1 = _mm256_add_epi64(acc1, _mm256_add_epi64(d1, _mm256_mul_epu32(k1, _mm256_srli_epi64(k1, 32))));
+        key0 = _mm256_add_epi64(key0, step);
+        key1 = _mm256_add_epi64(key1, step);
+    }
+
+    _mm256_storeu_si256((__m256i*)acc, acc0);
+    _mm256_storeu_si256((__m256i*)(acc + 4), acc1);
+    _mm256_storeu_si256((__m256i*)keys, key0);
+    _mm256_storeu_si256((__m256i*)(keys + 4), key1);
+#endif
+
+    for (; i < stripes; ++i)
+    {
+        accumulate(acc, keys, bytes + i * StripeSize);
+    }
+
+    size_t tail = size - stripes * StripeSize;
+
+    if (tail)
+    {
+        // Zero padded, the length is mixed in at the end so padding can't collide with real zeroes
+        uint8_t stripe[StripeSize] = {};
+        memcpy(stripe, bytes + stripes * StripeSize, tail);
+        accumulate(acc, keys, stripe);
+    }
+
+    uint64_t h = mix(seed ^ (uint64_t(size) * 0x9E3779B185EBCA87ull));
+
+    for (int lane = 0; lane < Lanes; ++lane)
+    {
+        h = mix(h ^ acc[lane]) + InitialKeys[lane];
+    }
+
+    return mix(h);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+    Fast 64-bit hash for checking frames and memory for changes, not for anything security related.
+
+    Data is processed in 64 byte stripes across 8 independent 64-bit lanes, each lane accumulating the data plus the 32x32 bit product
+    of its two halves mixed with a key which changes every stripe (so reordered data hashes differently). The AVX2 build and the plain
+    build produce the same hashes, golden hash files can be shared between them.
+*/
+uint64_t hash64(const void* data, size_t size, uint64_t seed = 0);
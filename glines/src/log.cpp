@@ -2,10 +2,13 @@
 
 #include <vector>
 #include <cstdarg>
+#include <cstdio>
 
+#if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
 #include <Windows.h>
+#endif
 
 
 void logf(const char* format, ...)
@@ -14,6 +17,8 @@ void logf(const char* format, ...)
     static char log_buffer[log_buffer_size];
     std::va_list args;
     va_start(args, format);
+    std::va_list retry_args;
+    va_copy(retry_args, args);
     int len = std::vsnprintf(log_buffer, log_buffer_size, format, args);
     va_end(args);
 
@@ -23,14 +28,21 @@ void logf(const char* format, ...)
     }
     else
     {
+        // The arguments have been used up, formatting again needs its own copy of them
         std::vector<char> buffer(len + 1);
-        std::vsnprintf(buffer.data(), buffer.size(), format, args);
+        std::vsnprintf(buffer.data(), buffer.size(), format, retry_args);
         logm(buffer.data());
     }
+
+    va_end(retry_args);
 }
 
 
 void logm(const char* message)
 {
+#if defined(_WIN32)
     OutputDebugStringA(message);
+#else
+    fputs(message, stderr);
+#endif
 }
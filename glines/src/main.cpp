@@ -2,14 +2,16 @@
 
 #include <algorithm>
 #include <array>
-#include <functional>
+#include <bitset>
 #include <vector>
 
+#include "audio_output.h"
 #include "bits.h"
-#include "gamepak.h"
-#include "gli2a03.h"
-#include "gli2c02.h"
+#include "deferred_renderer.h"
+#include "event_log.h"
+#include "nes.h"
 #include "ntsc_palette.h"
+#include "ppu_viewer.h"
 #include "vga9.h"
 
 class GliNes : public Vgfw
@@ -25,194 +27,70 @@ public:
     static constexpr int WindowWidth = 16 + (DisplayWidth * DisplayScale) + 16 + InspectorWidth + 16;
     static constexpr int WindowHeight = 16 + std::max(DisplayHeight * DisplayScale, InspectorHeight) + 16;
 
+    static constexpr uint32_t AudioSampleRate = 48000;
+
 
     bool on_create() override
     {
         set_palette(ntsc_palette, sizeof(ntsc_palette));
-        _cpu.connect(std::bind(&GliNes::read, this, std::placeholders::_1), std::bind(&GliNes::write, this, std::placeholders::_1, std::placeholders::_2));
-        reset(true);
-        return true;
-    }
+        _ppu_viewer = std::make_unique<PpuViewer>();
 
+        // Carry on without sound if there's no output device
+        _audio = std::make_unique<AudioOutput>(std::make_unique<WaveOutAudioSink>(), AudioSampleRate);
 
-    void on_destroy() override
-    {
+        if (!_audio->start())
+            _audio = nullptr;
 
+        _nes._apu.set_sample_rate(_audio ? AudioSampleRate : 0);
+        reset(true);
+        return true;
     }
 
 
-    gli2A03 _cpu;
-    gli2C02 _ppu;
-    std::shared_ptr<GamePak> _game_pak;
-    uint8_t _ram[2 * 1024];
-
-
-    // Bus
-    enum CpuMemoryMap
-    {
-        RAM_BASE = 0x0000,
-        RAM_TOP = 0x1FFF,
-        PPU_REG_BASE = 0x2000,
-        PPU_REG_TOP = 0x3FFF,
-        APU_IO_BASE = 0x4000,
-        OAMDMA = 0x4014,
-        JOY1 = 0x4016,
-        JOY2 = 0x4017,
-        APU_IO_TOP = 0x401F,
-        CART_BASE = 0x4020,
-    };
-
-    struct ControllerState
-    {
-        uint8_t latch;
-
-        union
-        {
-            uint8_t buttons;
-
-            struct
-            {
-                uint8_t right : 1;
-                uint8_t left : 1;
-                uint8_t down : 1;
-                uint8_t up : 1;
-                uint8_t start : 1;
-                uint8_t select : 1;
-                uint8_t b : 1;
-                uint8_t a : 1;
-            };
-        };
-    };
-
-    ControllerState joy1{};
-    ControllerState joy2{};
-
-    uint8_t read(uint16_t address)
+    void on_destroy() override
     {
-        uint8_t value = 0; // TODO: open bus behavior (make this static)
-
-        if (address <= CpuMemoryMap::RAM_TOP)
-        {
-            address = CpuMemoryMap::RAM_BASE + (address & 0x7FF);
-            value = _ram[address];
-        }
-        else if (address <= CpuMemoryMap::PPU_REG_TOP)
-        {
-            value = _ppu.cpu_read(address);
-        }
-        else if (address <= CpuMemoryMap::APU_IO_TOP)
-        {
-            if (address == JOY1)
-            {
-                set_bit(value, 0, get_bit(joy1.latch, 7));
-                joy1.latch <<= 1;
-            }
-            else if (address == JOY2)
-            {
-                set_bit(value, 0, get_bit(joy2.latch, 7));
-                joy2.latch <<= 1;
-            }
-        }
-        else if (_game_pak)
-        {
-            value = _game_pak->cpu_read(address);
-        }
-
-        return value;
+        _audio = nullptr;
     }
 
 
-    void write(uint16_t address, uint8_t value)
-    {
-        if (address <= CpuMemoryMap::RAM_TOP)
-        {
-            address = CpuMemoryMap::RAM_BASE + (address & 0x7FF);
-            _ram[address] = value;
-        }
-        else if (address <= CpuMemoryMap::PPU_REG_TOP)
-        {
-            _ppu.cpu_write(address, value);
-        }
-        else if (address <= CpuMemoryMap::APU_IO_TOP)
-        {
-            if (address == OAMDMA)
-            {
-                _cpu.dma(value);
-            }
-            else if (address == JOY1)
-            {
-                if ((value & 1)== 0)
-                {
-                    // latch controller values
-                    joy1.latch = joy1.buttons;
-                    joy2.latch = joy2.buttons;
-                }
-            }
-        }
-        else if (_game_pak)
-        {
-            _game_pak->cpu_write(address, value);
-        }
-    }
-
+    Nes _nes;
+    std::unique_ptr<DeferredRenderer> _renderer;
+    std::unique_ptr<PpuViewer> _ppu_viewer;
+    std::unique_ptr<EventLog> _event_log;
+    std::unique_ptr<AudioOutput> _audio;
+    std::vector<EventLog::Event> timeline_events;
 
-    // System
-    uint32_t _system_clock = 0;
+    // TV display lines which need redrawing in each of the two back buffers, they alternate every update
+    std::bitset<DisplayHeight> _stale_lines[2];
+    int _backbuffer = 0;
+    uint32_t _dirty_frame = ~0u;
 
 
     void reset(bool coldstart)
     {
-        _cpu.reset(coldstart);
-        _ppu.reset(coldstart);
-
-        if (_game_pak)
-            _game_pak->reset(coldstart);
-
-        _system_clock = 0;
+        _nes.reset(coldstart);
         run_emulation = false;
-        joy1.latch = 0;
-        joy2.latch = 0;
-        memset(_ppu._screen.data(), 0, _ppu._screen.size());
+        _stale_lines[0].set();
+        _stale_lines[1].set();
     }
 
 
-    void clock()
+    bool load_game_pak(const std::string& path)
     {
-        _system_clock++;
-
-        if ((_system_clock % 3) == 0)
-        {
-            _cpu.clock();
-        }
-
-        _ppu.clock();
-
-        if (_ppu.nmi())
-        {
-            _cpu.nmi();
-            _ppu.clear_nmi();
-        }
+        return _nes.load_game_pak(path);
     }
 
 
-    // Cart
-    bool load_game_pak(const std::string& path)
+    // The frame's audio goes to the output, which steers the rate of the next frame's to keep its buffer level
+    void run_frame()
     {
-        _game_pak = std::make_shared<GamePak>();
-
-        if (!_game_pak->load(path))
-        {
-            _game_pak = nullptr;
-        }
+        _nes.run_frame();
 
-        if (_game_pak)
+        if (_audio)
         {
-            _game_pak->connect(&_cpu, &_ppu);
+            _audio->write(_nes._apu.samples());
+            _nes._apu.set_rate_adjust(_audio->rate_adjust());
         }
-
-        _ppu.connect_game_pak(_game_pak);
-
-        return !!_game_pak;
     }
 
 
@@ -242,6 +120,31 @@ public:
             palette = (palette + 1) & 0x7;
         }
 
+        if (m_keys[VK_F8].pressed)
+        {
+            if (_renderer)
+            {
+                _renderer = nullptr;
+            }
+            else
+            {
+                _renderer = std::make_unique<DeferredRenderer>();
+                _renderer->attach(_nes._ppu);
+            }
+        }
+
+        if (m_keys[VK_F9].pressed)
+        {
+            // Event logging is only enabled while the timeline is shown
+            _event_log = _event_log ? nullptr : std::make_unique<EventLog>(_nes._cpu, _nes._ppu);
+            _nes.connect_event_log(_event_log.get());
+        }
+
+        if (_event_log && (m_keys[VK_LCONTROL].down || m_keys[VK_RCONTROL].down) && m_keys['E'].pressed)
+        {
+            _event_log->save("events.bin");
+        }
+
         if (m_keys[VK_OEM_3].pressed)
         {
             reset(m_keys[VK_LCONTROL].down);
@@ -255,56 +158,91 @@ public:
 
             if (run_emulation)
             {
-                joy1.right = m_keys[VK_RIGHT].down;
-                joy1.left = m_keys[VK_LEFT].down;
-                joy1.up = m_keys[VK_UP].down;
-                joy1.down = m_keys[VK_DOWN].down;
-                joy1.start = m_keys['V'].down;
-                joy1.select = m_keys['B'].down;
-                joy1.a = m_keys['Z'].down;
-                joy1.b = m_keys['X'].down;
+                _nes.joy1.right = m_keys[VK_RIGHT].down;
+                _nes.joy1.left = m_keys[VK_LEFT].down;
+                _nes.joy1.up = m_keys[VK_UP].down;
+                _nes.joy1.down = m_keys[VK_DOWN].down;
+                _nes.joy1.start = m_keys['V'].down;
+                _nes.joy1.select = m_keys['B'].down;
+                _nes.joy1.a = m_keys['Z'].down;
+                _nes.joy1.b = m_keys['X'].down;
 
                 accumulated_time += delta;
 
-                if (accumulated_time > 1.0f / 60.0f)
+                if (accumulated_time > _nes.frame_time())
                 {
-                    accumulated_time -= 1.0f / 60.0f;
-
-                    uint32_t f = _ppu.frame_number();
-
-                    do
-                    {
-                        clock();
-                    } while (_ppu.frame_number() == f);
+                    accumulated_time -= _nes.frame_time();
+                    run_frame();
                 }
             }
             else if (m_keys[VK_F11].pressed)
             {
-                uint16_t pc = _cpu._pc;
+                _nes.step_instruction();
 
-                do
-                {
-                    clock();
-                } while (!_cpu._stopped && (_cpu._pc == pc));
+                // The screen changes mid-frame while stepping
+                _stale_lines[0].set();
+                _stale_lines[1].set();
             }
             else if (m_keys[VK_F10].pressed)
             {
-                uint32_t f = _ppu.frame_number();
+                run_frame();
+            }
+        }
 
-                do
-                {
-                    clock();
-                } while (_ppu.frame_number() == f);
+        if (_renderer)
+        {
+            // Frames are rendered in the background, show the one before last so emulation doesn't wait on the renderer
+            std::bitset<DisplayHeight> dirty_lines;
+
+            if (_renderer->present(_nes._ppu.frame_number() - 2, _nes._ppu, dirty_lines))
+            {
+                _stale_lines[0] |= dirty_lines;
+                _stale_lines[1] |= dirty_lines;
             }
         }
 
-        clear_screen(0);
+        if (_nes._ppu.frame_number() != _dirty_frame)
+        {
+            _dirty_frame = _nes._ppu.frame_number();
+            _stale_lines[0] |= _nes._ppu._dirty_lines;
+            _stale_lines[1] |= _nes._ppu._dirty_lines;
+        }
+
+        // Clear around the TV display, it's only redrawn where it changed
+        int display_right = 16 + DisplayWidth * DisplayScale;
+        int display_bottom = 16 + DisplayHeight * DisplayScale;
+        clear_rect(0, 0, WindowWidth, 16, 0);
+        clear_rect(0, 16, 16, DisplayHeight * DisplayScale, 0);
+        clear_rect(display_right, 16, WindowWidth - display_right, DisplayHeight * DisplayScale, 0);
+        clear_rect(0, display_bottom, WindowWidth, WindowHeight - display_bottom, 0);
 
         // TV display
-        copy_rect_scaled(16, 16, DisplayWidth * DisplayScale, DisplayHeight * DisplayScale, _ppu._screen.data(), 256, DisplayScale);
+        std::bitset<DisplayHeight>& stale_lines = _stale_lines[_backbuffer];
+
+        for (int line = 0; line < DisplayHeight; ++line)
+        {
+            if (stale_lines[line])
+            {
+                copy_rect_scaled(16, 16 + line * DisplayScale, DisplayWidth * DisplayScale, DisplayScale, _nes._ppu._screen.data() + line * 256, 256,
+                    DisplayScale);
+            }
+        }
+
+        stale_lines.reset();
+        _backbuffer ^= 1;
+
+        int inspector_x = 16 + (DisplayWidth * DisplayScale) + 16;
 
-        // TODO: Add support for peeking at memory without causing the read side effects (e.g. reading $2002 modifying PPU state, reading
-        // pattern memory clocking the IRQ counter in MMC3 mapper..)
+        if (_event_log)
+        {
+            draw_event_timeline(inspector_x, 16);
+        }
+        else
+        {
+            draw_ppu_inspector(inspector_x, 16);
+        }
+
+        // TODO: Add support for peeking at CPU memory without causing the read side effects (e.g. reading $2002 modifying PPU state)
 #if 0
         // Dump RAM
         int ram_dump_x = 16 + (DisplayWidth * DisplayScale) + 16;
@@ -329,7 +267,7 @@ public:
                 if ((mem_ptr + p) >= 0x2000 && (mem_ptr + p) <= 0x3FFF)
                     memp[p] = 0;
                 else
-                    memp[p] = read(mem_ptr + p);
+                    memp[p] = _nes.read(mem_ptr + p);
 
                 memc[p] = (memp[p] >= 0x20 && memp[p] <= 0X7F) ? (char)memp[p] : '.';
             }
@@ -354,55 +292,111 @@ public:
         int cpu_x = cpu_state_x + 8;
         int cpu_y = cpu_state_y + 8;
 
-        std::string dissassembly = _cpu.disassemble(_cpu._pc);
-        format_string(cpu_x, cpu_y, (const int*)vga9_glyphs, vga9_glyph_width, vga9_glyph_height, 0x20, 2, "    PC: %04X  %s", _cpu._pc, dissassembly.c_str());
+        std::string dissassembly = _nes._cpu.disassemble(_nes._cpu._pc);
+        format_string(cpu_x, cpu_y, (const int*)vga9_glyphs, vga9_glyph_width, vga9_glyph_height, 0x20, 2, "    PC: %04X  %s", _nes._cpu._pc, dissassembly.c_str());
         cpu_y += vga9_glyph_height;
 
-        format_string(cpu_x, cpu_y, (const int*)vga9_glyphs, vga9_glyph_width, vga9_glyph_height, 0x20, 2, "     A: %02X  X: %02X  Y: %02X  SP: %02X", _cpu._a, _cpu._x, _cpu._y, _cpu._s);
+        format_string(cpu_x, cpu_y, (const int*)vga9_glyphs, vga9_glyph_width, vga9_glyph_height, 0x20, 2, "     A: %02X  X: %02X  Y: %02X  SP: %02X", _nes._cpu._a, _nes._cpu._x, _nes._cpu._y, _nes._cpu._s);
         cpu_y += vga9_glyph_height;
 
         auto bit = [](uint8_t byte, int bit) -> char { return ((byte >> bit) & 1) ? '1' : '-'; };
         format_string(cpu_x, cpu_y, (const int*)vga9_glyphs, vga9_glyph_width, vga9_glyph_height, 0x20, 2, "        N V   B D I Z C");
         cpu_y += vga9_glyph_height;
         format_string(cpu_x, cpu_y, (const int*)vga9_glyphs, vga9_glyph_width, vga9_glyph_height, 0x20, 2, "Status: %c %c   %c %c %c %c %c %s",
-            bit(_cpu._p, 7), bit(_cpu._p, 6), bit(_cpu._p, 4), bit(_cpu._p, 3), bit(_cpu._p, 2), bit(_cpu._p, 1), bit(_cpu._p, 0), _cpu._stopped ? "** STOPPED **" : "");
+            bit(_nes._cpu._p, 7), bit(_nes._cpu._p, 6), bit(_nes._cpu._p, 4), bit(_nes._cpu._p, 3), bit(_nes._cpu._p, 2), bit(_nes._cpu._p, 1), bit(_nes._cpu._p, 0), _nes._cpu._stopped ? "** STOPPED **" : "");
         cpu_y += vga9_glyph_height;
 
-        // Pattern table 1
-        int pattern_table_x = ram_dump_x;
-        int pattern_table_y = cpu_y + 16;
+#endif
+
+        return true;
+    }
+
+
+    void draw_ppu_inspector(int inspector_x, int inspector_y)
+    {
+        _ppu_viewer->update(_nes._ppu, palette);
 
-        std::array<uint8_t, 0x4000> pattern_table;
-        _ppu.get_pattern_table(0, palette, pattern_table);
-        copy_rect_scaled(pattern_table_x, pattern_table_y, 256, 256, pattern_table.data(), 128, 2);
+        int pattern_table_y = inspector_y;
 
-        // Pattern table 2
-        _ppu.get_pattern_table(1, palette, pattern_table);
-        copy_rect_scaled(pattern_table_x + 256 + 16, pattern_table_y, 256, 256, pattern_table.data(), 128, 2);
+        for (uint8_t table = 0; table < 2; ++table)
+        {
+            copy_rect_scaled(inspector_x + table * (256 + 16), pattern_table_y, 256, 256, _ppu_viewer->pattern_table(table).data(),
+                PpuViewer::PatternTableSize, 2);
+        }
 
-        // Palettes
-        int palette_x = ram_dump_x;
+        const std::array<uint8_t, 0x20>& ppu_palette = _ppu_viewer->palette();
         int palette_y = pattern_table_y + 256 + 16;
 
         for (uint8_t column = 0; column < 4; ++column)
         {
-            int palette_x = ram_dump_x + (144 * column);
+            int palette_x = inspector_x + (144 * column);
 
             for (uint8_t row = 0; row < 2; ++row)
             {
-                int palette_y = pattern_table_y + 256 + 16 + row * 32;
-                std::array<uint8_t, 4> palette;
-                _ppu.get_palette(column + row * 4, palette);
+                uint8_t palette_index = column + row * 4;
 
                 for (uint8_t c = 0; c < 4; ++c)
                 {
-                    fill_rect(palette_x + (c * 20), palette_y, 16, 16, 1, palette[c], palette[c]);
+                    uint8_t color = ppu_palette[(palette_index << 2) | c];
+                    fill_rect(palette_x + (c * 20), palette_y + row * 32, 16, 16, 1, color, color);
                 }
             }
         }
-#endif
 
-        return true;
+        int nametable_y = palette_y + 64 + 16;
+        copy_rect(inspector_x, nametable_y, PpuViewer::NametableWidth, PpuViewer::NametableHeight, _ppu_viewer->nametables().data(),
+            PpuViewer::NametableWidth);
+        copy_rect_scaled(inspector_x + PpuViewer::NametableWidth + 16, nametable_y, PpuViewer::SpriteSheetWidth * 2, PpuViewer::SpriteSheetHeight * 2,
+            _ppu_viewer->sprites().data(), PpuViewer::SpriteSheetWidth, 2);
+    }
+
+
+    void draw_event_timeline(int timeline_x, int timeline_y)
+    {
+        /*
+            The last complete frame, one pixel pair per dot: the pre-render scanline is at the top and the visible picture is the lighter
+            area. Events are marked on the dot they happened on and listed underneath.
+        */
+        static constexpr uint8_t EventColors[] = { 0x2A, 0x27, 0x21, 0x16, 0x25, 0x28 };
+        static const char* EventNames[] = { "PPU", "DMA", "Mapper", "IRQ", "IRQ ack", "NMI" };
+
+        uint32_t frame = _nes._ppu.frame_number() - 1;
+        _event_log->frame_events(frame, timeline_events);
+
+        // 262 scanlines for NTSC, 312 for PAL and Dendy
+        int height = _nes.scanlines() * 2;
+        fill_rect(timeline_x, timeline_y, 341 * 2, height, 0, 0x0F, 0x0F);
+        fill_rect(timeline_x, timeline_y + 2, 256 * 2, 240 * 2, 0, 0x2D, 0x2D);
+
+        for (const EventLog::Event& event : timeline_events)
+        {
+            uint8_t color = EventColors[uint8_t(event.type)];
+            fill_rect(timeline_x + event.dot * 2, timeline_y + (event.scanline + 1) * 2, 2, 2, 0, color, color);
+        }
+
+        int legend_y = timeline_y + height + 8;
+        int legend_x = timeline_x;
+
+        for (uint8_t type = 0; type < 6; ++type)
+        {
+            fill_rect(legend_x, legend_y + 4, 8, 8, 0, EventColors[type], EventColors[type]);
+            draw_string(legend_x + 12, legend_y, EventNames[type], (const int*)vga9_glyphs, vga9_glyph_width, vga9_glyph_height, 0x30, 0x0F);
+            legend_x += 12 + (int)strlen(EventNames[type]) * vga9_glyph_width + 16;
+        }
+
+        int list_y = legend_y + vga9_glyph_height + 8;
+        format_string(timeline_x, list_y, (const int*)vga9_glyphs, vga9_glyph_width, vga9_glyph_height, 0x30, 0x0F, "Frame %u: %u events",
+            frame, (uint32_t)timeline_events.size());
+        list_y += vga9_glyph_height;
+
+        for (size_t i = 0; i < timeline_events.size() && list_y + vga9_glyph_height <= timeline_y + InspectorHeight; ++i)
+        {
+            const EventLog::Event& event = timeline_events[i];
+            format_string(timeline_x, list_y, (const int*)vga9_glyphs, vga9_glyph_width, vga9_glyph_height, 0x30, 0x0F,
+                "%4d:%3u  CPU %-10llu  %-8s $%04X = $%02X", event.scanline, event.dot, (unsigned long long)event.cpu_cycle,
+                EventNames[uint8_t(event.type)], event.address, event.value);
+            list_y += vga9_glyph_height;
+        }
     }
 };
 
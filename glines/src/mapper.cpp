@@ -37,3 +37,9 @@ gli2C02* Mapper::ppu()
 {
     return _game_pak._ppu;
 }
+
+
+EventLog* Mapper::event_log()
+{
+    return _game_pak._event_log;
+}
@@ -1,8 +1,12 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 
+class EventLog;
 class gli2A03;
 class gli2C02;
 class GamePak;
@@ -10,6 +14,15 @@ class GamePak;
 class Mapper
 {
 public:
+    static constexpr size_t PrgRamSize = 0x2000;
+
+    // The mapper's registers as plain data (see Nes::State), each mapper packs its own layout into it
+    struct State
+    {
+        std::array<uint8_t, 32> registers;
+    };
+
+
     Mapper(GamePak& game_pak)
         : _game_pak{ game_pak } {}
 
@@ -21,15 +34,45 @@ public:
     virtual bool ppu_read(uint16_t address, uint8_t& value) = 0;
     virtual bool ppu_write(uint16_t address, uint8_t value) = 0;
 
+    // Read without side effects (e.g. clocking IRQ counters), mappers whose reads have side effects must override this
+    virtual bool ppu_peek(uint16_t address, uint8_t& value) { return ppu_read(address, value); }
+
     virtual bool ppu_remap_address(uint16_t& address) { return false;  }
 
+    // Offsets into CHR memory of the 1KB banks currently mapped to $0000-$1FFF, used to render pattern data away from the mapper
+    virtual bool ppu_chr_banks(std::array<uint32_t, 8>& banks) { return false; }
+
+    // True while an IRQ counter clocked by the PPU's memory accesses can interrupt the CPU, the PPU can't fall behind the CPU then
+    virtual bool ppu_clocked_irq() const { return false; }
+
+    virtual void save_state(State& state) const {}
+    virtual void load_state(const State& state) {}
+
+    // The PrgRamSize bytes of RAM at $6000-$7FFF, nullptr if the board has none
+    virtual uint8_t* prg_ram() { return nullptr; }
+
 protected:
     GamePak& _game_pak;
 
+    template <class Registers>
+    static void pack(State& state, const Registers& registers)
+    {
+        static_assert(sizeof(Registers) <= sizeof(State::registers), "Mapper registers don't fit in Mapper::State");
+        memcpy(state.registers.data(), &registers, sizeof(registers));
+    }
+
+    template <class Registers>
+    static void unpack(const State& state, Registers& registers)
+    {
+        static_assert(sizeof(Registers) <= sizeof(State::registers), "Mapper registers don't fit in Mapper::State");
+        memcpy(&registers, state.registers.data(), sizeof(registers));
+    }
+
     std::array<char, 16>& header();
     std::vector<uint8_t>& prg_rom();
     std::vector<uint8_t>& chr_rom();
     uint8_t* prg_rom(uint8_t bank);
     gli2A03* cpu();
     gli2C02* ppu();
+    EventLog* event_log();
 };
@@ -12,5 +12,6 @@ public:
 
     bool ppu_read(uint16_t address, uint8_t& value) override;
     bool ppu_write(uint16_t address, uint8_t value) override;
+    bool ppu_chr_banks(std::array<uint32_t, 8>& banks) override;
 };
 
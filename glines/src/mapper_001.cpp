@@ -1,13 +1,16 @@
 #include "mapper_001.h"
 
 #include "bits.h"
+#include "event_log.h"
 
 
 Mapper_001::Mapper_001(GamePak& game_pak)
     : Mapper(game_pak)
 {
+    _control = 0;
     _prg_bank = 0;
     _chr_bank_0 = 0;
+    _chr_bank_1 = 0;
     reset(true);
 }
 
@@ -58,6 +61,7 @@ void Mapper_001::cpu_write(uint16_t address, uint8_t value)
         if (value & 0x80)
         {
             reset(false);
+            event_log() ? event_log()->record(EventLog::EventType::MapperWrite, address & 0xE000, value) : ((void)0);
         }
         else
         {
@@ -90,6 +94,7 @@ void Mapper_001::cpu_write(uint16_t address, uint8_t value)
                     update_prg_rom_mapping();
                 }
 
+                event_log() ? event_log()->record(EventLog::EventType::MapperWrite, address & 0xE000, _load) : ((void)0);
                 _load = 0x10;
             }
         }
@@ -137,7 +142,7 @@ bool Mapper_001::ppu_write(uint16_t address, uint8_t value)
 
 bool Mapper_001::ppu_remap_address(uint16_t& address)
 {
-    if (address >= 0x2000 && address < 0x2FFF)
+    if (address >= 0x2000 && address < 0x3000)
     {
         uint8_t mirroring = _control & 3;
         if (mirroring == 0)
@@ -169,6 +174,38 @@ bool Mapper_001::ppu_remap_address(uint16_t& address)
 }
 
 
+bool Mapper_001::ppu_chr_banks(std::array<uint32_t, 8>& banks)
+{
+    for (uint32_t bank = 0; bank < 4; ++bank)
+    {
+        banks[bank] = _x0000 + bank * 0x400;
+        banks[bank + 4] = _x1000 + bank * 0x400;
+    }
+
+    return true;
+}
+
+
+void Mapper_001::save_state(State& state) const
+{
+    pack(state, Registers{ _load, _control, _chr_bank_0, _chr_bank_1, _prg_bank });
+}
+
+
+void Mapper_001::load_state(const State& state)
+{
+    Registers registers;
+    unpack(state, registers);
+    _load = registers.load;
+    _control = registers.control;
+    _chr_bank_0 = registers.chr_bank_0;
+    _chr_bank_1 = registers.chr_bank_1;
+    _prg_bank = registers.prg_bank;
+    update_prg_rom_mapping();
+    update_chr_rom_mapping();
+}
+
+
 void Mapper_001::update_prg_rom_mapping()
 {
     uint8_t prg_mode = (_control >> 2) & 3;
@@ -208,4 +245,8 @@ void Mapper_001::update_chr_rom_mapping()
         _x0000 = _chr_bank_0 * 0x1000;
         _x1000 = _chr_bank_1 * 0x1000;
     }
+
+    // Bank numbers wrap around the CHR memory there is, e.g. 8KB of CHR RAM ignores the upper bits (SUROM uses them for PRG banking)
+    _x0000 %= chr_rom().size();
+    _x1000 %= chr_rom().size();
 }
@@ -15,13 +15,28 @@ public:
     bool ppu_read(uint16_t address, uint8_t& value) override;
     bool ppu_write(uint16_t address, uint8_t value) override;
     bool ppu_remap_address(uint16_t& address) override;
+    bool ppu_chr_banks(std::array<uint32_t, 8>& banks) override;
+
+    void save_state(State& state) const override;
+    void load_state(const State& state) override;
+    uint8_t* prg_ram() override { return _prg_ram.data(); }
 
 protected:
+    struct Registers
+    {
+        uint8_t load;
+        uint8_t control;
+        uint8_t chr_bank_0;
+        uint8_t chr_bank_1;
+        uint8_t prg_bank;
+    };
+
+
     void update_prg_rom_mapping();
     void update_chr_rom_mapping();
 
     // PRG RAM
-    std::array<uint8_t, 0x2000> _prg_ram;
+    std::array<uint8_t, 0x2000> _prg_ram{};
 
     // Registers
     uint8_t _load;
@@ -35,6 +50,6 @@ protected:
     uint32_t _xC000;
 
     // CHR ROM mapping
-    uint16_t _x0000;
-    uint16_t _x1000;
+    uint32_t _x0000;
+    uint32_t _x1000;
 };
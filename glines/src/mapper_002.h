@@ -11,7 +11,11 @@ public:
     void cpu_write(uint16_t address, uint8_t value) override;
     bool ppu_read(uint16_t address, uint8_t& value) override;
     bool ppu_write(uint16_t address, uint8_t value) override;
-    
+    bool ppu_chr_banks(std::array<uint32_t, 8>& banks) override;
+
+    void save_state(State& state) const override { pack(state, _prg_banks); }
+    void load_state(const State& state) override { unpack(state, _prg_banks); }
+
 public:
     uint8_t _prg_banks[2];
 }; 
@@ -46,3 +46,14 @@ bool Mapper_003::ppu_write(uint16_t address, uint8_t value)
 {
     return false;
 }
+
+
+bool Mapper_003::ppu_chr_banks(std::array<uint32_t, 8>& banks)
+{
+    for (uint32_t bank = 0; bank < 8; ++bank)
+    {
+        banks[bank] = _chr_bank * 0x2000 + bank * 0x400;
+    }
+
+    return true;
+}
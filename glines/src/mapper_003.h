@@ -11,6 +11,10 @@ public:
     void cpu_write(uint16_t address, uint8_t value) override;
     bool ppu_read(uint16_t address, uint8_t& value) override;
     bool ppu_write(uint16_t address, uint8_t value) override;
+    bool ppu_chr_banks(std::array<uint32_t, 8>& banks) override;
+
+    void save_state(State& state) const override { pack(state, _chr_bank); }
+    void load_state(const State& state) override { unpack(state, _chr_bank); }
 
 private:
     uint8_t _chr_bank = 0;
@@ -1,6 +1,7 @@
 #include "mapper_004.h"
 
 #include "bits.h"
+#include "event_log.h"
 #include "gli2a03.h"
 #include "gli2c02.h"
 
@@ -25,6 +26,29 @@ void Mapper_004::reset(bool coldstart)
 }
 
 
+void Mapper_004::save_state(State& state) const
+{
+    pack(state, Registers{ _last_ppu_clock_count, _bank_select_registers, _last_ppu_address, _bank_select, _irq_latch, _irq_reload,
+        _irq_counter, _irq_enabled, _mirroring });
+}
+
+
+void Mapper_004::load_state(const State& state)
+{
+    Registers registers;
+    unpack(state, registers);
+    _last_ppu_clock_count = registers.last_ppu_clock_count;
+    _bank_select_registers = registers.bank_select_registers;
+    _last_ppu_address = registers.last_ppu_address;
+    _bank_select = registers.bank_select;
+    _irq_latch = registers.irq_latch;
+    _irq_reload = registers.irq_reload;
+    _irq_counter = registers.irq_counter;
+    _irq_enabled = registers.irq_enabled;
+    _mirroring = registers.mirroring;
+}
+
+
 uint8_t Mapper_004::cpu_read(uint16_t address)
 {
     uint8_t value = 0;
@@ -80,6 +104,12 @@ uint8_t Mapper_004::cpu_read(uint16_t address)
 
 void Mapper_004::cpu_write(uint16_t address, uint8_t value)
 {
+    if (address >= 0x8000)
+    {
+        // Registers are selected by A13-A15 and A0
+        event_log() ? event_log()->record(EventLog::EventType::MapperWrite, address & 0xE001, value) : ((void)0);
+    }
+
     if (address >= 0x6000 && address < 0x8000)
     {
         _prg_ram[address & 0x1FFF] = value;
@@ -147,47 +177,9 @@ bool Mapper_004::ppu_read(uint16_t address, uint8_t& value)
         }
     }
 
-    /*
-        When $8000 & $80    is $00      is $80
-        PPU Bank            Value of MMC3 register
-        $0000-$03FF         R0          R2
-        $0400-$07FF         R0          R3
-        $0800-$0BFF         R1          R4
-        $0C00-$0FFF         R1          R5
-        $1000-$13FF         R2          R0
-        $1400-$17FF         R3          R0
-        $1800-$1BFF         R4          R1
-        $1C00-$1FFF         R5          R1
-    */
-
     if (address < 0x2000)
     {
-        uint8_t mode = get_bit(_bank_select, 7);
-        uint8_t register_index = 0;
-
-        if (address >= 0x0000 && address < 0x0400)
-            register_index = mode ? 2 : 0;
-        else if (address >= 0x0400 && address < 0x0800)
-            register_index = mode ? 3 : 0;
-        else if (address >= 0x0800 && address < 0x0C00)
-            register_index = mode ? 4 : 1;
-        else if (address >= 0x0C00 && address < 0x1000)
-            register_index = mode ? 5 : 1;
-        else if (address >= 0x1000 && address < 0x1400)
-            register_index = mode ? 0 : 2;
-        else if (address >= 0x1400 && address < 0x1800)
-            register_index = mode ? 0 : 3;
-        else if (address >= 0x1800 && address < 0x1C00)
-            register_index = mode ? 1 : 4;
-        else if (address >= 0x1C00 && address < 0x2000)
-            register_index = mode ? 1 : 5;
-
-        uint16_t bank_size = (register_index < 2) ? 0x800 : 0x400;
-        uint8_t bank = _bank_select_registers[register_index];
-        bank = (register_index < 2) ? (bank & 0xFE) : bank;
-        size_t rom_address = ((size_t)bank * 0x400) + (address & (bank_size - 1));
-        value = chr_rom()[rom_address];
-
+        value = read_chr(address);
         return true;
     }
 
@@ -201,6 +193,18 @@ bool Mapper_004::ppu_write(uint16_t address, uint8_t value)
 }
 
 
+bool Mapper_004::ppu_peek(uint16_t address, uint8_t& value)
+{
+    if (address < 0x2000)
+    {
+        value = read_chr(address);
+        return true;
+    }
+
+    return false;
+}
+
+
 bool Mapper_004::ppu_remap_address(uint16_t& address)
 {
     if (address >= 0x2000 && address < 0x3000)
@@ -228,6 +232,24 @@ bool Mapper_004::ppu_remap_address(uint16_t& address)
 }
 
 
+bool Mapper_004::ppu_chr_banks(std::array<uint32_t, 8>& banks)
+{
+    for (uint16_t bank = 0; bank < 8; ++bank)
+    {
+        banks[bank] = uint32_t(chr_offset(bank << 10));
+    }
+
+    return true;
+}
+
+
+bool Mapper_004::ppu_clocked_irq() const
+{
+    // The counter is clocked by A12 rising as the PPU fetches patterns, only the IRQ it raises is visible to the CPU
+    return _irq_enabled != 0;
+}
+
+
 void Mapper_004::clock_irq()
 {
     if (_irq_counter == 0 || _irq_reload)
@@ -241,3 +263,56 @@ void Mapper_004::clock_irq()
     if (_irq_counter == 0 && _irq_enabled)
         cpu()->irq();
 }
+
+
+uint8_t Mapper_004::read_chr(uint16_t address)
+{
+    return chr_rom()[chr_offset(address)];
+}
+
+
+size_t Mapper_004::chr_offset(uint16_t address)
+{
+    /*
+        When $8000 & $80    is $00      is $80
+        PPU Bank            Value of MMC3 register
+        $0000-$03FF         R0          R2
+        $0400-$07FF         R0          R3
+        $0800-$0BFF         R1          R4
+        $0C00-$0FFF         R1          R5
+        $1000-$13FF         R2          R0
+        $1400-$17FF         R3          R0
+        $1800-$1BFF         R4          R1
+        $1C00-$1FFF         R5          R1
+    */
+
+    uint8_t mode = get_bit(_bank_select, 7);
+    uint8_t register_index = 0;
+
+    if (address >= 0x0000 && address < 0x0400)
+        register_index = mode ? 2 : 0;
+    else if (address >= 0x0400 && address < 0x0800)
+        register_index = mode ? 3 : 0;
+    else if (address >= 0x0800 && address < 0x0C00)
+        register_index = mode ? 4 : 1;
+    else if (address >= 0x0C00 && address < 0x1000)
+        register_index = mode ? 5 : 1;
+    else if (address >= 0x1000 && address < 0x1400)
+        register_index = mode ? 0 : 2;
+    else if (address >= 0x1400 && address < 0x1800)
+        register_index = mode ? 0 : 3;
+    else if (address >= 0x1800 && address < 0x1C00)
+        register_index = mode ? 1 : 4;
+    else if (address >= 0x1C00 && address < 0x2000)
+        register_index = mode ? 1 : 5;
+
+    uint16_t bank_size = (register_index < 2) ? 0x800 : 0x400;
+    uint8_t bank = _bank_select_registers[register_index];
+    bank = (register_index < 2) ? (bank & 0xFE) : bank;
+
+    // Bank numbers wrap around the CHR memory there is (e.g. 8KB of CHR RAM only decodes the low 3 bits)
+    size_t offset = (size_t)bank * 0x400;
+    size_t chr_size = chr_rom().size();
+    offset = (offset < chr_size) ? offset : offset % chr_size;
+    return offset + (address & (bank_size - 1));
+}
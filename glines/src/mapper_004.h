@@ -14,9 +14,30 @@ public:
 
     bool ppu_read(uint16_t address, uint8_t& value) override;
     bool ppu_write(uint16_t address, uint8_t value) override;
+    bool ppu_peek(uint16_t address, uint8_t& value) override;
     bool ppu_remap_address(uint16_t& address) override;
+    bool ppu_chr_banks(std::array<uint32_t, 8>& banks) override;
+    bool ppu_clocked_irq() const override;
+
+    void save_state(State& state) const override;
+    void load_state(const State& state) override;
+    uint8_t* prg_ram() override { return _prg_ram.data(); }
 
 private:
+    struct Registers
+    {
+        uint64_t last_ppu_clock_count;
+        std::array<uint8_t, 8> bank_select_registers;
+        uint16_t last_ppu_address;
+        uint8_t bank_select;
+        uint8_t irq_latch;
+        uint8_t irq_reload;
+        uint8_t irq_counter;
+        uint8_t irq_enabled;
+        uint8_t mirroring;
+    };
+
+
     std::array<uint8_t, 0x2000> _prg_ram{};
     std::array<uint8_t, 8> _bank_select_registers{};
 
@@ -32,4 +53,6 @@ private:
 
 
     void clock_irq();
+    uint8_t read_chr(uint16_t address);
+    size_t chr_offset(uint16_t address);
 }; 
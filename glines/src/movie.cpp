@@ -0,0 +1,51 @@
+#include "movie.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+
+bool read_movie(const std::string& path, std::vector<MovieFrame>& movie)
+{
+    std::ifstream ifs(path);
+
+    if (!ifs)
+        return false;
+
+    std::string line;
+
+    while (std::getline(ifs, line))
+    {
+        // |commands|port0|port1|port2|
+        if (line.empty() || line[0] != '|')
+            continue;
+
+        std::vector<std::string> fields;
+        std::istringstream stream(line.substr(1));
+        std::string field;
+
+        while (std::getline(stream, field, '|'))
+        {
+            fields.push_back(field);
+        }
+
+        MovieFrame frame{};
+        frame.commands = fields.empty() ? 0 : uint8_t(atoi(fields[0].c_str()));
+
+        for (size_t port = 0; port < 2 && port + 1 < fields.size(); ++port)
+        {
+            // RLDUTSBA, the same order as the bits of the controller state
+            const std::string& buttons = fields[port + 1];
+
+            for (size_t bit = 0; bit < 8 && bit < buttons.size(); ++bit)
+            {
+                if (buttons[bit] != '.' && buttons[bit] != ' ')
+                    frame.buttons[port] |= 1 << bit;
+            }
+        }
+
+        movie.push_back(frame);
+    }
+
+    return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+    Input movies, one entry per frame to be applied before the frame is run.
+
+    Movies are read from FCEUX .fm2 files, only the input lines are used (commands for soft/hard reset and the gamepads in ports 0
+    and 1).
+*/
+struct MovieFrame
+{
+    uint8_t commands;   // 1: soft reset, 2: hard reset
+    uint8_t buttons[2];
+};
+
+
+bool read_movie(const std::string& path, std::vector<MovieFrame>& movie);
@@ -0,0 +1,463 @@
+#include "nes.h"
+
+#include "bits.h"
+#include "event_log.h"
+#include "gamepak.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+
+
+Nes::Nes()
+{
+    _cpu.connect(std::bind(&Nes::read, this, std::placeholders::_1), std::bind(&Nes::write, this, std::placeholders::_1, std::placeholders::_2));
+    _apu.connect(&_cpu, std::bind(&Nes::read, this, std::placeholders::_1));
+}
+
+
+template <class Timing>
+void Nes::dispatch()
+{
+    if (_scheduler.next_event() == Scheduler::Apu)
+    {
+        if (_cpu.cycle_count() >= _apu.next_event())
+            _apu.run();
+
+        schedule_apu<Timing>();
+    }
+    else
+    {
+        catch_up_ppu<Timing>(_scheduler.next_time() + 1);
+    }
+}
+
+
+template <class Timing>
+void Nes::catch_up_ppu(uint64_t time)
+{
+    // Runs the dots before the given master clock
+    if (time > _ppu_time + Timing::PpuDivider)
+    {
+        uint32_t clocks = uint32_t((time - _ppu_time - 1) / Timing::PpuDivider);
+        _ppu_time += uint64_t(clocks) * Timing::PpuDivider;
+
+        if (_ppu.rendering_enabled())
+        {
+            for (uint32_t i = 0; i < clocks; ++i)
+            {
+                _ppu.clock<Timing>();
+            }
+        }
+        else
+        {
+            _ppu.advance<Timing>(clocks);
+        }
+    }
+
+    if (_ppu.nmi())
+    {
+        _cpu.nmi();
+        _ppu.clear_nmi();
+    }
+
+    schedule_ppu<Timing>();
+}
+
+
+void Nes::catch_up_ppu()
+{
+    // The dot on the same master clock as the CPU's current cycle comes after it
+    switch (_region)
+    {
+        case Region::Ntsc:
+        {
+            catch_up_ppu<NtscTiming>(_cpu_time);
+            break;
+        }
+        case Region::Pal:
+        {
+            catch_up_ppu<PalTiming>(_cpu_time);
+            break;
+        }
+        case Region::Dendy:
+        {
+            catch_up_ppu<DendyTiming>(_cpu_time);
+            break;
+        }
+    }
+}
+
+
+template <class Timing>
+void Nes::schedule_ppu()
+{
+    /*
+        Nothing the PPU does is seen by the rest of the system until the CPU accesses it, vblank starts (NMI) or the next frame starts,
+        except for the IRQ of a mapper which counts the PPU's pattern fetches (MMC3). While that can fire the PPU is kept up with the
+        CPU, running the dots before each CPU cycle, as it is while events are being logged (they're recorded with its position).
+    */
+    if (_ppu_time >= _ppu_event_time)
+    {
+        // Where vblank and frame starts fall doesn't depend on anything the CPU can change, only reaching one moves it on
+        _ppu_event_time = _ppu_time + uint64_t(_ppu.idle_clocks<Timing>()) * Timing::PpuDivider;
+    }
+
+    uint64_t deadline = _ppu_event_time;
+
+    if (_ppu_lockstep)
+    {
+        // The last dot before the first CPU cycle after the next dot
+        uint64_t cpu_time = ((_ppu_time + Timing::PpuDivider) / Timing::CpuDivider + 1) * Timing::CpuDivider;
+        deadline = std::min(deadline, (cpu_time - 1) / Timing::PpuDivider * Timing::PpuDivider);
+    }
+
+    _scheduler.schedule(Scheduler::Ppu, deadline);
+}
+
+
+void Nes::update_ppu_lockstep()
+{
+    // Rendering being enabled, a mapper IRQ being enabled or the event log being connected can change it
+    _ppu_lockstep = _event_log || (_ppu.rendering_enabled() && _game_pak && _game_pak->ppu_clocked_irq());
+    _scheduler.schedule(Scheduler::Ppu, 0);
+}
+
+
+template <class Timing>
+void Nes::schedule_apu()
+{
+    // The APU counts CPU cycles, which stop while the CPU is halted. Its deadline is looked at again when reached in case they did.
+    uint64_t cycle = _cpu.cycle_count();
+    uint64_t cycles = _apu.next_event() > cycle ? std::min<uint64_t>(_apu.next_event() - cycle, UINT32_MAX) : 1;
+    _scheduler.schedule(Scheduler::Apu, _cpu_time + cycles * Timing::CpuDivider);
+}
+
+
+template <class Timing, class Predicate>
+void Nes::clock_region_while(Predicate predicate)
+{
+    do
+    {
+        uint64_t cpu_time = _cpu_time + Timing::CpuDivider;
+
+        if (_scheduler.next_time() < cpu_time)
+        {
+            dispatch<Timing>();
+        }
+        else
+        {
+            _cpu_time = cpu_time;
+            _cpu.clock();
+        }
+    } while (predicate());
+
+    // Finish the PPU dot the CPU stopped on
+    catch_up_ppu<Timing>(_cpu_time + Timing::PpuDivider);
+}
+
+
+template <class Predicate>
+void Nes::clock_while(Predicate predicate)
+{
+    // The region is only looked at once here, the clock loops themselves are specialized for it
+    switch (_region)
+    {
+        case Region::Ntsc:
+        {
+            clock_region_while<NtscTiming>(predicate);
+            break;
+        }
+        case Region::Pal:
+        {
+            clock_region_while<PalTiming>(predicate);
+            break;
+        }
+        case Region::Dendy:
+        {
+            clock_region_while<DendyTiming>(predicate);
+            break;
+        }
+    }
+}
+
+
+bool Nes::load_game_pak(const std::string& path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    return load_game_pak(ifs);
+}
+
+
+bool Nes::load_game_pak(std::istream& is)
+{
+    _game_pak = std::make_shared<GamePak>();
+
+    if (!_game_pak->load(is))
+    {
+        _game_pak = nullptr;
+    }
+
+    if (_game_pak)
+    {
+        _game_pak->connect(&_cpu, &_ppu);
+        _game_pak->connect_event_log(_event_log);
+    }
+
+    _ppu.connect_game_pak(_game_pak);
+    _region = _game_pak ? _game_pak->region() : Region::Ntsc;
+    _apu.set_region(_region);
+    _scheduler.reset();
+    update_ppu_lockstep();
+
+    return !!_game_pak;
+}
+
+
+void Nes::reset(bool coldstart)
+{
+    _cpu.reset(coldstart);
+    _ppu.reset(coldstart);
+    _apu.reset(coldstart);
+
+    if (_game_pak)
+        _game_pak->reset(coldstart);
+
+    _cpu_time = 0;
+    _ppu_time = 0;
+    _ppu_event_time = 0;
+    _scheduler.reset();
+    update_ppu_lockstep();
+    joy1.latch = 0;
+    joy2.latch = 0;
+    memset(_ppu._screen.data(), 0, _ppu._screen.size());
+
+    // Power on RAM contents are unspecified (and differ between consoles), clear them so runs are reproducible
+    if (coldstart)
+        memset(_ram, 0, RamSize);
+}
+
+
+void Nes::run_frame()
+{
+    uint32_t f = _ppu.frame_number();
+    clock_while([&]() { return _ppu.frame_number() == f; });
+    _apu.flush();
+    _scheduler.schedule(Scheduler::Apu, 0);
+
+    if (_hashing)
+    {
+        // The PPU has just started the next frame, the screen holds the whole of the one which finished
+        _frame_hash = hash64(_ppu._screen.data(), _ppu._screen.size());
+        _ram_hash = hash64(_ram, RamSize);
+    }
+}
+
+
+void Nes::step_instruction()
+{
+    uint16_t pc = _cpu._pc;
+    clock_while([&]() { return !_cpu._stopped && (_cpu._pc == pc); });
+}
+
+
+void Nes::connect_event_log(EventLog* event_log)
+{
+    _event_log = event_log;
+    _cpu.connect_event_log(event_log);
+    update_ppu_lockstep();
+
+    if (_game_pak)
+        _game_pak->connect_event_log(event_log);
+}
+
+
+float Nes::frame_time() const
+{
+    switch (_region)
+    {
+        case Region::Pal:
+            return 1.0f / PalTiming::FrameRate;
+        case Region::Dendy:
+            return 1.0f / DendyTiming::FrameRate;
+        default:
+            return 1.0f / NtscTiming::FrameRate;
+    }
+}
+
+
+uint16_t Nes::scanlines() const
+{
+    switch (_region)
+    {
+        case Region::Pal:
+            return PalTiming::LastScanline + 2;
+        case Region::Dendy:
+            return DendyTiming::LastScanline + 2;
+        default:
+            return NtscTiming::LastScanline + 2;
+    }
+}
+
+
+void Nes::save_state(State& state) const
+{
+    const uint8_t* prg_ram = _game_pak ? _game_pak->prg_ram() : nullptr;
+    const uint8_t* chr_ram = _game_pak ? _game_pak->chr_ram() : nullptr;
+
+    state.version = State::Version;
+    state.prg_ram_size = prg_ram ? uint16_t(Mapper::PrgRamSize) : 0;
+    state.chr_ram_size = chr_ram ? uint16_t(_game_pak->chr_ram_size()) : 0;
+    state.size = uint32_t(state.cart_ram.data() - (const uint8_t*)&state) + state.prg_ram_size + state.chr_ram_size;
+    state.cpu_time = _cpu_time;
+    state.ppu_time = _ppu_time;
+    state.ppu_event_time = _ppu_event_time;
+    state.scheduler = _scheduler;
+    _cpu.save_state(state.cpu);
+    _ppu.save_state(state.ppu);
+    _apu.save_state(state.apu);
+    state.mapper = {};
+
+    if (_game_pak)
+        _game_pak->save_state(state.mapper);
+
+    memcpy(state.ram.data(), _ram, RamSize);
+    state.joy1 = joy1;
+    state.joy2 = joy2;
+
+    if (prg_ram)
+        memcpy(state.cart_ram.data(), prg_ram, state.prg_ram_size);
+
+    if (chr_ram)
+        memcpy(state.cart_ram.data() + state.prg_ram_size, chr_ram, state.chr_ram_size);
+}
+
+
+bool Nes::load_state(const State& state)
+{
+    uint8_t* prg_ram = _game_pak ? _game_pak->prg_ram() : nullptr;
+    uint8_t* chr_ram = _game_pak ? _game_pak->chr_ram() : nullptr;
+
+    if (state.version != State::Version || state.prg_ram_size != (prg_ram ? Mapper::PrgRamSize : 0) ||
+        state.chr_ram_size != (chr_ram ? _game_pak->chr_ram_size() : 0))
+    {
+        return false;
+    }
+
+    // The game pak goes first, the PPU takes its nametable mirroring from the mapper
+    if (_game_pak)
+        _game_pak->load_state(state.mapper);
+
+    if (prg_ram)
+        memcpy(prg_ram, state.cart_ram.data(), state.prg_ram_size);
+
+    if (chr_ram)
+        memcpy(chr_ram, state.cart_ram.data() + state.prg_ram_size, state.chr_ram_size);
+
+    _cpu.load_state(state.cpu);
+    _ppu.load_state(state.ppu);
+    _apu.load_state(state.apu);
+    memcpy(_ram, state.ram.data(), RamSize);
+    joy1 = state.joy1;
+    joy2 = state.joy2;
+    _cpu_time = state.cpu_time;
+    _ppu_time = state.ppu_time;
+    _ppu_event_time = state.ppu_event_time;
+    _scheduler = state.scheduler;
+    update_ppu_lockstep();
+
+    return true;
+}
+
+
+uint8_t Nes::read(uint16_t address)
+{
+    uint8_t value = 0; // TODO: open bus behavior (make this static)
+
+    if (address <= CpuMemoryMap::RAM_TOP)
+    {
+        address = CpuMemoryMap::RAM_BASE + (address & 0x7FF);
+        value = _ram[address];
+    }
+    else if (address <= CpuMemoryMap::PPU_REG_TOP)
+    {
+        catch_up_ppu();
+        value = _ppu.cpu_read(address);
+    }
+    else if (address <= CpuMemoryMap::APU_IO_TOP)
+    {
+        if (address == APU_STATUS)
+        {
+            value = _apu.cpu_read(address);
+            _scheduler.schedule(Scheduler::Apu, 0);
+        }
+        else if (address == JOY1)
+        {
+            set_bit(value, 0, get_bit(joy1.latch, 7));
+            joy1.latch <<= 1;
+        }
+        else if (address == JOY2)
+        {
+            set_bit(value, 0, get_bit(joy2.latch, 7));
+            joy2.latch <<= 1;
+        }
+    }
+    else if (_game_pak)
+    {
+        value = _game_pak->cpu_read(address);
+    }
+
+    return value;
+}
+
+
+void Nes::write(uint16_t address, uint8_t value)
+{
+    if (address <= CpuMemoryMap::RAM_TOP)
+    {
+        address = CpuMemoryMap::RAM_BASE + (address & 0x7FF);
+        _ram[address] = value;
+    }
+    else if (address <= CpuMemoryMap::PPU_REG_TOP)
+    {
+        catch_up_ppu();
+
+        // OAM DMA's writes to $2004 are covered by the $4014 event
+        if (_event_log && !_cpu.dma_active())
+            _event_log->record(EventLog::EventType::PpuRegisterWrite, PPU_REG_BASE | (address & 7), value);
+
+        _ppu.cpu_write(address, value);
+        update_ppu_lockstep();
+    }
+    else if (address <= CpuMemoryMap::APU_IO_TOP)
+    {
+        if (address == OAMDMA)
+        {
+            _event_log ? _event_log->record(EventLog::EventType::OamDma, address, value) : ((void)0);
+            _cpu.dma(value);
+        }
+        else if (address == JOY1)
+        {
+            if ((value & 1)== 0)
+            {
+                // latch controller values
+                joy1.latch = joy1.buttons;
+                joy2.latch = joy2.buttons;
+            }
+        }
+        else if (address <= Apu::DMC_TOP || address == Apu::STATUS || address == Apu::FRAME_COUNTER)
+        {
+            _apu.cpu_write(address, value);
+            _scheduler.schedule(Scheduler::Apu, 0);
+        }
+    }
+    else if (_game_pak)
+    {
+        // Mapper writes can change the PPU's memory map (and enable an IRQ clocked by the PPU)
+        catch_up_ppu();
+        _game_pak->cpu_write(address, value);
+        update_ppu_lockstep();
+    }
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include "apu.h"
+#include "gamepak.h"
+#include "gli2a03.h"
+#include "gli2c02.h"
+#include "region.h"
+#include "scheduler.h"
+
+class EventLog;
+
+/*
+    The console without any front end: CPU, PPU, APU, work RAM, controllers and the game pak wired up to the CPU bus, and the system
+    clock driving them at the game pak's region timing.
+
+    Time is kept in master clocks. The CPU is clocked a cycle at a time up to the scheduler's next deadline, the PPU and APU run behind
+    it and are only caught up when the CPU accesses them or a deadline is reached (see Scheduler). A CPU cycle comes before the PPU
+    dot and APU event on the same master clock.
+*/
+class Nes
+{
+public:
+    static constexpr size_t RamSize = 2 * 1024;
+
+    // Bus
+    enum CpuMemoryMap
+    {
+        RAM_BASE = 0x0000,
+        RAM_TOP = 0x1FFF,
+        PPU_REG_BASE = 0x2000,
+        PPU_REG_TOP = 0x3FFF,
+        APU_IO_BASE = 0x4000,
+        OAMDMA = 0x4014,
+        APU_STATUS = 0x4015,
+        JOY1 = 0x4016,
+        JOY2 = 0x4017,
+        APU_IO_TOP = 0x401F,
+        CART_BASE = 0x4020,
+    };
+
+    struct ControllerState
+    {
+        uint8_t latch;
+
+        union
+        {
+            uint8_t buttons;
+
+            struct
+            {
+                uint8_t right : 1;
+                uint8_t left : 1;
+                uint8_t down : 1;
+                uint8_t up : 1;
+                uint8_t start : 1;
+                uint8_t select : 1;
+                uint8_t b : 1;
+                uint8_t a : 1;
+            };
+        };
+    };
+
+
+    /*
+        Everything that changes as the console runs, gathered into plain data so saving or loading a state is a copy of each part's
+        block. Only the game pak's RAM is copied, into the end of cart_ram, not its ROM - a state can only be loaded with the same game
+        pak loaded. size covers the part of cart_ram the game pak uses, copying the first size bytes is enough to keep a state.
+    */
+    struct State
+    {
+        static constexpr uint32_t Version = 4;
+
+        uint32_t version;
+        uint32_t size;
+        uint64_t cpu_time;
+        uint64_t ppu_time;
+        uint64_t ppu_event_time;
+        Scheduler scheduler;
+        gli2A03::State cpu;
+        gli2C02::State ppu;
+        Apu::State apu;
+        Mapper::State mapper;
+        std::array<uint8_t, RamSize> ram;
+        ControllerState joy1;
+        ControllerState joy2;
+        uint16_t prg_ram_size;
+        uint16_t chr_ram_size;
+        std::array<uint8_t, Mapper::PrgRamSize + GamePak::MaxChrRamSize> cart_ram;  // PRG RAM then CHR RAM
+    };
+
+
+    Nes();
+    ~Nes() = default;
+
+    // The CPU's bus callbacks point at this object
+    Nes(const Nes&) = delete;
+    Nes& operator=(const Nes&) = delete;
+
+    bool load_game_pak(const std::string& path);
+    bool load_game_pak(std::istream& is);
+    void reset(bool coldstart);
+
+    // Clock until the PPU starts the next frame, the APU's samples are flushed up to the end of it
+    void run_frame();
+
+    // Clock until the CPU moves on to another instruction (or stops)
+    void step_instruction();
+
+    void connect_event_log(EventLog* event_log);
+
+    // When enabled run_frame() hashes the finished frame and work RAM, the PPU must be rendering inline (no deferred renderer) to its
+    // own screen (no render target)
+    void set_hashing(bool enable) { _hashing = enable; }
+    uint64_t frame_hash() const { return _frame_hash; }
+    uint64_t ram_hash() const { return _ram_hash; }
+
+    Region region() const { return _region; }
+    float frame_time() const;
+    uint16_t scanlines() const;     // Per frame, including the pre-render scanline
+
+    // Loading fails if the state is from another version or doesn't fit the game pak's RAM
+    void save_state(State& state) const;
+    bool load_state(const State& state);
+
+    uint8_t read(uint16_t address);
+    void write(uint16_t address, uint8_t value);
+
+    gli2A03 _cpu;
+    gli2C02 _ppu;
+    Apu _apu;
+    std::shared_ptr<GamePak> _game_pak;
+    uint8_t _ram[RamSize];
+    ControllerState joy1{};
+    ControllerState joy2{};
+
+private:
+    EventLog* _event_log = nullptr;
+    Region _region = Region::Ntsc;
+    Scheduler _scheduler;
+    uint64_t _cpu_time = 0;     // Master clock of the last CPU cycle
+    uint64_t _ppu_time = 0;     // Master clock of the last PPU dot
+    uint64_t _ppu_event_time = 0;   // Master clock of the PPU's next vblank or frame start
+    bool _ppu_lockstep = false;     // The PPU is run up to each CPU cycle, see schedule_ppu()
+    bool _hashing = false;
+    uint64_t _frame_hash = 0;
+    uint64_t _ram_hash = 0;
+
+
+    template <class Timing>
+    void dispatch();
+
+    template <class Timing>
+    void catch_up_ppu(uint64_t time);
+    void catch_up_ppu();
+
+    template <class Timing>
+    void schedule_ppu();
+    void update_ppu_lockstep();
+
+    template <class Timing>
+    void schedule_apu();
+
+    template <class Timing, class Predicate>
+    void clock_region_while(Predicate predicate);
+
+    template <class Predicate>
+    void clock_while(Predicate predicate);
+};
+
+
+static_assert(std::is_trivially_copyable<Nes::State>::value, "Nes::State must be copyable as bytes");
@@ -0,0 +1,234 @@
+#include "ntsc_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+static constexpr int SamplesPerPixel = 8;
+static constexpr int WindowSize = 12;
+
+// Phase offset (in samples) between the colour burst and the PPU's colour generator
+static constexpr double HueOffset = 3.9;
+
+// Kernel entries are 10-bit fixed point (1.0 = 1024) per channel, biased to keep the packed 16-bit lanes positive
+static constexpr int ChannelScale = 1024;
+static constexpr int ChannelBias = 0x1000;
+
+
+static bool in_color_phase(int color, int phase)
+{
+    return ((color + phase) % 12) < 6;
+}
+
+
+static double ntsc_signal(uint16_t pixel, int phase)
+{
+    /*
+        https://wiki.nesdev.com/w/index.php/NTSC_video
+
+        The PPU generates a square wave between a low and a high level for each colour, with the phase of the wave selected by the
+        hue (low 4 bits of the colour). Hue 0 is the high level only, hues $D-$F are the low level only. The emphasis bits attenuate
+        the signal during the part of the subcarrier cycle that corresponds to the emphasized colour.
+    */
+    static const double levels[8] = {
+        0.228, 0.312, 0.552, 0.880, // Signal low
+        0.616, 0.840, 1.100, 1.100, // Signal high
+    };
+
+    static constexpr double black = 0.312;
+    static constexpr double white = 1.100;
+    static constexpr double attenuation = 0.746;
+
+    int color = pixel & 0x0F;
+    int level = (pixel >> 4) & 0x3;
+    int emphasis = (pixel >> 6) & 0x7;
+
+    if (color > 13)
+        level = 1;
+
+    double low = levels[level + 4 * (color == 0x0)];
+    double high = levels[level + 4 * (color < 0xD)];
+    double signal = in_color_phase(color, phase) ? high : low;
+
+    if (((emphasis & 1) && in_color_phase(0, phase)) ||
+        ((emphasis & 2) && in_color_phase(4, phase)) ||
+        ((emphasis & 4) && in_color_phase(8, phase)))
+    {
+        signal *= attenuation;
+    }
+
+    return (signal - black) / (white - black);
+}
+
+
+NtscFilter::NtscFilter()
+{
+    const double pi = std::acos(-1.0);
+
+    _kernels.resize(size_t(3) * ChunkOutputs * KernelInputs * 512);
+
+    for (int output = 0; output < ChunkOutputs; ++output)
+    {
+        // Window of samples (relative to the start of the chunk) decoded for this output pixel
+        int centre = ((2 * output + 1) * ChunkInputs * SamplesPerPixel + ChunkOutputs) / (2 * ChunkOutputs);
+        int window_first = centre - WindowSize / 2;
+        int window_last = window_first + WindowSize;
+
+        _first_input[output] = int8_t(window_first >= 0 ? window_first / SamplesPerPixel : -1);
+
+        for (int phase = 0; phase < 3; ++phase)
+        {
+            for (int input = 0; input < KernelInputs; ++input)
+            {
+                int pixel_first = (_first_input[output] + input) * SamplesPerPixel;
+                int pixel_last = pixel_first + SamplesPerPixel;
+                uint64_t* entries = _kernels.data() + ((size_t(phase) * ChunkOutputs + output) * KernelInputs + input) * 512;
+
+                for (uint16_t color = 0; color < 512; ++color)
+                {
+                    double y = 0.0;
+                    double i = 0.0;
+                    double q = 0.0;
+
+                    for (int sample = std::max(window_first, pixel_first); sample < std::min(window_last, pixel_last); ++sample)
+                    {
+                        // Each scanline starts 4 samples further into the subcarrier cycle than the last
+                        int sample_phase = ((phase * 4 + sample) % 12 + 12) % 12;
+                        double level = ntsc_signal(color, sample_phase) / WindowSize;
+                        y += level;
+                        i += level * std::cos(pi * (sample_phase + HueOffset) / 6.0);
+                        q += level * std::sin(pi * (sample_phase + HueOffset) / 6.0);
+                    }
+
+                    double rgb[3] = {
+                        y + 0.946882 * i + 0.623557 * q,
+                        y - 0.274788 * i - 0.635691 * q,
+                        y - 1.108545 * i + 1.709007 * q,
+                    };
+
+                    uint64_t entry = 0;
+
+                    for (int channel = 0; channel < 3; ++channel)
+                    {
+                        long value = std::lround(rgb[channel] * ChannelScale) + ChannelBias;
+                        entry |= uint64_t(value & 0xFFFF) << (channel * 16);
+                    }
+
+                    entries[color] = entry;
+                }
+            }
+        }
+    }
+}
+
+
+void NtscFilter::filter(const uint16_t* src, uint32_t src_stride, uint32_t* dest, uint32_t dest_stride, int height, uint8_t burst_phase) const
+{
+    int threads = std::min(_threads, height);
+
+    if (threads <= 1)
+    {
+        filter_lines(src, src_stride, dest, dest_stride, 0, height, burst_phase);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+
+    for (int band = 1; band < threads; ++band)
+    {
+        int first = (height * band) / threads;
+        int last = (height * (band + 1)) / threads;
+        workers.emplace_back(&NtscFilter::filter_lines, this, src, src_stride, dest, dest_stride, first, last, burst_phase);
+    }
+
+    filter_lines(src, src_stride, dest, dest_stride, 0, height / threads, burst_phase);
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+
+void NtscFilter::filter_lines(const uint16_t* src, uint32_t src_stride, uint32_t* dest, uint32_t dest_stride, int first, int last,
+    uint8_t burst_phase) const
+{
+    // Input is padded with black so kernels overlapping the edges of the scanline don't need special casing
+    constexpr uint16_t Black = 0x0F;
+    constexpr int Padding = 1;
+    constexpr int PaddedWidth = Padding + ChunkCount * ChunkInputs + KernelInputs;
+
+    uint16_t pixels[PaddedWidth];
+    alignas(32) uint64_t sums[ChunkCount * ChunkOutputs];
+
+    std::fill_n(pixels, PaddedWidth, Black);
+
+    for (int line = first; line < last; ++line)
+    {
+        const uint16_t* in = src + size_t(line) * src_stride;
+        uint32_t* out = dest + size_t(line) * dest_stride;
+        int phase = (burst_phase + line) % 3;
+
+        for (int x = 0; x < InputWidth; ++x)
+        {
+            pixels[Padding + x] = in[x] & 0x1FF;
+        }
+
+        for (int output = 0; output < ChunkOutputs; ++output)
+        {
+            const uint64_t* k0 = kernel(phase, output, 0);
+            const uint64_t* k1 = kernel(phase, output, 1);
+            const uint64_t* k2 = kernel(phase, output, 2);
+            const uint16_t* p = pixels + Padding + _first_input[output];
+            uint64_t* sum = sums + output;
+
+            for (int chunk = 0; chunk < ChunkCount; ++chunk)
+            {
+                *sum = k0[p[0]] + k1[p[1]] + k2[p[2]];
+                p += ChunkInputs;
+                sum += ChunkOutputs;
+            }
+        }
+
+        // Remove the bias, clamp and pack to 8 bits per channel
+        int x = 0;
+
+#if defined(__AVX2__)
+        const __m256i bias = _mm256_set1_epi16(short(ChannelBias * KernelInputs));
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i full = _mm256_set1_epi16(ChannelScale - 1);
+        const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+
+        for (; x + 4 <= OutputWidth; x += 4)
+        {
+            __m256i rgb = _mm256_load_si256((const __m256i*)(sums + x));
+            rgb = _mm256_sub_epi16(rgb, bias);
+            rgb = _mm256_min_epi16(_mm256_max_epi16(rgb, zero), full);
+            rgb = _mm256_srli_epi16(rgb, 2);
+            rgb = _mm256_packus_epi16(rgb, rgb);
+            rgb = _mm256_permute4x64_epi64(rgb, 0x08);
+            _mm_storeu_si128((__m128i*)(out + x), _mm_or_si128(_mm256_castsi256_si128(rgb), alpha));
+        }
+#endif
+
+        for (; x < OutputWidth; ++x)
+        {
+            uint32_t pixel = 0xFF000000;
+
+            for (int channel = 0; channel < 3; ++channel)
+            {
+                int value = int((sums[x] >> (channel * 16)) & 0xFFFF) - ChannelBias * KernelInputs;
+                value = std::min(std::max(value, 0), ChannelScale - 1);
+                pixel |= uint32_t(value >> 2) << (channel * 8);
+            }
+
+            out[x] = pixel;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+    NTSC composite video filter for 9-bit PPU output (see gli2C02::set_emphasis_output).
+
+    Each PPU pixel produces 8 samples of composite signal (12 samples per colour subcarrier cycle), which are decoded back to RGB with
+    a 12 sample window centred on each output pixel - this reproduces the artifact colours of the real hardware. Like blargg's nes_ntsc,
+    every 3 input pixels become 7 output pixels, so 256 input pixels produce 602 output pixels per scanline. The burst phase changes
+    every scanline and every frame, which produces the dot crawl.
+
+    Decoding is linear, so the RGB contribution of each colour to each of the 7 output pixels of a chunk is precomputed for the three
+    burst phases; filtering is then three table lookups and adds per output pixel.
+
+    Output pixels are 32-bit with the bytes in R, G, B, A order in memory, matching RgbaConverter.
+*/
+class NtscFilter
+{
+public:
+    static constexpr int InputWidth = 256;
+    static constexpr int OutputWidth = 602;
+
+    NtscFilter();
+    ~NtscFilter() = default;
+
+    // Number of threads the scanlines are split across (including the calling thread)
+    void set_threads(int threads) { _threads = threads < 1 ? 1 : threads; }
+
+    void filter(const uint16_t* src, uint32_t src_stride, uint32_t* dest, uint32_t dest_stride, int height, uint8_t burst_phase) const;
+
+private:
+    static constexpr int ChunkInputs = 3;
+    static constexpr int ChunkOutputs = 7;
+    static constexpr int ChunkCount = OutputWidth / ChunkOutputs;
+    static constexpr int KernelInputs = 3;
+
+    /*
+        Packed RGB contribution of an input pixel to an output pixel, 16 bits per channel biased so that the sum of KernelInputs entries
+        can be done with a single 64-bit add. Indexed [burst phase][output pixel in chunk][input pixel in kernel][colour].
+    */
+    std::vector<uint64_t> _kernels;
+
+    // First input pixel (relative to the start of the chunk) contributing to each output pixel in a chunk
+    std::array<int8_t, ChunkOutputs> _first_input;
+
+    int _threads = 1;
+
+    const uint64_t* kernel(int phase, int output, int input) const
+    {
+        return _kernels.data() + ((size_t(phase) * ChunkOutputs + output) * KernelInputs + input) * 512;
+    }
+
+    void filter_lines(const uint16_t* src, uint32_t src_stride, uint32_t* dest, uint32_t dest_stride, int first, int last,
+        uint8_t burst_phase) const;
+};
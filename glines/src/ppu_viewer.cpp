@@ -0,0 +1,235 @@
+#include "ppu_viewer.h"
+
+#include "gamepak.h"
+#include "gli2c02.h"
+
+#include <cstring>
+
+
+void PpuViewer::update(const gli2C02& ppu, uint8_t pattern_palette)
+{
+    update_tiles(ppu);
+    update_palette(ppu);
+    update_pattern_tables(pattern_palette & 7);
+    update_nametables(ppu);
+    update_sprites(ppu);
+
+    _valid = true;
+}
+
+
+void PpuViewer::update_tiles(const gli2C02& ppu)
+{
+    /*
+        Pattern data is copied straight out of CHR memory using the mapper's bank map. Mappers which can't provide one fall back to
+        peeking through the game pak, which is slower but still free of side effects.
+    */
+    std::array<uint32_t, 8> banks{};
+    const uint8_t* chr = nullptr;
+    size_t chr_size = 0;
+
+    if (ppu._game_pak)
+    {
+        const std::vector<uint8_t>& chr_rom = ppu._game_pak->chr_rom();
+
+        if (!chr_rom.empty() && ppu._game_pak->ppu_chr_banks(banks))
+        {
+            chr = chr_rom.data();
+            chr_size = chr_rom.size();
+        }
+    }
+    else if (ppu._chr)
+    {
+        // One of the deferred renderer's copies of the PPU, its banks are already inside its CHR snapshot
+        chr = ppu._chr;
+        banks = ppu._chr_banks;
+    }
+
+    _tiles_changed.reset();
+
+    for (uint16_t tile = 0; tile < TileCount; ++tile)
+    {
+        uint16_t address = tile << 4;
+        std::array<uint8_t, 16> bytes{};
+
+        if (chr)
+        {
+            uint32_t bank = chr_size ? uint32_t(banks[address >> 10] % chr_size) : banks[address >> 10];
+            memcpy(bytes.data(), chr + bank + (address & 0x3FF), bytes.size());
+        }
+        else if (ppu._game_pak)
+        {
+            for (uint8_t i = 0; i < 16; ++i)
+            {
+                ppu._game_pak->ppu_peek(address + i, bytes[i]);
+            }
+        }
+
+        if (_valid && bytes == _tile_bytes[tile])
+        {
+            continue;
+        }
+
+        _tile_bytes[tile] = bytes;
+        _tiles_changed.set(tile);
+
+        for (uint8_t y = 0; y < 8; ++y)
+        {
+            for (uint8_t x = 0; x < 8; ++x)
+            {
+                uint8_t lsb = (bytes[y] >> (7 - x)) & 1;
+                uint8_t msb = (bytes[y + 8] >> (7 - x)) & 1;
+                _tile_pixels[tile][(y << 3) | x] = (msb << 1) | lsb;
+            }
+        }
+    }
+}
+
+
+void PpuViewer::update_palette(const gli2C02& ppu)
+{
+    std::array<uint8_t, 0x20> palette;
+
+    for (uint8_t i = 0; i < 0x20; ++i)
+    {
+        // $3F10/$3F14/$3F18/$3F1C mirror $3F00/$3F04/$3F08/$3F0C
+        palette[i] = ppu._palette[((i & 0x13) == 0x10) ? (i & 0x0F) : i];
+    }
+
+    _palettes_changed = 0;
+
+    for (uint8_t i = 0; i < 8; ++i)
+    {
+        if (!_valid || palette[0] != _palette[0] || memcmp(&palette[i << 2], &_palette[i << 2], 4) != 0)
+            _palettes_changed |= 1 << i;
+    }
+
+    _palette = palette;
+}
+
+
+void PpuViewer::update_pattern_tables(uint8_t pattern_palette)
+{
+    bool redraw_all = !_valid || pattern_palette != _pattern_palette || (_palettes_changed & (1 << pattern_palette));
+    _pattern_palette = pattern_palette;
+
+    for (uint16_t tile = 0; tile < TileCount; ++tile)
+    {
+        if (!redraw_all && !_tiles_changed[tile])
+            continue;
+
+        uint8_t index = tile & 0xFF;
+        uint8_t* dest = _pattern_tables[tile >> 8].data() + ((index >> 4) << 3) * PatternTableSize + ((index & 0xF) << 3);
+        draw_tile(dest, PatternTableSize, tile, pattern_palette);
+    }
+}
+
+
+void PpuViewer::update_nametables(const gli2C02& ppu)
+{
+    // All four logical nametables with the current mirroring, attributes come from the PPU's expanded attribute cache
+    uint16_t pattern_table = ppu._ppuctrl.B << 8;
+
+    for (uint8_t nametable = 0; nametable < 4; ++nametable)
+    {
+        uint8_t physical = ppu._nametable_map[nametable];
+        const uint8_t* names = ppu._ram.data() + (physical << 10);
+        const std::array<uint8_t, NametableTiles>& attributes = ppu._attribute_cache[physical];
+        uint8_t* origin = _nametables.data() + (nametable >> 1) * 240 * NametableWidth + (nametable & 1) * 256;
+
+        for (uint16_t i = 0; i < NametableTiles; ++i)
+        {
+            uint16_t tile = pattern_table | names[i];
+            uint8_t palette = attributes[i];
+
+            if (_valid && tile == _nametable_tiles[nametable][i] && palette == _nametable_palettes[nametable][i] &&
+                !_tiles_changed[tile] && !(_palettes_changed & (1 << palette)))
+            {
+                continue;
+            }
+
+            _nametable_tiles[nametable][i] = tile;
+            _nametable_palettes[nametable][i] = palette;
+            draw_tile(origin + (i >> 5) * 8 * NametableWidth + (i & 31) * 8, NametableWidth, tile, palette);
+        }
+    }
+}
+
+
+void PpuViewer::update_sprites(const gli2C02& ppu)
+{
+    _oam = ppu._oam;
+
+    for (uint8_t sprite = 0; sprite < 64; ++sprite)
+    {
+        uint8_t tile_index = _oam[(sprite << 2) + 1];
+        uint8_t attributes = _oam[(sprite << 2) + 2];
+        uint8_t palette = (attributes & 3) + 4;
+        bool flip_x = (attributes & 0x40) != 0;
+        bool flip_y = (attributes & 0x80) != 0;
+
+        uint16_t top;
+        uint16_t bottom;
+
+        if (ppu._ppuctrl.H)
+        {
+            top = ((tile_index & 1) << 8) | (tile_index & 0xFE);
+            bottom = top + 1;
+        }
+        else
+        {
+            top = (ppu._ppuctrl.S << 8) | tile_index;
+            bottom = top;
+        }
+
+        uint32_t key = tile_index | ((attributes & 0xC3) << 8) | (ppu._ppuctrl.H << 16) | (ppu._ppuctrl.S << 17);
+
+        if (_valid && key == _sprite_keys[sprite] && !_tiles_changed[top] && !_tiles_changed[bottom] && !(_palettes_changed & (1 << palette)))
+        {
+            continue;
+        }
+
+        _sprite_keys[sprite] = key;
+        uint8_t* dest = _sprites.data() + (sprite >> 3) * 16 * SpriteSheetWidth + (sprite & 7) * 8;
+
+        if (ppu._ppuctrl.H)
+        {
+            draw_tile(dest, SpriteSheetWidth, flip_y ? bottom : top, palette, flip_x, flip_y);
+            draw_tile(dest + 8 * SpriteSheetWidth, SpriteSheetWidth, flip_y ? top : bottom, palette, flip_x, flip_y);
+        }
+        else
+        {
+            draw_tile(dest, SpriteSheetWidth, top, palette, flip_x, flip_y);
+
+            for (uint8_t y = 8; y < 16; ++y)
+            {
+                memset(dest + y * SpriteSheetWidth, _palette[0], 8);
+            }
+        }
+    }
+}
+
+
+void PpuViewer::draw_tile(uint8_t* dest, uint32_t stride, uint16_t tile, uint8_t palette, bool flip_x, bool flip_y)
+{
+    const std::array<uint8_t, 64>& pixels = _tile_pixels[tile];
+    const uint8_t colors[4] = { _palette[0], _palette[(palette << 2) | 1], _palette[(palette << 2) | 2], _palette[(palette << 2) | 3] };
+
+    for (uint8_t y = 0; y < 8; ++y)
+    {
+        const uint8_t* row = pixels.data() + ((flip_y ? 7 - y : y) << 3);
+
+        if (flip_x)
+        {
+            for (uint8_t x = 0; x < 8; ++x)
+                dest[x] = colors[row[7 - x]];
+        }
+        else
+        {
+            for (uint8_t x = 0; x < 8; ++x)
+                dest[x] = colors[row[x]];
+        }
+
+        dest += stride;
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+
+class gli2C02;
+
+/*
+    Debug views of the PPU's pattern tables, nametables, sprites and palettes for the inspector.
+
+    Views are built directly from the PPU's memories and the game pak's CHR memory (through the mapper's bank map) rather than through
+    the PPU or mapper read paths, so building them never affects emulated state. Decoded tiles are cached and each update only redraws
+    the parts of the views whose pattern bytes, palette colours or tile selection changed since the last update.
+
+    All views are 8-bit palette indices.
+*/
+class PpuViewer
+{
+public:
+    static constexpr int PatternTableSize = 128;
+    static constexpr int NametableWidth = 512;
+    static constexpr int NametableHeight = 480;
+    static constexpr int SpriteSheetWidth = 64;    // 8 columns of 8x16 cells, 8x8 sprites use the top half
+    static constexpr int SpriteSheetHeight = 128;
+
+    PpuViewer() = default;
+    ~PpuViewer() = default;
+
+    void update(const gli2C02& ppu, uint8_t pattern_palette);
+
+    const std::array<uint8_t, PatternTableSize * PatternTableSize>& pattern_table(uint8_t table) const { return _pattern_tables[table & 1]; }
+    const std::array<uint8_t, NametableWidth * NametableHeight>& nametables() const { return _nametables; }
+    const std::array<uint8_t, SpriteSheetWidth * SpriteSheetHeight>& sprites() const { return _sprites; }
+    const std::array<uint8_t, 0x20>& palette() const { return _palette; }
+    const std::array<uint8_t, 0x100>& oam() const { return _oam; }
+
+private:
+    static constexpr uint16_t TileCount = 512;
+    static constexpr uint16_t NametableTiles = 960;
+
+    // Pattern data as of the last update and decoded to 2-bit pixels
+    std::array<std::array<uint8_t, 16>, TileCount> _tile_bytes{};
+    std::array<std::array<uint8_t, 64>, TileCount> _tile_pixels{};
+    std::bitset<TileCount> _tiles_changed;
+
+    // Colours with palette RAM mirroring resolved, colour 0 of every palette is the backdrop
+    std::array<uint8_t, 0x20> _palette{};
+    uint8_t _palettes_changed = 0;
+    uint8_t _pattern_palette = 0xFF;
+
+    // Pattern tile (including table) and palette each nametable tile and sprite was last drawn with
+    std::array<std::array<uint16_t, NametableTiles>, 4> _nametable_tiles;
+    std::array<std::array<uint8_t, NametableTiles>, 4> _nametable_palettes;
+    std::array<uint32_t, 64> _sprite_keys;
+    bool _valid = false;
+
+    std::array<uint8_t, 0x100> _oam{};
+    std::array<std::array<uint8_t, PatternTableSize * PatternTableSize>, 2> _pattern_tables{};
+    std::array<uint8_t, NametableWidth * NametableHeight> _nametables{};
+    std::array<uint8_t, SpriteSheetWidth * SpriteSheetHeight> _sprites{};
+
+
+    void update_tiles(const gli2C02& ppu);
+    void update_palette(const gli2C02& ppu);
+    void update_pattern_tables(uint8_t pattern_palette);
+    void update_nametables(const gli2C02& ppu);
+    void update_sprites(const gli2C02& ppu);
+    void draw_tile(uint8_t* dest, uint32_t stride, uint16_t tile, uint8_t palette, bool flip_x = false, bool flip_y = false);
+};
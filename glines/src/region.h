@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+enum class Region : uint8_t
+{
+    Ntsc,
+    Pal,
+    Dendy,
+};
+
+
+/*
+    Timing policies for the PPU and system clocks, selected at compile time so each region's clock loop has its constants folded in.
+
+    Scanlines are numbered as gli2C02 numbers them, -1 being the pre-render scanline. The dividers are from the master clock, the CPU
+    is clocked once every CpuDivider / PpuDivider PPU clocks (3 for NTSC and Dendy, 3.2 for PAL).
+
+    https://wiki.nesdev.com/w/index.php/Cycle_reference_chart
+*/
+struct NtscTiming
+{
+    static constexpr Region region = Region::Ntsc;
+    static constexpr int16_t LastScanline = 260;    // Followed by the pre-render scanline, 262 scanlines in total
+    static constexpr int16_t VblankScanline = 241;  // Vblank flag (and NMI) on dot 1 of this scanline
+    static constexpr bool SkipOddFrameDot = true;   // Last dot of the pre-render scanline is skipped on odd frames
+    static constexpr uint32_t MasterClock = 21477272;   // Hz
+    static constexpr uint32_t CpuDivider = 12;
+    static constexpr uint32_t PpuDivider = 4;
+    static constexpr float FrameRate = 60.0988f;
+};
+
+
+struct PalTiming
+{
+    static constexpr Region region = Region::Pal;
+    static constexpr int16_t LastScanline = 310;    // 312 scanlines
+    static constexpr int16_t VblankScanline = 241;
+    static constexpr bool SkipOddFrameDot = false;
+    static constexpr uint32_t MasterClock = 26601712;
+    static constexpr uint32_t CpuDivider = 16;
+    static constexpr uint32_t PpuDivider = 5;
+    static constexpr float FrameRate = 50.0070f;
+};
+
+
+struct DendyTiming
+{
+    // PAL frame with an NTSC-like CPU ratio, vblank starts 50 scanlines late to keep NTSC games' vblank timing working
+    static constexpr Region region = Region::Dendy;
+    static constexpr int16_t LastScanline = 310;
+    static constexpr int16_t VblankScanline = 291;
+    static constexpr bool SkipOddFrameDot = false;
+    static constexpr uint32_t MasterClock = 26601712;
+    static constexpr uint32_t CpuDivider = 15;
+    static constexpr uint32_t PpuDivider = 5;
+    static constexpr float FrameRate = 50.0070f;
+};
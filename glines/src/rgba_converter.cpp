@@ -0,0 +1,132 @@
+#include "rgba_converter.h"
+
+#include <fstream>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+// Attenuation applied to the colour channels which are not emphasized (matches the ~0.746 signal attenuation of the 2C02)
+static constexpr uint32_t EmphasisAttenuation = 191; // / 256
+
+
+static uint32_t pack_rgba(uint8_t r, uint8_t g, uint8_t b)
+{
+    return uint32_t(r) | (uint32_t(g) << 8) | (uint32_t(b) << 16) | 0xFF000000;
+}
+
+
+bool RgbaConverter::set_palette(const uint8_t* palette, size_t size)
+{
+    if (size >= 512 * 3)
+    {
+        for (size_t i = 0; i < 512; ++i)
+        {
+            const uint8_t* rgb = palette + i * 3;
+            _lut[i] = pack_rgba(rgb[0], rgb[1], rgb[2]);
+        }
+
+        return true;
+    }
+
+    if (size < 64 * 3)
+    {
+        return false;
+    }
+
+    for (uint16_t emphasis = 0; emphasis < 8; ++emphasis)
+    {
+        for (uint16_t color = 0; color < 64; ++color)
+        {
+            uint32_t rgb[3] = { palette[color * 3 + 0], palette[color * 3 + 1], palette[color * 3 + 2] };
+
+            // Columns $E & $F are black and unaffected by emphasis
+            if (emphasis && (color & 0xE) != 0xE)
+            {
+                for (int channel = 0; channel < 3; ++channel)
+                {
+                    if ((emphasis & (1 << channel)) == 0)
+                        rgb[channel] = (rgb[channel] * EmphasisAttenuation) >> 8;
+                }
+            }
+
+            _lut[(emphasis << 6) | color] = pack_rgba(uint8_t(rgb[0]), uint8_t(rgb[1]), uint8_t(rgb[2]));
+        }
+    }
+
+    return true;
+}
+
+
+bool RgbaConverter::load_palette(const std::string& path)
+{
+    std::ifstream f(path, std::ios::binary);
+
+    if (!f)
+    {
+        return false;
+    }
+
+    std::vector<uint8_t> palette(512 * 3);
+    f.read((char*)palette.data(), palette.size());
+
+    return set_palette(palette.data(), size_t(f.gcount()));
+}
+
+
+void RgbaConverter::convert(const uint16_t* src, uint32_t* dest, size_t count) const
+{
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i index_mask = _mm256_set1_epi32(0x1FF);
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i p0 = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+        __m256i p1 = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + i + 8)));
+        p0 = _mm256_and_si256(p0, index_mask);
+        p1 = _mm256_and_si256(p1, index_mask);
+        __m256i c0 = _mm256_i32gather_epi32((const int*)_lut.data(), p0, 4);
+        __m256i c1 = _mm256_i32gather_epi32((const int*)_lut.data(), p1, 4);
+        _mm256_storeu_si256((__m256i*)(dest + i), c0);
+        _mm256_storeu_si256((__m256i*)(dest + i + 8), c1);
+    }
+#else
+    for (; i + 4 <= count; i += 4)
+    {
+        uint32_t c0 = _lut[src[i + 0] & 0x1FF];
+        uint32_t c1 = _lut[src[i + 1] & 0x1FF];
+        uint32_t c2 = _lut[src[i + 2] & 0x1FF];
+        uint32_t c3 = _lut[src[i + 3] & 0x1FF];
+        dest[i + 0] = c0;
+        dest[i + 1] = c1;
+        dest[i + 2] = c2;
+        dest[i + 3] = c3;
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        dest[i] = _lut[src[i] & 0x1FF];
+    }
+}
+
+
+void RgbaConverter::convert(const uint16_t* src, uint32_t src_stride, uint32_t* dest, uint32_t dest_stride, int w, int h) const
+{
+    if (src_stride == uint32_t(w) && dest_stride == uint32_t(w))
+    {
+        convert(src, dest, size_t(w) * size_t(h));
+        return;
+    }
+
+    for (int y = 0; y < h; ++y)
+    {
+        convert(src, dest, size_t(w));
+        src += src_stride;
+        dest += dest_stride;
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+/*
+    Converts 9-bit PPU output (palette index in bits 0-5, PPUMASK emphasis bits in 6-8 - see gli2C02::set_emphasis_output) to 32-bit
+    RGBA pixels with the bytes in R, G, B, A order in memory.
+*/
+class RgbaConverter
+{
+public:
+    RgbaConverter() = default;
+    ~RgbaConverter() = default;
+
+    // Accepts either a 64 entry RGB palette (emphasis is then synthesized) or a full 512 entry palette with emphasis variants
+    bool set_palette(const uint8_t* palette, size_t size);
+    bool load_palette(const std::string& path);
+
+    void convert(const uint16_t* src, uint32_t* dest, size_t count) const;
+    void convert(const uint16_t* src, uint32_t src_stride, uint32_t* dest, uint32_t dest_stride, int w, int h) const;
+
+    uint32_t lookup(uint16_t pixel) const { return _lut[pixel & 0x1FF]; }
+    const uint32_t* lut() const { return _lut.data(); }
+
+private:
+    alignas(32) std::array<uint32_t, 512> _lut{};
+};
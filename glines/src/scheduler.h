@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+/*
+    Deadlines, in master clocks, of the parts of the system which run behind the CPU: the next time each of them could do something
+    the CPU would see without accessing it. The CPU is clocked until the earliest one, then that part is caught up and schedules its
+    next deadline. Accessing a part from the CPU catches it up on the spot, and anything which may move its deadline (e.g. a
+    register write) reschedules it as due immediately.
+
+    There are only a handful of events so the queue is a small array, scanned when a deadline changes rather than every cycle. Events
+    due at the same time are taken in the order they are declared in.
+*/
+class Scheduler
+{
+public:
+    enum Event : uint8_t
+    {
+        Apu,    // Frame IRQ, DMC sample fetch (DMA)
+        Ppu,    // Vblank (NMI), frame start, or every dot while a mapper IRQ is clocked by the PPU
+        EventCount
+    };
+
+
+    void reset()
+    {
+        _deadlines.fill(0);
+        _next_time = 0;
+        _next_event = Event(0);
+    }
+
+
+    void schedule(Event event, uint64_t time)
+    {
+        _deadlines[event] = time;
+        _next_event = Event(0);
+
+        for (uint8_t i = 1; i < EventCount; ++i)
+        {
+            _next_event = _deadlines[i] < _deadlines[_next_event] ? Event(i) : _next_event;
+        }
+
+        _next_time = _deadlines[_next_event];
+    }
+
+
+    uint64_t next_time() const { return _next_time; }
+    Event next_event() const { return _next_event; }
+
+private:
+    std::array<uint64_t, EventCount> _deadlines{};
+    uint64_t _next_time = 0;
+    Event _next_event = Event(0);
+};
@@ -272,6 +272,25 @@ public:
     }
 
 
+    void clear_rect(int x, int y, int w, int h, uint8_t c)
+    {
+        int x0 = std::max(x, 0);
+        int y0 = std::max(y, 0);
+        int x1 = std::min(x + w, screen_width);
+        int y1 = std::min(y + h, screen_height);
+
+        if (x0 >= x1 || y0 >= y1)
+            return;
+
+        uint8_t* backbuffer = m_framebuffer[m_frontbuffer ^ 1];
+
+        for (int py = y0; py < y1; ++py)
+        {
+            memset(backbuffer + x0 + py * screen_width, c, size_t(x1 - x0));
+        }
+    }
+
+
     void draw_line(int x1, int y1, int x2, int y2, uint8_t c)
     {
         int delta_x = x2 - x1;
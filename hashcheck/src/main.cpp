@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch_engine.h"
+#include "corpus.h"
+#include "movie.h"
+#include "nes.h"
+
+/*
+    Headless regression checker: runs every ROM in a corpus for a number of frames, optionally replaying an input movie, hashing each
+    frame's screen and the work RAM, and compares the hashes with the golden files stored with the corpus (see corpus.h).
+
+    Golden files have one line per frame: frame number, frame hash and RAM hash in hex.
+*/
+
+
+template<typename F>
+void die(const F& f)
+{
+    f();
+    exit(1);
+}
+
+
+void usage()
+{
+    printf("Usage:\n");
+    printf("\thashcheck [-j threads] [-u] corpusfile\n");
+    printf("\t-j    number of threads to run the ROMs on (default: hardware threads)\n");
+    printf("\t-u    write the golden files instead of checking against them\n");
+}
+
+
+struct FrameHashes
+{
+    uint64_t frame;
+    uint64_t ram;
+};
+
+
+struct Test
+{
+    CorpusEntry entry;
+    std::vector<MovieFrame> movie;
+
+    // Results
+    std::vector<FrameHashes> hashes;
+    std::string error;
+    bool passed = false;
+    std::string report;
+};
+
+
+bool read_golden(const std::string& path, std::vector<FrameHashes>& hashes)
+{
+    std::ifstream ifs(path);
+
+    if (!ifs)
+        return false;
+
+    uint32_t frame;
+    std::string frame_hash;
+    std::string ram_hash;
+
+    while (ifs >> frame >> frame_hash >> ram_hash)
+    {
+        if (frame != hashes.size())
+            return false;
+
+        hashes.push_back({ strtoull(frame_hash.c_str(), nullptr, 16), strtoull(ram_hash.c_str(), nullptr, 16) });
+    }
+
+    return true;
+}
+
+
+bool write_golden(const std::string& path, const std::vector<FrameHashes>& hashes)
+{
+    FILE* f = fopen(path.c_str(), "w");
+
+    if (!f)
+        return false;
+
+    for (size_t i = 0; i < hashes.size(); ++i)
+    {
+        fprintf(f, "%zu %016llx %016llx\n", i, (unsigned long long)hashes[i].frame, (unsigned long long)hashes[i].ram);
+    }
+
+    return fclose(f) == 0;
+}
+
+
+// Loads the test's movie and ROM, ready to run
+std::unique_ptr<Nes> start_test(Test& test)
+{
+    if (!test.entry.movie.empty() && !read_movie(test.entry.movie, test.movie))
+    {
+        test.error = "unable to read movie " + test.entry.movie;
+        return nullptr;
+    }
+
+    std::unique_ptr<Nes> nes = std::make_unique<Nes>();
+
+    if (!nes->load_game_pak(test.entry.rom))
+    {
+        test.error = "unable to load " + test.entry.rom;
+        return nullptr;
+    }
+
+    nes->reset(true);
+    nes->set_hashing(true);
+    test.hashes.reserve(test.entry.frames);
+    return nes;
+}
+
+
+void check_test(Test& test, bool update)
+{
+    const std::vector<FrameHashes>& hashes = test.hashes;
+
+    if (update)
+    {
+        if (!write_golden(test.entry.golden, hashes))
+            test.error = "unable to write " + test.entry.golden;
+        else
+            test.passed = true;
+
+        return;
+    }
+
+    std::vector<FrameHashes> golden;
+
+    if (!read_golden(test.entry.golden, golden))
+    {
+        test.error = "unable to read " + test.entry.golden;
+        return;
+    }
+
+    char buffer[256];
+
+    for (size_t i = 0; i < hashes.size(); ++i)
+    {
+        if (i >= golden.size())
+        {
+            snprintf(buffer, sizeof(buffer), "golden file ends at frame %zu", i);
+            test.report = buffer;
+            return;
+        }
+
+        if (hashes[i].frame != golden[i].frame || hashes[i].ram != golden[i].ram)
+        {
+            snprintf(buffer, sizeof(buffer), "first difference at frame %zu: %s (frame %016llx expected %016llx, RAM %016llx expected %016llx)",
+                i, hashes[i].frame != golden[i].frame ? (hashes[i].ram != golden[i].ram ? "screen and RAM" : "screen") : "RAM",
+                (unsigned long long)hashes[i].frame, (unsigned long long)golden[i].frame, (unsigned long long)hashes[i].ram,
+                (unsigned long long)golden[i].ram);
+            test.report = buffer;
+            return;
+        }
+    }
+
+    test.passed = true;
+}
+
+
+int main(int argc, char** argv)
+{
+    std::string corpus;
+    int threads = std::max(1, (int)std::thread::hardware_concurrency());
+    bool update = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+
+        if (arg[0] == '-')
+        {
+            if (arg == "-j")
+            {
+                if (++i == argc)
+                {
+                    die(usage);
+                }
+
+                threads = std::max(1, atoi(argv[i]));
+            }
+            else if (arg == "-u")
+            {
+                update = true;
+            }
+            else
+            {
+                die(usage);
+            }
+        }
+        else if (corpus.empty())
+        {
+            corpus = arg;
+        }
+        else
+        {
+            die(usage);
+        }
+    }
+
+    if (corpus.empty())
+    {
+        die(usage);
+    }
+
+    std::vector<CorpusEntry> entries;
+
+    if (!read_corpus(corpus, entries))
+    {
+        die([&]() { printf("Unable to read corpus file [%s]\n", corpus.c_str()); });
+    }
+
+    std::vector<Test> tests(entries.size());
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        tests[i].entry = entries[i];
+    }
+
+    // Each test runs on its own emulator instance, the engine spreads their frames over the threads
+    BatchEngine engine{ uint32_t(threads) };
+
+    for (Test& test : tests)
+    {
+        std::unique_ptr<Nes> nes = start_test(test);
+
+        if (!nes)
+            continue;
+
+        auto input = [&test](Nes& nes, uint32_t frame) {
+            if (frame < test.movie.size())
+            {
+                if (test.movie[frame].commands & 3)
+                    nes.reset((test.movie[frame].commands & 2) != 0);
+
+                nes.joy1.buttons = test.movie[frame].buttons[0];
+                nes.joy2.buttons = test.movie[frame].buttons[1];
+            }
+        };
+
+        auto frame_done = [&test](Nes& nes, uint32_t frame) {
+            test.hashes.push_back({ nes.frame_hash(), nes.ram_hash() });
+            return true;
+        };
+
+        engine.add(std::move(nes), test.entry.frames, input, frame_done);
+    }
+
+    engine.run();
+
+    for (Test& test : tests)
+    {
+        test.error.empty() ? check_test(test, update) : ((void)0);
+    }
+
+    int failures = 0;
+
+    for (const Test& test : tests)
+    {
+        if (test.passed)
+        {
+            printf("%s  %s\n", update ? "UPDATED" : "PASS   ", test.entry.rom.c_str());
+        }
+        else
+        {
+            printf("FAIL     %s: %s\n", test.entry.rom.c_str(), test.error.empty() ? test.report.c_str() : test.error.c_str());
+            ++failures;
+        }
+    }
+
+    printf("%zu tests, %d failed\n", tests.size(), failures);
+    return failures ? 1 : 0;
+}